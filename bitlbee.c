@@ -35,6 +35,13 @@
 
 static gboolean bitlbee_io_new_client( gpointer data, gint fd, b_input_condition condition );
 
+#ifndef _WIN32
+static GSList *worker_pids = NULL;
+static gint worker_respawn_id = 0;
+
+static gboolean bitlbee_daemon_respawn( gpointer data, gint fd, b_input_condition cond );
+#endif
+
 static gboolean try_listen( struct addrinfo *res )
 {
 	int i;
@@ -58,6 +65,13 @@ static gboolean try_listen( struct addrinfo *res )
 	/* TIME_WAIT (?) sucks.. */
 	i = 1;
 	setsockopt( global.listen_socket, SOL_SOCKET, SO_REUSEADDR, &i, sizeof( i ) );
+	
+#ifdef SO_REUSEPORT
+	/* Every worker gets its own listening socket, the kernel will spread
+	   the incoming connections over them. */
+	if( global.conf->runmode == RUNMODE_DAEMON && global.conf->workers != 1 )
+		setsockopt( global.listen_socket, SOL_SOCKET, SO_REUSEPORT, &i, sizeof( i ) );
+#endif
 
 	i = bind( global.listen_socket, res->ai_addr, res->ai_addrlen );
 	if( i == -1 )
@@ -72,14 +86,10 @@ static gboolean try_listen( struct addrinfo *res )
 	return TRUE;
 }
 
-int bitlbee_daemon_init()
+static int bitlbee_listen()
 {
 	struct addrinfo *res, hints, *addrinfo_bind;
 	int i;
-	FILE *fp;
-	
-	log_link( LOGLVL_ERROR, LOGOUTPUT_CONSOLE );
-	log_link( LOGLVL_WARNING, LOGOUTPUT_CONSOLE );
 	
 	memset( &hints, 0, sizeof( hints ) );
 	hints.ai_family = PF_UNSPEC;
@@ -124,10 +134,173 @@ int bitlbee_daemon_init()
 		return( -1 );
 	}
 	
+	/* With several workers on one socket, more than one of them may
+	   wake up for the same connection. */
+	if( global.conf->runmode == RUNMODE_DAEMON && global.conf->workers != 1 )
+		sock_make_nonblocking( global.listen_socket );
+	
 	global.listen_watch_source_id = b_input_add( global.listen_socket, B_EV_IO_READ, bitlbee_io_new_client, NULL );
 	
+	return( 0 );
+}
+
 #ifndef _WIN32
-	if( !global.conf->nofork )
+/* Daemon mode with more than one worker: fork() a few copies of ourselves
+   that each run their own event loop, accept connections on their own
+   listening socket (or on the shared one if SO_REUSEPORT isn't there) and
+   keep the connections they accept. There's nothing shared between them
+   at runtime, so nothing needs locking. Returns in the master and in
+   every worker, global.worker tells which one we are. */
+static void bitlbee_daemon_fork_workers()
+{
+	int n = global.conf->workers, i;
+	
+	if( n <= 0 )
+		n = sysconf( _SC_NPROCESSORS_ONLN );
+	
+	for( i = 1; i < n; i ++ )
+	{
+		pid_t pid = fork();
+		
+		if( pid == -1 )
+		{
+			log_error( "fork" );
+			break;
+		}
+		else if( pid > 0 )
+		{
+			worker_pids = g_slist_append( worker_pids, GINT_TO_POINTER( pid ) );
+			continue;
+		}
+		
+		global.worker = i;
+		g_slist_free( worker_pids );
+		worker_pids = NULL;
+		
+		/* Same as in ForkDaemon mode, don't share random numbers
+		   or event handler state with the master. */
+		srand( time( NULL ) ^ getpid() );
+		b_main_init();
+		
+#ifdef SO_REUSEPORT
+		b_event_remove( global.listen_watch_source_id );
+		closesocket( global.listen_socket );
+		if( bitlbee_listen() != 0 )
+			exit( 1 );
+#endif
+		
+		break;
+	}
+	
+	if( global.worker == 0 && worker_pids )
+	{
+		log_message( LOGLVL_INFO, "Started %d daemon workers.", g_slist_length( worker_pids ) + 1 );
+		worker_respawn_id = b_timeout_add( 1000, bitlbee_daemon_respawn, NULL );
+	}
+}
+
+/* Called from the SIGCHLD handler, so this only marks the worker's slot
+   as free. bitlbee_daemon_respawn() does the rest. */
+void bitlbee_daemon_worker_exited( pid_t pid )
+{
+	GSList *l;
+	
+	for( l = worker_pids; l; l = l->next )
+		if( GPOINTER_TO_INT( l->data ) == pid )
+			l->data = NULL;
+}
+
+/* A replacement worker is fork()ed from the master, so it has all of the
+   master's users, IM connections and event handlers. Start over with a
+   fresh copy of ourselves that keeps only the listening socket. */
+static void bitlbee_daemon_exec_worker( int i )
+{
+	int fd, max = sysconf( _SC_OPEN_MAX );
+	
+	for( fd = 3; fd < max; fd ++ )
+		if( fd != global.listen_socket )
+			close( fd );
+	
+	putenv( g_strdup_printf( "_BITLBEE_WORKER=%d %d", i, global.listen_socket ) );
+	if( global.cwd )
+		fd = chdir( global.cwd );
+	
+	execv( global.argv[0], global.argv );
+	log_error( "execv" );
+	_exit( 1 );
+}
+
+/* Replace workers that died, but only one per second so a worker that
+   crashes right away doesn't keep us busy fork()ing. */
+static gboolean bitlbee_daemon_respawn( gpointer data, gint fd, b_input_condition cond )
+{
+	sigset_t set, old;
+	GSList *l;
+	pid_t pid;
+	int i;
+	
+	for( l = worker_pids, i = 1; l && l->data; l = l->next )
+		i ++;
+	if( l == NULL )
+		return TRUE;
+	
+	/* If the new one dies right away, the SIGCHLD handler has to find
+	   its pid in the list already. */
+	sigemptyset( &set );
+	sigaddset( &set, SIGCHLD );
+	sigprocmask( SIG_BLOCK, &set, &old );
+	
+	pid = fork();
+	if( pid == 0 )
+	{
+		sigprocmask( SIG_SETMASK, &old, NULL );
+		bitlbee_daemon_exec_worker( i );
+	}
+	else if( pid > 0 )
+	{
+		l->data = GINT_TO_POINTER( pid );
+	}
+	
+	sigprocmask( SIG_SETMASK, &old, NULL );
+	
+	if( pid == -1 )
+		log_error( "fork" );
+	else
+		log_message( LOGLVL_INFO, "Started a new daemon worker (pid %d) to replace one that died.", (int) pid );
+	
+	return TRUE;
+}
+#endif
+
+int bitlbee_daemon_init()
+{
+	int i;
+	FILE *fp;
+#ifndef _WIN32
+	char *s;
+#endif
+	
+	log_link( LOGLVL_ERROR, LOGOUTPUT_CONSOLE );
+	log_link( LOGLVL_WARNING, LOGOUTPUT_CONSOLE );
+	
+#ifndef _WIN32
+	/* A replacement for a worker that died, see bitlbee_daemon_respawn().
+	   It uses the master's listening socket, we may not be allowed to
+	   bind() a new one anymore. */
+	if( ( s = getenv( "_BITLBEE_WORKER" ) ) &&
+	    sscanf( s, "%d %d", &global.worker, &global.listen_socket ) == 2 )
+	{
+		global.listen_watch_source_id = b_input_add( global.listen_socket, B_EV_IO_READ, bitlbee_io_new_client, NULL );
+		if( !global.conf->nofork )
+			i = chdir( "/" );
+	}
+	else
+#endif
+	if( bitlbee_listen() != 0 )
+		return( -1 );
+	
+#ifndef _WIN32
+	if( !global.conf->nofork && global.worker == 0 )
 	{
 		i = fork();
 		if( i == -1 )
@@ -152,21 +325,39 @@ int bitlbee_daemon_init()
 	}
 #endif
 	
+#ifndef _WIN32
+	if( global.conf->runmode == RUNMODE_DAEMON && global.conf->workers != 1 &&
+	    global.worker == 0 )
+		bitlbee_daemon_fork_workers();
+#endif
+	
 	if( global.conf->runmode == RUNMODE_FORKDAEMON )
 		ipc_master_load_state( getenv( "_BITLBEE_RESTART_STATE" ) );
 
-	if( global.conf->runmode == RUNMODE_DAEMON || global.conf->runmode == RUNMODE_FORKDAEMON )
+	/* Workers leave the IPC socket and the PID file to the master. */
+	if( ( global.conf->runmode == RUNMODE_DAEMON || global.conf->runmode == RUNMODE_FORKDAEMON ) &&
+	    global.worker == 0 )
 		ipc_master_listen_socket();
 	
 #ifndef _WIN32
-	if( ( fp = fopen( global.conf->pidfile, "w" ) ) )
-	{
-		fprintf( fp, "%d\n", (int) getpid() );
-		fclose( fp );
-	}
-	else
+	/* Done from a timer, so the children are started after we drop root
+	   privileges. */
+	if( global.conf->runmode == RUNMODE_FORKDAEMON )
+		ipc_master_pool_refill();
+#endif
+	
+#ifndef _WIN32
+	if( global.worker == 0 )
 	{
-		log_message( LOGLVL_WARNING, "Warning: Couldn't write PID to `%s'", global.conf->pidfile );
+		if( ( fp = fopen( global.conf->pidfile, "w" ) ) )
+		{
+			fprintf( fp, "%d\n", (int) getpid() );
+			fclose( fp );
+		}
+		else
+		{
+			log_message( LOGLVL_WARNING, "Warning: Couldn't write PID to `%s'", global.conf->pidfile );
+		}
 	}
 #endif
 	
@@ -190,10 +381,11 @@ int bitlbee_inetd_init()
 gboolean bitlbee_io_current_client_read( gpointer data, gint fd, b_input_condition cond )
 {
 	irc_t *irc = data;
-	char line[513];
+	char *line, *nul;
 	int st;
 	
-	st = read( irc->fd, line, sizeof( line ) - 1 );
+	line = iobuf_reserve( irc->readbuffer, IRC_MAX_LINE );
+	st = read( irc->fd, line, IRC_MAX_LINE );
 	if( st == 0 )
 	{
 		irc_abort( irc, 1, "Connection reset by peer" );
@@ -212,16 +404,10 @@ gboolean bitlbee_io_current_client_read( gpointer data, gint fd, b_input_conditi
 		}
 	}
 	
-	line[st] = '\0';
-	if( irc->readbuffer == NULL ) 
-	{
-		irc->readbuffer = g_strdup( line );
-	}
-	else 
-	{
-		irc->readbuffer = g_renew( char, irc->readbuffer, strlen( irc->readbuffer ) + strlen ( line ) + 1 );
-		strcpy( ( irc->readbuffer + strlen( irc->readbuffer ) ), line );
-	}
+	/* Anything after a NUL byte was always ignored, keep it that way. */
+	if( ( nul = memchr( line, '\0', st ) ) )
+		st = nul - line;
+	iobuf_commit( irc->readbuffer, st );
 	
 	irc_process( irc );
 	
@@ -233,7 +419,7 @@ gboolean bitlbee_io_current_client_read( gpointer data, gint fd, b_input_conditi
 	} 
 	
 	/* Very naughty, go read the RFCs! >:) */
-	if( irc->readbuffer && ( strlen( irc->readbuffer ) > 1024 ) )
+	if( irc->readbuffer->len > 1024 )
 	{
 		irc_abort( irc, 0, "Maximum line length exceeded" );
 		return FALSE;
@@ -245,14 +431,14 @@ gboolean bitlbee_io_current_client_read( gpointer data, gint fd, b_input_conditi
 gboolean bitlbee_io_current_client_write( gpointer data, gint fd, b_input_condition cond )
 {
 	irc_t *irc = data;
-	int st, size;
-	char *temp;
+	int st;
 
-	if( irc->sendbuffer == NULL )
+	if( irc->sendbuffer->len == 0 )
 		return FALSE;
 	
-	size = strlen( irc->sendbuffer );
-	st = write( irc->fd, irc->sendbuffer, size );
+	st = iobuf_writev( irc->sendbuffer, irc->fd );
+	if( st > 0 )
+		irc->writes_out ++;
 	
 	if( st == 0 || ( st < 0 && !sockerr_again() ) )
 	{
@@ -264,29 +450,17 @@ gboolean bitlbee_io_current_client_write( gpointer data, gint fd, b_input_condit
 		return TRUE;
 	}
 	
-	if( st == size )
+	if( irc->sendbuffer->len == 0 )
 	{
 		if( irc->status & USTATUS_SHUTDOWN )
-		{
 			irc_free( irc );
-		}
 		else
-		{
-			g_free( irc->sendbuffer );
-			irc->sendbuffer = NULL;
 			irc->w_watch_source_id = 0;
-		}
 		
 		return FALSE;
 	}
-	else
-	{
-		temp = g_strdup( irc->sendbuffer + st );
-		g_free( irc->sendbuffer );
-		irc->sendbuffer = temp;
-		
-		return TRUE;
-	}
+	
+	return TRUE;
 }
 
 static gboolean bitlbee_io_new_client( gpointer data, gint fd, b_input_condition condition )
@@ -295,7 +469,12 @@ static gboolean bitlbee_io_new_client( gpointer data, gint fd, b_input_condition
 	struct sockaddr_in conn_info;
 	int new_socket = accept( global.listen_socket, (struct sockaddr *) &conn_info, &size );
 	
-	if( new_socket == -1 )
+	if( new_socket == -1 && ( errno == EAGAIN || errno == EWOULDBLOCK ) )
+	{
+		/* Another worker was faster. */
+		return TRUE;
+	}
+	else if( new_socket == -1 )
 	{
 		log_message( LOGLVL_WARNING, "Could not accept new connection: %s", strerror( errno ) );
 		return TRUE;
@@ -307,6 +486,10 @@ static gboolean bitlbee_io_new_client( gpointer data, gint fd, b_input_condition
 		pid_t client_pid = 0;
 		int fds[2];
 		
+		/* See if an idle child from the pool can take it. */
+		if( ipc_master_pool_accept( new_socket ) )
+			return TRUE;
+		
 		if( socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) == -1 )
 		{
 			log_message( LOGLVL_WARNING, "Could not create IPC socket for client: %s", strerror( errno ) );
@@ -374,11 +557,29 @@ static gboolean bitlbee_io_new_client( gpointer data, gint fd, b_input_condition
 
 gboolean bitlbee_shutdown( gpointer data, gint fd, b_input_condition cond )
 {
+#ifndef _WIN32
+	GSList *l;
+#endif
+	
 	/* Try to save data for all active connections (if desired). */
 	while( irc_connection_list != NULL )
 		irc_abort( irc_connection_list->data, TRUE,
 		           "BitlBee server shutting down" );
 	
+#ifndef _WIN32
+	/* The workers take care of their own users. Skip the ones that died
+	   already, someone else may have their pid by now. */
+	for( l = worker_pids; l; l = l->next )
+		if( l->data )
+			kill( GPOINTER_TO_INT( l->data ), SIGTERM );
+	g_slist_free( worker_pids );
+	worker_pids = NULL;
+	
+	if( worker_respawn_id > 0 )
+		b_event_remove( worker_respawn_id );
+	worker_respawn_id = 0;
+#endif
+	
 	/* We'll only reach this point when not running in inetd mode: */
 	b_main_quit();
 	
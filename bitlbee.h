@@ -149,6 +149,9 @@ extern "C" {
 #include "conf.h"
 #include "log.h"
 #include "ini.h"
+#include "iobuf.h"
+#include "slab.h"
+#include "dns.h"
 #include "query.h"
 #include "sock.h"
 #include "misc.h"
@@ -164,9 +167,13 @@ typedef struct global {
 	GList *storage; /* The first backend in the list will be used for saving */
 	char *helpfile;
 	int restart;
+	int worker; /* Daemon mode with several workers: 0 in the master. */
+	char **argv; /* The master needs these to start replacement workers. */
+	char *cwd;
 } global_t;
 
 int bitlbee_daemon_init( void );
+void bitlbee_daemon_worker_exited( pid_t pid );
 int bitlbee_inetd_init( void );
 
 gboolean bitlbee_io_current_client_read( gpointer data, gint source, b_input_condition cond );
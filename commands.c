@@ -0,0 +1,69 @@
+  /********************************************************************\
+  * BitlBee -- An IRC to other IM-networks gateway                     *
+  *                                                                    *
+  * Copyright 2002-2012 Wilmer van der Gaast and others                *
+  \********************************************************************/
+
+/* Hashed lookup for the IRC, root and IPC command tables               */
+
+/*
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License with
+  the Debian GNU/Linux distribution in /usr/share/common-licenses/GPL;
+  if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+  Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#define BITLBEE_CORE
+#include "commands.h"
+
+/* Every line from the IRC client used to go through a strcasecmp() for
+   every entry in the command table until one matched. These tables are
+   small and never change after startup (except for plugins adding root
+   commands), so just hash them case-insensitively once. */
+
+command_table_t *command_table_new( const command_t *commands )
+{
+	command_table_t *t = g_hash_table_new_full( str_case_hash, str_case_equal, NULL, g_free );
+	
+	for( ; commands && commands->command; commands ++ )
+		command_table_add( t, commands );
+	
+	return t;
+}
+
+/* The table keeps its own copy of cmd (but not of the name string), so
+   the array it came from can be moved around. Returns FALSE if there
+   already is a command with this name. */
+gboolean command_table_add( command_table_t *t, const command_t *cmd )
+{
+	command_t *c;
+	
+	if( g_hash_table_lookup( t, cmd->command ) )
+		return FALSE;
+	
+	c = g_memdup( cmd, sizeof( command_t ) );
+	g_hash_table_insert( t, c->command, c );
+	
+	return TRUE;
+}
+
+const command_t *command_table_find( command_table_t *t, const char *name )
+{
+	return g_hash_table_lookup( t, name );
+}
+
+void command_table_free( command_table_t *t )
+{
+	if( t )
+		g_hash_table_destroy( t );
+}
@@ -38,6 +38,14 @@ typedef struct command
 
 extern command_t root_commands[];
 
+/* Case-insensitive hash of a NULL-terminated command_t array, see commands.c. */
+typedef GHashTable command_table_t;
+
+command_table_t *command_table_new( const command_t *commands );
+gboolean command_table_add( command_table_t *t, const command_t *cmd );
+const command_t *command_table_find( command_table_t *t, const char *name );
+void command_table_free( command_table_t *t );
+
 #define IRC_CMD_PRE_LOGIN	1
 #define IRC_CMD_LOGGED_IN	2
 #define IRC_CMD_OPER_ONLY	4
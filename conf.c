@@ -67,6 +67,8 @@ conf_t *conf_load( int argc, char *argv[] )
 	conf->ft_listen = NULL;
 	conf->protocols = NULL;
 	conf->cafile = NULL;
+	conf->workers = 1;
+	conf->forkpool = 0;
 	proxytype = 0;
 	
 	i = conf_loadini( conf, global.conf_file );
@@ -208,6 +210,34 @@ static int conf_loadini( conf_t *conf, char *file )
 				else
 					conf->runmode = RUNMODE_INETD;
 			}
+			else if( g_strcasecmp( ini->key, "daemonworkers" ) == 0 )
+			{
+				if( g_strcasecmp( ini->value, "auto" ) == 0 )
+					conf->workers = 0;
+				else if( sscanf( ini->value, "%d", &i ) != 1 || i < 1 )
+				{
+					fprintf( stderr, "Invalid %s value: %s\n", ini->key, ini->value );
+					return 0;
+				}
+				else
+					conf->workers = i;
+			}
+			else if( g_strcasecmp( ini->key, "forkdaemonpool" ) == 0 )
+			{
+				if( sscanf( ini->value, "%d", &i ) != 1 || i < 0 )
+				{
+					fprintf( stderr, "Invalid %s value: %s\n", ini->key, ini->value );
+					return 0;
+				}
+#ifdef NO_FD_PASSING
+				/* Pool children get their connection from the master,
+				   which needs fd passing. Just fork() per connection. */
+				if( i > 0 )
+					fprintf( stderr, "Warning: %s is not supported on this platform, ignoring it.\n", ini->key );
+				i = 0;
+#endif
+				conf->forkpool = i;
+			}
 			else if( g_strcasecmp( ini->key, "pidfile" ) == 0 )
 			{
 				g_free( conf->pidfile );
@@ -388,6 +418,7 @@ void conf_loaddefaults( irc_t *irc )
 			{
 				if( s->def ) g_free( s->def );
 				s->def = g_strdup( ini->value );
+				set_parse( s );
 			}
 		}
 	}
@@ -54,6 +54,8 @@ typedef struct conf
 	char *ft_listen;
 	char **protocols;
 	char *cafile;
+	int workers;
+	int forkpool;
 } conf_t;
 
 G_GNUC_MALLOC conf_t *conf_load( int argc, char *argv[] );
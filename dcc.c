@@ -516,7 +516,7 @@ file_transfer_t *dcc_request( struct im_connection *ic, char* const* ctcp )
 	    sscanf( ctcp[5], "%zd", &filesize ) == 1 )
 	{
 		char *filename, *host, *port;
-		struct addrinfo hints, *rp;
+		struct addrinfo *rp;
 		
 		filename = ctcp[2];
 		
@@ -535,11 +535,7 @@ file_transfer_t *dcc_request( struct im_connection *ic, char* const* ctcp )
 		port = ctcp[4];
 		filesize = atoll( ctcp[5] );
 
-		memset( &hints, 0, sizeof ( struct addrinfo ) );
-		hints.ai_socktype = SOCK_STREAM;
-		hints.ai_flags = AI_NUMERICSERV;
-
-		if ( ( gret = getaddrinfo( host, port, &hints, &rp ) ) )
+		if ( ( gret = dns_lookup_sync( host, atoi( port ), AF_UNSPEC, &rp ) ) )
 		{
 			imcb_log( ic, "DCC: getaddrinfo() failed with %s "
 				  "when parsing incoming 'DCC SEND': "
@@ -553,7 +549,7 @@ file_transfer_t *dcc_request( struct im_connection *ic, char* const* ctcp )
 		ft->sending = TRUE;
 		memcpy( &df->saddr, rp->ai_addr, rp->ai_addrlen );
 
-		freeaddrinfo( rp );
+		dns_free( rp );
 
 		irc->file_transfers = g_slist_prepend( irc->file_transfers, ft );
 
@@ -35,6 +35,9 @@
 GSList *child_list = NULL;
 static int ipc_child_recv_fd = -1;
 
+static guint pool_idle = 0;
+static gint pool_fill_id = 0;
+
 static void ipc_master_takeover_fail( struct bitlbee_child *child, gboolean both );
 static gboolean ipc_send_fd( int fd, int send_fd );
 
@@ -107,8 +110,10 @@ static void ipc_master_cmd_deaf( irc_t *data, char **cmd )
 void ipc_master_cmd_rehash( irc_t *data, char **cmd )
 {
 	runmode_t oldmode;
+	int oldworkers;
 	
 	oldmode = global.conf->runmode;
+	oldworkers = global.conf->workers;
 	
 	g_free( global.conf );
 	global.conf = conf_load( 0, NULL );
@@ -118,9 +123,22 @@ void ipc_master_cmd_rehash( irc_t *data, char **cmd )
 		log_message( LOGLVL_WARNING, "Can't change RunMode setting at runtime, restoring original setting" );
 		global.conf->runmode = oldmode;
 	}
+	if( global.conf->workers != oldworkers )
+	{
+		log_message( LOGLVL_WARNING, "Can't change DaemonWorkers setting at runtime, restoring original setting" );
+		global.conf->workers = oldworkers;
+	}
 	
 	if( global.conf->runmode == RUNMODE_FORKDAEMON )
+	{
 		ipc_to_children( cmd );
+#ifndef _WIN32
+		/* Idle children don't get these broadcasts, and they still
+		   have the old configuration. Start over with new ones. */
+		ipc_master_pool_flush();
+		ipc_master_pool_refill();
+#endif
+	}
 }
 
 void ipc_master_cmd_restart( irc_t *data, char **cmd )
@@ -516,27 +534,31 @@ static void ipc_master_takeover_fail( struct bitlbee_child *child, gboolean both
 
 static void ipc_command_exec( void *data, char **cmd, const command_t *commands )
 {
-	int i, j;
+	/* Hashed versions of ipc_master_commands and ipc_child_commands. */
+	static command_table_t *tables[2];
+	command_table_t **table = &tables[commands == ipc_child_commands];
+	const command_t *c;
+	int j;
 	
 	if( !cmd[0] )
 		return;
 	
-	for( i = 0; commands[i].command; i ++ )
-		if( g_strcasecmp( commands[i].command, cmd[0] ) == 0 )
-		{
-			/* There is no typo in this line: */
-			for( j = 1; cmd[j]; j ++ ); j --;
-			
-			if( j < commands[i].required_parameters )
-				break;
-			
-			if( commands[i].flags & IPC_CMD_TO_CHILDREN )
-				ipc_to_children( cmd );
-			else
-				commands[i].execute( data, cmd );
-			
-			break;
-		}
+	if( *table == NULL )
+		*table = command_table_new( commands );
+	
+	if( ( c = command_table_find( *table, cmd[0] ) ) )
+	{
+		/* There is no typo in this line: */
+		for( j = 1; cmd[j]; j ++ ); j --;
+		
+		if( j < c->required_parameters )
+			return;
+		
+		if( c->flags & IPC_CMD_TO_CHILDREN )
+			ipc_to_children( cmd );
+		else
+			c->execute( data, cmd );
+	}
 }
 
 /* Return just one line. Returns NULL if something broke, an empty string
@@ -738,6 +760,8 @@ void ipc_to_children_str( char *format, ... )
 			struct bitlbee_child *c = l->data;
 			
 			next = l->next;
+			if( c->idle )
+				continue;
 			if( write( c->ipc_fd, msg_buf, msg_len ) <= 0 )
 				ipc_master_free_one( c );
 		}
@@ -794,6 +818,9 @@ void ipc_master_free_one( struct bitlbee_child *c )
 	if( c->to_fd != -1 )
 		close( c->to_fd );
 	
+	if( c->idle )
+		pool_idle --;
+	
 	g_free( c->host );
 	g_free( c->nick );
 	g_free( c->realname );
@@ -832,6 +859,12 @@ void ipc_master_free_all()
 {
 	while( child_list )
 		ipc_master_free_one( child_list->data );
+	
+	/* Only used in freshly forked children, which shouldn't go on
+	   filling the master's pool. */
+	if( pool_fill_id > 0 )
+		b_event_remove( pool_fill_id );
+	pool_fill_id = 0;
 }
 
 void ipc_child_disable()
@@ -842,6 +875,167 @@ void ipc_child_disable()
 	global.listen_socket = -1;
 }
 
+#ifndef _WIN32
+/* The ForkDaemon child pool: a few children that are fork()ed in advance,
+   with their IPC socket and event loop set up, waiting for the master to
+   pass them a connection. Saves us a fork() per accept() when lots of
+   users reconnect at the same time. */
+static gboolean ipc_child_idle_read( gpointer data, gint source, b_input_condition cond )
+{
+	char *buf;
+	int fd = -1;
+	irc_t *irc;
+	
+	if( ( buf = ipc_readline( source, &fd ) ) == NULL )
+	{
+		/* Master went away (or doesn't need us anymore). */
+		b_main_quit();
+		return FALSE;
+	}
+	g_free( buf );
+	
+	if( fd == -1 )
+		return TRUE;
+	
+	b_event_remove( global.listen_watch_source_id );
+	irc = irc_new( fd );
+	global.listen_watch_source_id = b_input_add( source, B_EV_IO_READ, ipc_child_read, irc );
+	
+	return FALSE;
+}
+
+/* Returns the pid of the new child in the master, 0 in the child and -1
+   if anything failed. */
+static pid_t ipc_master_pool_spawn()
+{
+	struct bitlbee_child *child;
+	pid_t pid;
+	int fds[2];
+	
+	if( socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) == -1 )
+	{
+		log_message( LOGLVL_WARNING, "Could not create IPC socket for client: %s", strerror( errno ) );
+		return -1;
+	}
+	
+	sock_make_nonblocking( fds[0] );
+	sock_make_nonblocking( fds[1] );
+	
+	pid = fork();
+	if( pid == -1 )
+	{
+		log_error( "fork" );
+		close( fds[0] );
+		close( fds[1] );
+	}
+	else if( pid == 0 )
+	{
+		srand( time( NULL ) ^ getpid() );
+		b_main_init();
+		
+		close( global.listen_socket );
+		b_event_remove( global.listen_watch_source_id );
+		
+		global.listen_socket = fds[1];
+		global.listen_watch_source_id = b_input_add( fds[1], B_EV_IO_READ, ipc_child_idle_read, NULL );
+		
+		close( fds[0] );
+		
+		ipc_master_free_all();
+	}
+	else
+	{
+		child = g_new0( struct bitlbee_child, 1 );
+		child->pid = pid;
+		child->ipc_fd = fds[0];
+		child->ipc_inpa = b_input_add( child->ipc_fd, B_EV_IO_READ, ipc_master_read, child );
+		child->to_fd = -1;
+		child->idle = TRUE;
+		child_list = g_slist_prepend( child_list, child );
+		pool_idle ++;
+		
+		close( fds[1] );
+	}
+	
+	return pid;
+}
+
+/* Add one child at a time, so we don't block the master for too long if
+   the pool is big. */
+static gboolean ipc_master_pool_fill( gpointer data, gint fd, b_input_condition cond )
+{
+	if( pool_idle >= global.conf->forkpool || ipc_master_pool_spawn() <= 0 )
+	{
+		pool_fill_id = 0;
+		return FALSE;
+	}
+	
+	return TRUE;
+}
+
+/* Get rid of all idle children. They'll quit once they see their IPC
+   socket closing. */
+void ipc_master_pool_flush()
+{
+	GSList *l, *next;
+	
+	for( l = child_list; l; l = next )
+	{
+		next = l->next;
+		if( ((struct bitlbee_child*)l->data)->idle )
+			ipc_master_free_one( l->data );
+	}
+}
+
+void ipc_master_pool_refill()
+{
+	/* Without fd passing, idle children would never get a connection. */
+#ifndef NO_FD_PASSING
+	if( pool_fill_id == 0 && pool_idle < global.conf->forkpool )
+		pool_fill_id = b_timeout_add( 10, ipc_master_pool_fill, NULL );
+#endif
+}
+
+/* Hand over a freshly accepted connection to an idle child, if we have
+   one. */
+gboolean ipc_master_pool_accept( int fd )
+{
+	GSList *l, *next;
+	
+#ifdef NO_FD_PASSING
+	return FALSE;
+#endif
+	for( l = child_list; pool_idle > 0 && l; l = next )
+	{
+		struct bitlbee_child *c = l->data;
+		
+		next = l->next;
+		if( !c->idle )
+			continue;
+		
+		if( !ipc_send_fd( c->ipc_fd, fd ) )
+		{
+			/* This one's no good, try the next one. */
+			ipc_master_free_one( c );
+			continue;
+		}
+		
+		c->idle = FALSE;
+		pool_idle --;
+		
+		log_message( LOGLVL_INFO, "Passing new connection to subprocess %d.", (int) c->pid );
+		close( fd );
+		ipc_master_pool_refill();
+		
+		return TRUE;
+	}
+	
+	ipc_master_pool_refill();
+	
+	return FALSE;
+}
+#endif
+
 #ifndef _WIN32
 char *ipc_master_save_state()
 {
@@ -861,6 +1055,9 @@ char *ipc_master_save_state()
 	/* This is more convenient now. */
 	fp = fdopen( fd, "w" );
 	
+	/* Idle children have nothing worth keeping. */
+	ipc_master_pool_flush();
+	
 	for( l = child_list, i = 0; l; l = l->next )
 		i ++;
 	
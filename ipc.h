@@ -42,6 +42,9 @@ struct bitlbee_child
 	/* For takeovers: */
 	struct bitlbee_child *to_child;
 	int to_fd;
+	
+	/* Pre-forked, waiting for a connection. */
+	gboolean idle;
 };
 
 
@@ -54,6 +57,10 @@ void ipc_master_free_all();
 
 void ipc_child_disable();
 
+gboolean ipc_master_pool_accept( int fd );
+void ipc_master_pool_flush();
+void ipc_master_pool_refill();
+
 gboolean ipc_child_identify( irc_t *irc );
 
 void ipc_to_master( char **cmd );
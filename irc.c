@@ -28,6 +28,8 @@
 #include "dcc.h"
 
 GSList *irc_connection_list;
+static int irc_corked = 0;
+static GSList *irc_corked_list = NULL;
 GSList *irc_plugins;
 
 static gboolean irc_userping( gpointer _irc, gint fd, b_input_condition cond );
@@ -51,13 +53,22 @@ irc_t *irc_new( int fd )
 	irc->fd = fd;
 	sock_make_nonblocking( irc->fd );
 	
+	irc->readbuffer = iobuf_new();
+	irc->sendbuffer = iobuf_new();
+	
 	irc->r_watch_source_id = b_input_add( irc->fd, B_EV_IO_READ, bitlbee_io_current_client_read, irc );
 	
 	irc->status = USTATUS_OFFLINE;
 	irc->last_pong = gettime();
 	
 	irc->nick_user_hash = g_hash_table_new( g_str_hash, g_str_equal );
+	irc->nick_suffix = g_hash_table_new_full( g_str_hash, g_str_equal, g_free, NULL );
 	irc->watches = g_hash_table_new( g_str_hash, g_str_equal );
+	irc->user_slab = slab_new( "IRC users", sizeof( irc_user_t ) );
+	irc->channel_user_slab = slab_new( "channel members", sizeof( irc_channel_user_t ) );
+	irc->control_channels = g_hash_table_new( g_direct_hash, g_direct_equal );
+	irc->channel_hash = g_hash_table_new( irc_channel_name_hash, irc_channel_name_equal );
+	irc->channel_ids = g_ptr_array_new();
 	
 	irc->iconv = (GIConv) -1;
 	irc->oconv = (GIConv) -1;
@@ -135,17 +146,17 @@ irc_t *irc_new( int fd )
 	s = set_add( &b->set, "typing_notice", "false", set_eval_bool, irc );
 
 	irc->root = iu = irc_user_new( irc, ROOT_NICK );
-	iu->host = g_strdup( myhost );
+	iu->host = (char *) str_ref( myhost );
 	iu->fullname = g_strdup( ROOT_FN );
 	iu->f = &irc_user_root_funcs;
 	
 	iu = irc_user_new( irc, NS_NICK );
-	iu->host = g_strdup( myhost );
+	iu->host = (char *) str_ref( myhost );
 	iu->fullname = g_strdup( ROOT_FN );
 	iu->f = &irc_user_root_funcs;
 	
 	irc->user = g_new0( irc_user_t, 1 );
-	irc->user->host = g_strdup( host );
+	irc->user->host = (char *) str_ref( host );
 	
 	conf_loaddefaults( irc );
 	
@@ -238,21 +249,23 @@ void irc_free( irc_t * irc )
 	}
 	
 	irc_connection_list = g_slist_remove( irc_connection_list, irc );
+	if( irc->corked )
+		irc_corked_list = g_slist_remove( irc_corked_list, irc );
 	
 	while( irc->queries != NULL )
 		query_del( irc, irc->queries );
 	
-	/* This is a little bit messy: bee_free() frees all b->users which
-	   calls us back to free the corresponding irc->users. So do this
-	   before we clear the remaining ones ourselves. */
+	/* bee_free() frees all b->users, which would normally take the
+	   corresponding irc->users with them. With USTATUS_SHUTDOWN set,
+	   those (and channel members) are instead all cleaned up at once
+	   below, and their memory goes away with the pools. */
 	bee_free( irc->b );
 	
-	while( irc->users )
-		irc_user_free( irc, (irc_user_t *) irc->users->data );
-	
 	while( irc->channels )
 		irc_channel_free( irc->channels->data );
 	
+	irc_user_free_all( irc );
+	
 	if( irc->ping_source_id > 0 )
 		b_event_remove( irc->ping_source_id );
 	if( irc->r_watch_source_id > 0 )
@@ -265,19 +278,28 @@ void irc_free( irc_t * irc )
 	
 	g_hash_table_foreach_remove( irc->nick_user_hash, irc_free_hashkey, NULL );
 	g_hash_table_destroy( irc->nick_user_hash );
+	g_hash_table_destroy( irc->nick_suffix );
 	
 	g_hash_table_foreach_remove( irc->watches, irc_free_hashkey, NULL );
 	g_hash_table_destroy( irc->watches );
 	
+	/* Empty by now, channels take themselves out. */
+	g_hash_table_destroy( irc->control_channels );
+	g_hash_table_destroy( irc->channel_hash );
+	g_ptr_array_free( irc->channel_ids, TRUE );
+	
 	if( irc->iconv != (GIConv) -1 )
 		g_iconv_close( irc->iconv );
 	if( irc->oconv != (GIConv) -1 )
 		g_iconv_close( irc->oconv );
 	
-	g_free( irc->sendbuffer );
-	g_free( irc->readbuffer );
+	iobuf_free( irc->sendbuffer );
+	iobuf_free( irc->readbuffer );
 	g_free( irc->password );
 	
+	slab_destroy( irc->user_slab );
+	slab_destroy( irc->channel_user_slab );
+	
 	g_free( irc );
 	
 	if( global.conf->runmode == RUNMODE_INETD ||
@@ -323,198 +345,173 @@ static char *set_eval_password( set_t *set, char *value )
 	}
 }
 
-static char **irc_splitlines( char *buffer );
+static void irc_process_line( irc_t *irc, char *line, gsize len );
+static gboolean irc_conv_skip( irc_t *irc, const char *line, gsize len );
 
+/* Everything is done in place in the receive buffer: lines get cut up and
+   NUL-terminated where they are, the arguments go into an array on the
+   stack and the incomplete line at the end (if any) just stays behind. */
 void irc_process( irc_t *irc )
 {
-	char **lines, *temp, **cmd;
-	int i;
-
-	if( irc->readbuffer != NULL )
+	char *buf, *end, *s, *line, *eol;
+	
+	if( irc->readbuffer->len == 0 )
+		return;
+	
+	/* iobuf_pullup() always leaves room for a terminator. */
+	buf = iobuf_pullup( irc->readbuffer );
+	end = buf + irc->readbuffer->len;
+	*end = '\0';
+	
+	for( line = s = buf; s < end; s ++ )
 	{
-		lines = irc_splitlines( irc->readbuffer );
+		/* Accept any kind of line endings, knowing that ERC on Windows
+		   may send something interesting like \r\r\n, and surely there
+		   must be clients that think just \n is enough... */
+		if( *s != '\r' && *s != '\n' )
+			continue;
 		
-		for( i = 0; *lines[i] != '\0'; i ++ )
-		{
-			char *conv = NULL;
-			
-			/* [WvG] If the last line isn't empty, it's an incomplete line and we
-			   should wait for the rest to come in before processing it. */
-			if( lines[i+1] == NULL )
-			{
-				temp = g_strdup( lines[i] );
-				g_free( irc->readbuffer );
-				irc->readbuffer = temp;
-				i ++;
-				break;
-			}
-			
-			if( irc->iconv != (GIConv) -1 )
-			{
-				gsize bytes_read, bytes_written;
-				
-				conv = g_convert_with_iconv( lines[i], -1, irc->iconv,
-				                             &bytes_read, &bytes_written, NULL );
-				
-				if( conv == NULL || bytes_read != strlen( lines[i] ) )
-				{
-					/* GLib can do strange things if things are not in the expected charset,
-					   so let's be a little bit paranoid here: */
-					if( irc->status & USTATUS_LOGGED_IN )
-					{
-						irc_rootmsg( irc, "Error: Charset mismatch detected. The charset "
-						                  "setting is currently set to %s, so please make "
-						                  "sure your IRC client will send and accept text in "
-						                  "that charset, or tell BitlBee which charset to "
-						                  "expect by changing the charset setting. See "
-						                  "`help set charset' for more information. Your "
-						                  "message was ignored.",
-						                  set_getstr( &irc->b->set, "charset" ) );
-						
-						g_free( conv );
-						conv = NULL;
-					}
-					else
-					{
-						irc_write( irc, ":%s NOTICE AUTH :%s", irc->root->host,
-						           "Warning: invalid characters received at login time." );
-						
-						conv = g_strdup( lines[i] );
-						for( temp = conv; *temp; temp ++ )
-							if( *temp & 0x80 )
-								*temp = '?';
-					}
-				}
-				lines[i] = conv;
-			}
-			
-			if( lines[i] && ( cmd = irc_parse_line( lines[i] ) ) )
-			{
-				irc_exec( irc, cmd );
-				g_free( cmd );
-			}
-			
-			g_free( conv );
-			
-			/* Shouldn't really happen, but just in case... */
-			if( !g_slist_find( irc_connection_list, irc ) )
-			{
-				g_free( lines );
-				return;
-			}
-		}
+		for( eol = s; s < end && ( *s == '\r' || *s == '\n' ); s ++ )
+			*s = '\0';
 		
-		if( lines[i] != NULL )
-		{
-			g_free( irc->readbuffer );
-			irc->readbuffer = NULL;
-		}
+		irc_process_line( irc, line, eol - line );
+		
+		/* Shouldn't really happen, but just in case... */
+		if( !g_slist_find( irc_connection_list, irc ) )
+			return;
 		
-		g_free( lines );
+		line = s --;
 	}
+	
+	/* Keep only the incomplete line (if any), no need to copy it. */
+	iobuf_drop( irc->readbuffer, line - buf );
 }
 
-/* Splits a long string into separate lines. The array is NULL-terminated
-   and, unless the string contains an incomplete line at the end, ends with
-   an empty string. Could use g_strsplit() but this one does it in-place.
-   (So yes, it's destructive.) */
-static char **irc_splitlines( char *buffer )
+static void irc_process_line( irc_t *irc, char *line, gsize len )
 {
-	int i, j, n = 3;
-	char **lines;
-
-	/* Allocate n+1 elements. */
-	lines = g_new( char *, n + 1 );
-	
-	lines[0] = buffer;
+	char *cmd[IRC_MAX_ARGS+1], *conv = NULL, *temp;
 	
-	/* Split the buffer in several strings, and accept any kind of line endings,
-	 * knowing that ERC on Windows may send something interesting like \r\r\n,
-	 * and surely there must be clients that think just \n is enough... */
-	for( i = 0, j = 0; buffer[i] != '\0'; i ++ )
+	if( irc->iconv != (GIConv) -1 && !irc_conv_skip( irc, line, len ) )
 	{
-		if( buffer[i] == '\r' || buffer[i] == '\n' )
+		gsize bytes_read, bytes_written;
+		
+		conv = g_convert_with_iconv( line, len, irc->iconv,
+		                             &bytes_read, &bytes_written, NULL );
+		
+		if( conv == NULL || bytes_read != len )
 		{
-			while( buffer[i] == '\r' || buffer[i] == '\n' )
-				buffer[i++] = '\0';
-			
-			lines[++j] = buffer + i;
-			
-			if( j >= n )
+			/* GLib can do strange things if things are not in the expected charset,
+			   so let's be a little bit paranoid here: */
+			if( irc->status & USTATUS_LOGGED_IN )
 			{
-				n *= 2;
-				lines = g_renew( char *, lines, n + 1 );
+				irc_rootmsg( irc, "Error: Charset mismatch detected. The charset "
+				                  "setting is currently set to %s, so please make "
+				                  "sure your IRC client will send and accept text in "
+				                  "that charset, or tell BitlBee which charset to "
+				                  "expect by changing the charset setting. See "
+				                  "`help set charset' for more information. Your "
+				                  "message was ignored.",
+				                  set_getstr( &irc->b->set, "charset" ) );
+				
+				g_free( conv );
+				return;
+			}
+			else
+			{
+				irc_write( irc, ":%s NOTICE AUTH :%s", irc->root->host,
+				           "Warning: invalid characters received at login time." );
+				
+				g_free( conv );
+				conv = g_strdup( line );
+				for( temp = conv; *temp; temp ++ )
+					if( *temp & 0x80 )
+						*temp = '?';
 			}
-
-			if( buffer[i] == '\0' )
-				break;
 		}
+		line = conv;
 	}
 	
-	/* NULL terminate our list. */ 
-	lines[++j] = NULL;
+	if( irc_tokenize( line, cmd ) > 0 )
+		irc_exec( irc, cmd );
 	
-	return lines;
+	g_free( conv );
 }
 
-/* Split an IRC-style line into little parts/arguments. */
-char **irc_parse_line( char *line )
+/* Most lines don't need to go through iconv at all: pure ASCII lines
+   when the charset is a superset of ASCII (almost all of them are) and
+   valid UTF-8 lines when the charset is UTF-8 (the default). Stateful
+   charsets like ISO-2022-JP look like ASCII too but switch to other
+   character sets using ESC/SO/SI, so lines with those always get
+   converted. */
+static gboolean irc_conv_skip( irc_t *irc, const char *line, gsize len )
+{
+	if( irc->charset_ascii && str_is_ascii( line, len ) &&
+	    !memchr( line, '\033', len ) && !memchr( line, '\016', len ) &&
+	    !memchr( line, '\017', len ) )
+		return TRUE;
+	
+	return irc->charset_utf8 && g_utf8_validate( line, len, NULL );
+}
+
+/* Split an IRC-style line into little parts/arguments, in place, in one
+   pass. Format is:
+   Input: "PRIVMSG #bitlbee :foo bar"
+   Output: cmd[0]=="PRIVMSG", cmd[1]=="#bitlbee", cmd[2]=="foo bar", cmd[3]==NULL
+   cmd needs room for IRC_MAX_ARGS+1 elements. If there are more arguments
+   than that, the last one gets the rest of the line. Returns the number of
+   elements in cmd, 0 for empty lines. */
+int irc_tokenize( char *line, char **cmd )
 {
-	int i, j;
-	char **cmd;
+	int n = 0;
 	
-	/* Move the line pointer to the start of the command, skipping spaces and the optional prefix. */
-	if( line[0] == ':' )
+	/* Skip the optional prefix and any leading spaces. */
+	if( *line == ':' )
+		while( *line && *line != ' ' )
+			line ++;
+	while( *line == ' ' )
+		line ++;
+	
+	if( *line == '\0' )
 	{
-		for( i = 0; line[i] && line[i] != ' '; i ++ );
-		line = line + i;
+		cmd[0] = NULL;
+		return 0;
 	}
-	for( i = 0; line[i] == ' '; i ++ );
-	line = line + i;
-	
-	/* If we're already at the end of the line, return. If not, we're going to need at least one element. */
-	if( line[0] == '\0')
-		return NULL;
 	
-	/* Count the number of char **cmd elements we're going to need. */
-	j = 1;
-	for( i = 0; line[i] != '\0'; i ++ )
+	cmd[n++] = line;
+	for( ; *line; line ++ )
 	{
-		if( line[i] == ' ' )
+		if( *line != ' ' )
+			continue;
+		
+		*line = '\0';
+		if( line[1] == ':' )
 		{
-			j ++;
-			
-			if( line[i+1] == ':' )
-				break;
+			cmd[n++] = line + 2;
+			break;
 		}
-	}	
-
-	/* Allocate the space we need. */
-	cmd = g_new( char *, j + 1 );
-	cmd[j] = NULL;
-	
-	/* Do the actual line splitting, format is:
-	 * Input: "PRIVMSG #bitlbee :foo bar"
-	 * Output: cmd[0]=="PRIVMSG", cmd[1]=="#bitlbee", cmd[2]=="foo bar", cmd[3]==NULL
-	 */
-
-	cmd[0] = line;
-	for( i = 0, j = 0; line[i] != '\0'; i ++ )
-	{
-		if( line[i] == ' ' )
+		else if( n == IRC_MAX_ARGS - 1 )
 		{
-			line[i] = '\0';
-			cmd[++j] = line + i + 1;
-			
-			if( line[i+1] == ':' )
-			{
-				cmd[j] ++;
-				break;
-			}
+			cmd[n++] = line + 1;
+			break;
 		}
+		cmd[n++] = line + 1;
 	}
+	cmd[n] = NULL;
 	
-	return cmd;
+	return n;
+}
+
+/* Same, but returns a g_free()able copy of the array (the strings still
+   point into line). */
+char **irc_parse_line( char *line )
+{
+	char *cmd[IRC_MAX_ARGS+1];
+	int n;
+	
+	if( ( n = irc_tokenize( line, cmd ) ) == 0 )
+		return NULL;
+	
+	return g_memdup( cmd, sizeof( char* ) * ( n + 1 ) );
 }
 
 /* Converts such an array back into a command string. Mainly used for the IPC code right now. */
@@ -574,8 +571,8 @@ void irc_write_all( int now, char *format, ... )
 		
 		if( now )
 		{
-			g_free( irc->sendbuffer );
-			irc->sendbuffer = g_strdup( "\r\n" );
+			iobuf_clear( irc->sendbuffer );
+			iobuf_append( irc->sendbuffer, "\r\n", 2 );
 		}
 		irc_vawrite( temp->data, format, params );
 		if( now )
@@ -591,8 +588,8 @@ void irc_write_all( int now, char *format, ... )
 
 void irc_vawrite( irc_t *irc, char *format, va_list params )
 {
-	int size;
 	char line[IRC_MAX_LINE+1];
+	gsize len;
 		
 	/* Don't try to write anything new anymore when shutting down. */
 	if( irc->status & USTATUS_SHUTDOWN )
@@ -601,34 +598,39 @@ void irc_vawrite( irc_t *irc, char *format, va_list params )
 	memset( line, 0, sizeof( line ) );
 	g_vsnprintf( line, IRC_MAX_LINE - 2, format, params );
 	strip_newlines( line );
+	len = strlen( line );
 	
-	if( irc->oconv != (GIConv) -1 )
+	if( irc->oconv != (GIConv) -1 && !irc_conv_skip( irc, line, len ) )
 	{
 		gsize bytes_read, bytes_written;
 		char *conv;
 		
-		conv = g_convert_with_iconv( line, -1, irc->oconv,
+		conv = g_convert_with_iconv( line, len, irc->oconv,
 		                             &bytes_read, &bytes_written, NULL );
 
-		if( bytes_read == strlen( line ) )
+		if( bytes_read == len )
+		{
 			strncpy( line, conv, IRC_MAX_LINE - 2 );
+			len = strlen( line );
+		}
 		
 		g_free( conv );
 	}
-	g_strlcat( line, "\r\n", IRC_MAX_LINE + 1 );
+	memcpy( line + len, "\r\n", 3 );
 	
-	if( irc->sendbuffer != NULL )
-	{
-		size = strlen( irc->sendbuffer ) + strlen( line );
-		irc->sendbuffer = g_renew ( char, irc->sendbuffer, size + 1 );
-		strcpy( ( irc->sendbuffer + strlen( irc->sendbuffer ) ), line );
-	}
-	else
+	iobuf_append( irc->sendbuffer, line, len + 2 );
+	irc->lines_out ++;
+	
+	if( irc->w_watch_source_id == 0 && irc_corked )
 	{
-		irc->sendbuffer = g_strdup(line);
+		/* Write it out later, together with everything else. */
+		if( !irc->corked )
+		{
+			irc->corked = TRUE;
+			irc_corked_list = g_slist_prepend( irc_corked_list, irc );
+		}
 	}
-	
-	if( irc->w_watch_source_id == 0 )
+	else if( irc->w_watch_source_id == 0 )
 	{
 		/* If the buffer is empty we can probably write, so call the write event handler
 		   immediately. If it returns TRUE, it should be called again, so add the event to
@@ -644,31 +646,58 @@ void irc_vawrite( irc_t *irc, char *format, va_list params )
 	return;
 }
 
+/* While corked, irc_vawrite() only queues output and remembers which
+   connections have something to send. irc_flush_corked() then writes
+   out everything queued for a connection with a single writev(). The
+   main loop stays corked and calls irc_flush_corked() every time it's
+   done handling a batch of events, so a presence storm of hundreds of
+   lines doesn't turn into hundreds of write events and syscalls. */
+void irc_cork( void )
+{
+	irc_corked ++;
+}
+
+void irc_uncork( void )
+{
+	if( irc_corked > 0 && --irc_corked == 0 )
+		irc_flush_corked();
+}
+
+void irc_flush_corked( void )
+{
+	while( irc_corked_list )
+	{
+		irc_t *irc = irc_corked_list->data;
+		
+		irc_corked_list = g_slist_delete_link( irc_corked_list, irc_corked_list );
+		irc->corked = FALSE;
+		
+		if( irc->sendbuffer->len == 0 || irc->w_watch_source_id != 0 )
+			continue;
+		
+		/* Only wait for the socket if we couldn't get it all out
+		   right away. (This one may free irc if it returns FALSE.) */
+		if( bitlbee_io_current_client_write( irc, irc->fd, B_EV_IO_WRITE ) )
+			irc->w_watch_source_id = b_input_add( irc->fd, B_EV_IO_WRITE, bitlbee_io_current_client_write, irc );
+	}
+}
+
 /* Flush sendbuffer if you can. If it fails, fail silently and let some
    I/O event handler clean up. */
 void irc_flush( irc_t *irc )
 {
-	ssize_t n;
-	size_t len;
-	
-	if( irc->sendbuffer == NULL )
+	if( irc->sendbuffer->len == 0 )
 		return;
 	
-	len = strlen( irc->sendbuffer );
-	if( ( n = send( irc->fd, irc->sendbuffer, len, 0 ) ) == len )
+	while( irc->sendbuffer->len > 0 &&
+	       iobuf_writev( irc->sendbuffer, irc->fd ) > 0 )
+		irc->writes_out ++;
+	
+	if( irc->sendbuffer->len == 0 )
 	{
-		g_free( irc->sendbuffer );
-		irc->sendbuffer = NULL;
-		
 		b_event_remove( irc->w_watch_source_id );
 		irc->w_watch_source_id = 0;
 	}
-	else if( n > 0 )
-	{
-		char *s = g_strdup( irc->sendbuffer + n );
-		g_free( irc->sendbuffer );
-		irc->sendbuffer = s;
-	}
 	/* Otherwise something went wrong and we don't currently care
 	   what the error was. We may or may not succeed later, we
 	   were just trying to flush the buffer immediately. */
@@ -681,12 +710,11 @@ void irc_switch_fd( irc_t *irc, int fd )
 	irc_write( irc, "ERROR :Transferring session to a new connection" );
 	irc_flush( irc ); /* Write it now or forget about it forever. */
 	
-	if( irc->sendbuffer )
+	if( irc->sendbuffer->len > 0 )
 	{
 		b_event_remove( irc->w_watch_source_id );
 		irc->w_watch_source_id = 0;
-		g_free( irc->sendbuffer );
-		irc->sendbuffer = NULL;
+		iobuf_clear( irc->sendbuffer );
 	}
 	
 	b_event_remove( irc->r_watch_source_id );
@@ -890,9 +918,11 @@ static gboolean irc_userping( gpointer _irc, gint fd, b_input_condition cond )
 static char *set_eval_charset( set_t *set, char *value )
 {
 	irc_t *irc = (irc_t*) set->data;
-	char *test;
+	char *test, ascii[127];
 	gsize test_bytes = 0;
+	gboolean charset_ascii;
 	GIConv ic, oc;
+	int i;
 
 	if( g_strcasecmp( value, "none" ) == 0 )
 		value = g_strdup( "utf-8" );
@@ -915,6 +945,13 @@ static char *set_eval_charset( set_t *set, char *value )
 	}
 	g_free( test );
 	
+	/* See irc_conv_skip(). */
+	for( i = 0; i < 127; i ++ )
+		ascii[i] = i + 1;
+	test = g_convert_with_iconv( ascii, 127, oc, NULL, &test_bytes, NULL );
+	charset_ascii = test && test_bytes == 127 && memcmp( test, ascii, 127 ) == 0;
+	g_free( test );
+	
 	if( ( ic = g_iconv_open( "utf-8", value ) ) == (GIConv) -1 )
 	{
 		g_iconv_close( oc );
@@ -928,6 +965,9 @@ static char *set_eval_charset( set_t *set, char *value )
 	
 	irc->iconv = ic;
 	irc->oconv = oc;
+	irc->charset_ascii = charset_ascii;
+	irc->charset_utf8 = g_strcasecmp( value, "utf-8" ) == 0 ||
+	                    g_strcasecmp( value, "utf8" ) == 0;
 
 	return value;
 }
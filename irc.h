@@ -71,9 +71,12 @@ typedef struct irc
 	irc_status_t status;
 	double last_pong;
 	int pinging;
-	char *sendbuffer;
-	char *readbuffer;
+	struct iobuf *sendbuffer;
+	struct iobuf *readbuffer;
 	GIConv iconv, oconv;
+	gboolean charset_ascii, charset_utf8; /* See irc_conv_skip(). */
+	gboolean corked; /* On the list of connections to flush, see irc_cork(). */
+	guint64 lines_out, writes_out;
 
 	struct irc_user *root;
 	struct irc_user *user;
@@ -88,9 +91,25 @@ typedef struct irc
 	GSList *file_transfers;
 	
 	GSList *users, *channels;
+	GHashTable *channel_hash; /* Name -> irc_channel_t, see irc_channel_by_name(). */
+	GPtrArray *channel_ids;   /* Numbers for the "channel" command. */
 	struct irc_channel *default_channel;
 	GHashTable *nick_user_hash;
+	GHashTable *nick_suffix; /* See nick_dedupe(). */
 	GHashTable *watches; /* See irc_cmd_watch() */
+	
+	/* irc_user_t and irc_channel_user_t are allocated from these. */
+	struct slab *user_slab, *channel_user_slab;
+	
+	/* Control channels by the group/account/protocol they're filled
+	   by (GSList each), and the ones that take everyone. */
+	GHashTable *control_channels;
+	GSList *control_channels_all;
+	
+	/* While contact lists are coming in, irc->users isn't kept sorted
+	   and channel updates are saved up, see bee_irc_roster_end(). */
+	int roster_batch;
+	GSList *roster_pending;
 
 	gint r_watch_source_id;
 	gint w_watch_source_id;
@@ -107,6 +126,8 @@ typedef enum
 {
 	/* Replaced with iu->last_channel IRC_USER_PRIVATE = 1, */
 	IRC_USER_AWAY = 2,
+	IRC_USER_ROSTER_PENDING = 4, /* On irc->roster_pending. */
+	IRC_USER_ROSTER_REGROUP = 8, /* Also moved to another group meanwhile. */
 	
 	IRC_USER_OTR_ENCRYPTED = 0x10000,
 	IRC_USER_OTR_TRUSTED   = 0x20000,
@@ -150,6 +171,9 @@ typedef enum
 	IRC_CHANNEL_JOINED = 1, /* The user is currently in the channel. */
 	IRC_CHANNEL_TEMP = 2,   /* Erase the channel when the user leaves,
 	                           and don't save it. */
+	IRC_CHANNEL_QUIET = 4,  /* Don't send JOINs/MODEs for other users, a
+	                           NAMES reply will follow instead. */
+	IRC_CHANNEL_NAMES_PENDING = 8,
 	
 	/* Hack: Set this flag right before jumping into IM when we expect
 	   a call to imcb_chat_new(). */
@@ -162,12 +186,14 @@ typedef struct irc_channel
 	char *name;
 	char mode[8];
 	int flags;
+	int id; /* Stays the same for the lifetime of the channel. */
 	
 	char *topic;
 	char *topic_who;
 	time_t topic_time;
 	
-	GSList *users; /* struct irc_channel_user */
+	GHashTable *users; /* irc_user_t -> struct irc_channel_user */
+	GSList *users_sorted; /* See irc_channel_users(). */
 	struct irc_user *last_target;
 	struct set *set;
 	
@@ -220,6 +246,11 @@ struct irc_control_channel
 	struct account *account;
 	struct prpl *protocol;
 	char modes[4];
+	
+	/* Where we're filed in irc->control_channels. */
+	gboolean indexed;
+	irc_control_channel_type_t index_type;
+	const void *index_key;
 };
 
 extern const struct bee_ui_funcs irc_ui_funcs;
@@ -271,6 +302,7 @@ void irc_free( irc_t *irc );
 void irc_setpass (irc_t *irc, const char *pass);
 
 void irc_process( irc_t *irc );
+int irc_tokenize( char *line, char **cmd );
 char **irc_parse_line( char *line );
 char *irc_build_line( char **cmd );
 
@@ -279,6 +311,9 @@ void irc_write_all( int now, char *format, ... ) G_GNUC_PRINTF( 2, 3 );
 void irc_vawrite( irc_t *irc, char *format, va_list params );
 
 void irc_flush( irc_t *irc );
+void irc_cork( void );
+void irc_uncork( void );
+void irc_flush_corked( void );
 void irc_switch_fd( irc_t *irc, int fd );
 void irc_sync( irc_t *irc );
 void irc_desync( irc_t *irc );
@@ -298,6 +333,8 @@ void irc_channel_free_soon( irc_channel_t *ic );
 int irc_channel_add_user( irc_channel_t *ic, irc_user_t *iu );
 int irc_channel_del_user( irc_channel_t *ic, irc_user_t *iu, irc_channel_del_user_type_t type, const char *msg );
 irc_channel_user_t *irc_channel_has_user( irc_channel_t *ic, irc_user_t *iu );
+GSList *irc_channel_users( irc_channel_t *ic );
+void irc_channel_users_changed( irc_channel_t *ic );
 struct irc_channel *irc_channel_with_user( irc_t *irc, irc_user_t *iu );
 int irc_channel_set_topic( irc_channel_t *ic, const char *topic, const irc_user_t *who );
 void irc_channel_user_set_mode( irc_channel_t *ic, irc_user_t *iu, irc_channel_user_flags_t flags );
@@ -307,6 +344,9 @@ void irc_channel_printf( irc_channel_t *ic, char *format, ... );
 gboolean irc_channel_name_ok( const char *name );
 void irc_channel_name_strip( char *name );
 int irc_channel_name_cmp( const char *a_, const char *b_ );
+guint irc_channel_name_hash( gconstpointer name );
+gboolean irc_channel_name_equal( gconstpointer a, gconstpointer b );
+void irc_channel_rename( irc_channel_t *ic, char *name );
 void irc_channel_update_ops( irc_channel_t *ic, char *value );
 char *set_eval_irc_channel_ops( struct set *set, char *value );
 gboolean irc_channel_wants_user( irc_channel_t *ic, irc_user_t *iu );
@@ -341,6 +381,7 @@ void irc_send_invite( irc_user_t *iu, irc_channel_t *ic );
 /* irc_user.c */
 irc_user_t *irc_user_new( irc_t *irc, const char *nick );
 int irc_user_free( irc_t *irc, irc_user_t *iu );
+void irc_user_free_all( irc_t *irc );
 irc_user_t *irc_user_by_name( irc_t *irc, const char *nick );
 int irc_user_set_nick( irc_user_t *iu, const char *new_nick );
 gint irc_user_cmp( gconstpointer a_, gconstpointer b_ );
@@ -41,11 +41,23 @@ irc_channel_t *irc_channel_new( irc_t *irc, const char *name )
 	ic = g_new0( irc_channel_t, 1 );
 	ic->irc = irc;
 	ic->name = g_strdup( name );
+	ic->users = g_hash_table_new_full( g_direct_hash, g_direct_equal, NULL, slab_free );
 	strcpy( ic->mode, CMODE );
 	
 	irc_channel_add_user( ic, irc->root );
 	
 	irc->channels = g_slist_append( irc->channels, ic );
+	g_hash_table_insert( irc->channel_hash, ic->name, ic );
+	
+	/* Take the lowest free number, so they stay the same as the
+	   position in the list as long as nothing gets deleted. */
+	for( ic->id = 0; ic->id < irc->channel_ids->len; ic->id ++ )
+		if( g_ptr_array_index( irc->channel_ids, ic->id ) == NULL )
+			break;
+	if( ic->id == irc->channel_ids->len )
+		g_ptr_array_add( irc->channel_ids, ic );
+	else
+		g_ptr_array_index( irc->channel_ids, ic->id ) = ic;
 	
 	set_add( &ic->set, "auto_join", "false", set_eval_bool, ic );
 	set_add( &ic->set, "type", "control", set_eval_channel_type, ic );
@@ -60,17 +72,7 @@ irc_channel_t *irc_channel_new( irc_t *irc, const char *name )
 
 irc_channel_t *irc_channel_by_name( irc_t *irc, const char *name )
 {
-	GSList *l;
-	
-	for( l = irc->channels; l; l = l->next )
-	{
-		irc_channel_t *ic = l->data;
-		
-		if( irc_channel_name_cmp( name, ic->name ) == 0 )
-			return ic;
-	}
-	
-	return NULL;
+	return g_hash_table_lookup( irc->channel_hash, name );
 }
 
 irc_channel_t *irc_channel_get( irc_t *irc, char *id )
@@ -81,12 +83,8 @@ irc_channel_t *irc_channel_get( irc_t *irc, char *id )
 	
 	if( sscanf( id, "%d", &nr ) == 1 && nr < 1000 )
 	{
-		for( l = irc->channels; l; l = l->next )
-		{
-			ic = l->data;
-			if( ( nr-- ) == 0 ) 
-				return ic;
-		}
+		if( nr >= 0 && nr < irc->channel_ids->len )
+			return g_ptr_array_index( irc->channel_ids, nr );
 		
 		return NULL;
 	}
@@ -132,19 +130,29 @@ int irc_channel_free( irc_channel_t *ic )
 		set_del( &ic->set, ic->set->key );
 	
 	irc->channels = g_slist_remove( irc->channels, ic );
-	while( ic->users )
+	g_hash_table_remove( irc->channel_hash, ic->name );
+	g_ptr_array_index( irc->channel_ids, ic->id ) = NULL;
+	while( irc->channel_ids->len > 0 &&
+	       g_ptr_array_index( irc->channel_ids, irc->channel_ids->len - 1 ) == NULL )
+		g_ptr_array_set_size( irc->channel_ids, irc->channel_ids->len - 1 );
+	g_slist_free( ic->users_sorted );
+	
+	if( irc->status & USTATUS_SHUTDOWN )
 	{
-		g_free( ic->users->data );
-		ic->users = g_slist_remove( ic->users, ic->users->data );
+		/* irc_free() drops all members (and users) with their pools. */
+		g_hash_table_steal_all( ic->users );
 	}
-	
-	for( l = irc->users; l; l = l->next )
+	else
 	{
-		irc_user_t *iu = l->data;
-		
-		if( iu->last_channel == ic )
-			iu->last_channel = irc->default_channel;
+		for( l = irc->users; l; l = l->next )
+		{
+			irc_user_t *iu = l->data;
+			
+			if( iu->last_channel == ic )
+				iu->last_channel = irc->default_channel;
+		}
 	}
+	g_hash_table_destroy( ic->users );
 	
 	if( ic->pastebuf_timer ) b_event_remove( ic->pastebuf_timer );
 	
@@ -221,14 +229,21 @@ int irc_channel_add_user( irc_channel_t *ic, irc_user_t *iu )
 	if( irc_channel_has_user( ic, iu ) )
 		return 0;
 	
-	icu = g_new0( irc_channel_user_t, 1 );
+	icu = slab_alloc( ic->irc->channel_user_slab );
 	icu->iu = iu;
 	
-	ic->users = g_slist_insert_sorted( ic->users, icu, irc_channel_user_cmp );
+	g_hash_table_insert( ic->users, iu, icu );
+	irc_channel_users_changed( ic );
 	
-	irc_channel_update_ops( ic, set_getstr( &ic->irc->b->set, "ops" ) );
+	/* The ops setting is only about root and the user. */
+	if( iu == ic->irc->root || iu == ic->irc->user )
+		irc_channel_update_ops( ic, set_getstr( &ic->irc->b->set, "ops" ) );
 	
-	if( iu == ic->irc->user || ic->flags & IRC_CHANNEL_JOINED )
+	if( iu != ic->irc->user && ic->flags & IRC_CHANNEL_QUIET )
+	{
+		ic->flags |= IRC_CHANNEL_NAMES_PENDING;
+	}
+	else if( iu == ic->irc->user || ic->flags & IRC_CHANNEL_JOINED )
 	{
 		ic->flags |= IRC_CHANNEL_JOINED;
 		irc_send_join( ic, iu );
@@ -239,13 +254,11 @@ int irc_channel_add_user( irc_channel_t *ic, irc_user_t *iu )
 
 int irc_channel_del_user( irc_channel_t *ic, irc_user_t *iu, irc_channel_del_user_type_t type, const char *msg )
 {
-	irc_channel_user_t *icu;
-	
-	if( !( icu = irc_channel_has_user( ic, iu ) ) )
+	if( !irc_channel_has_user( ic, iu ) )
 		return 0;
 	
-	ic->users = g_slist_remove( ic->users, icu );
-	g_free( icu );
+	g_hash_table_remove( ic->users, iu );
+	irc_channel_users_changed( ic );
 	
 	if( !( ic->flags & IRC_CHANNEL_JOINED ) || type == IRC_CDU_SILENT ) {}
 		/* Do nothing. The caller should promise it won't screw
@@ -270,11 +283,8 @@ int irc_channel_del_user( irc_channel_t *ic, irc_user_t *iu, irc_channel_del_use
 		else
 		{
 			/* Flush userlist now. The user won't see it anyway. */
-			while( ic->users )
-			{
-				g_free( ic->users->data );
-				ic->users = g_slist_remove( ic->users, ic->users->data );
-			}
+			g_hash_table_remove_all( ic->users );
+			irc_channel_users_changed( ic );
 			irc_channel_add_user( ic, ic->irc->root );
 		}
 	}
@@ -284,17 +294,34 @@ int irc_channel_del_user( irc_channel_t *ic, irc_user_t *iu, irc_channel_del_use
 
 irc_channel_user_t *irc_channel_has_user( irc_channel_t *ic, irc_user_t *iu )
 {
-	GSList *l;
+	return g_hash_table_lookup( ic->users, iu );
+}
+
+static gint irc_channel_user_cmp( gconstpointer a_, gconstpointer b_ );
+
+/* Channel members (irc_channel_user_t) sorted by nick, for NAMES/WHO.
+   Membership itself is just a hash table, this list only gets built
+   when someone asks for it and is kept until the membership changes. */
+GSList *irc_channel_users( irc_channel_t *ic )
+{
+	GHashTableIter iter;
+	gpointer icu;
 	
-	for( l = ic->users; l; l = l->next )
-	{
-		irc_channel_user_t *icu = l->data;
-		
-		if( icu->iu == iu )
-			return icu;
-	}
+	if( ic->users_sorted || g_hash_table_size( ic->users ) == 0 )
+		return ic->users_sorted;
 	
-	return NULL;
+	g_hash_table_iter_init( &iter, ic->users );
+	while( g_hash_table_iter_next( &iter, NULL, &icu ) )
+		ic->users_sorted = g_slist_prepend( ic->users_sorted, icu );
+	
+	return ic->users_sorted = g_slist_sort( ic->users_sorted, irc_channel_user_cmp );
+}
+
+/* Call this when someone joins/leaves or changes nicks. */
+void irc_channel_users_changed( irc_channel_t *ic )
+{
+	g_slist_free( ic->users_sorted );
+	ic->users_sorted = NULL;
 }
 
 /* Find a channel we're currently in, that currently has iu in it. */
@@ -306,7 +333,7 @@ struct irc_channel *irc_channel_with_user( irc_t *irc, irc_user_t *iu )
 	{
 		irc_channel_t *ic = l->data;
 		
-		if( strcmp( set_getstr( &ic->set, "type" ), "control" ) != 0 )
+		if( ic->f != &control_channel_funcs )
 			continue;
 		
 		if( ( ic->flags & IRC_CHANNEL_JOINED ) &&
@@ -323,7 +350,7 @@ struct irc_channel *irc_channel_with_user( irc_t *irc, irc_user_t *iu )
 	{
 		irc_channel_t *ic = l->data;
 		
-		if( strcmp( set_getstr( &ic->set, "type" ), "control" ) != 0 )
+		if( ic->f != &control_channel_funcs )
 			continue;
 		
 		if( ( ic->flags & IRC_CHANNEL_JOINED ) &&
@@ -360,7 +387,9 @@ void irc_channel_user_set_mode( irc_channel_t *ic, irc_user_t *iu, irc_channel_u
 	if( !icu || icu->flags == flags )
 		return;
 	
-	if( ic->flags & IRC_CHANNEL_JOINED )
+	if( ic->flags & IRC_CHANNEL_QUIET )
+		ic->flags |= IRC_CHANNEL_NAMES_PENDING;
+	else if( ic->flags & IRC_CHANNEL_JOINED )
 		irc_send_channel_user_mode_diff( ic, iu, icu->flags, flags );
 	
 	icu->flags = flags;
@@ -496,10 +525,10 @@ void irc_channel_name_strip( char *name )
 	name[j] = '\0';
 }
 
-int irc_channel_name_cmp( const char *a_, const char *b_ )
+static unsigned char case_map[256];
+
+static void irc_channel_case_map_init( void )
 {
-	static unsigned char case_map[256];
-	const unsigned char *a = (unsigned char*) a_, *b = (unsigned char*) b_;
 	int i;
 	
 	if( case_map['A'] == '\0' )
@@ -516,6 +545,14 @@ int irc_channel_name_cmp( const char *a_, const char *b_ )
 		case_map['~'] = '`';
 		case_map['\\'] = '|';
 	}
+}
+
+int irc_channel_name_cmp( const char *a_, const char *b_ )
+{
+	const unsigned char *a = (unsigned char*) a_, *b = (unsigned char*) b_;
+	int i;
+	
+	irc_channel_case_map_init();
 	
 	if( !irc_channel_name_ok( a_ ) || !irc_channel_name_ok( b_ ) )
 		return -1;
@@ -531,6 +568,36 @@ int irc_channel_name_cmp( const char *a_, const char *b_ )
 	return case_map[a[i]] - case_map[b[i]];
 }
 
+/* For irc->channel_hash. Names that compare equal using the function above
+   have to hash to the same value, so this stops at the same characters. */
+guint irc_channel_name_hash( gconstpointer name )
+{
+	const unsigned char *s = name;
+	guint h = 5381;
+	
+	irc_channel_case_map_init();
+	
+	for( ; *s && case_map[*s]; s ++ )
+		h = h * 33 + case_map[*s];
+	
+	return h;
+}
+
+gboolean irc_channel_name_equal( gconstpointer a, gconstpointer b )
+{
+	return irc_channel_name_cmp( a, b ) == 0;
+}
+
+/* Change the name of a channel, name has to be g_malloc()ed and becomes
+   the channel's. */
+void irc_channel_rename( irc_channel_t *ic, char *name )
+{
+	g_hash_table_remove( ic->irc->channel_hash, ic->name );
+	g_free( ic->name );
+	ic->name = name;
+	g_hash_table_insert( ic->irc->channel_hash, ic->name, ic );
+}
+
 static gint irc_channel_user_cmp( gconstpointer a_, gconstpointer b_ )
 {
 	const irc_channel_user_t *a = a_, *b = b_;
@@ -628,6 +695,69 @@ static char *set_eval_by_group( set_t *set, char *value );
 static char *set_eval_by_protocol( set_t *set, char *value );
 static char *set_eval_show_users( set_t *set, char *value );
 
+/* Presence updates only look at the control channels that can possibly
+   want a user (see bee_irc_channel_update()), so keep track of what every
+   control channel is filled by. Has to be called whenever the fill_by
+   setting or the group/account/protocol it uses changes. */
+static void control_channel_unindex( irc_channel_t *ic )
+{
+	struct irc_control_channel *icc = ic->data;
+	irc_t *irc = ic->irc;
+	GSList *l;
+	
+	if( !icc->indexed )
+		return;
+	
+	switch( icc->index_type )
+	{
+	case IRC_CC_TYPE_GROUP:
+	case IRC_CC_TYPE_ACCOUNT:
+	case IRC_CC_TYPE_PROTOCOL:
+		l = g_hash_table_lookup( irc->control_channels, icc->index_key );
+		if( ( l = g_slist_remove( l, ic ) ) )
+			g_hash_table_insert( irc->control_channels, (gpointer) icc->index_key, l );
+		else
+			g_hash_table_remove( irc->control_channels, icc->index_key );
+		break;
+	default:
+		irc->control_channels_all = g_slist_remove( irc->control_channels_all, ic );
+	}
+	
+	icc->indexed = FALSE;
+}
+
+static void control_channel_index( irc_channel_t *ic )
+{
+	struct irc_control_channel *icc = ic->data;
+	irc_t *irc = ic->irc;
+	GSList *l;
+	
+	control_channel_unindex( ic );
+	
+	icc->indexed = TRUE;
+	icc->index_type = icc->type;
+	switch( icc->type )
+	{
+	case IRC_CC_TYPE_GROUP:
+		icc->index_key = icc->group;
+		break;
+	case IRC_CC_TYPE_ACCOUNT:
+		icc->index_key = icc->account;
+		break;
+	case IRC_CC_TYPE_PROTOCOL:
+		icc->index_key = icc->protocol;
+		break;
+	default:
+		icc->index_key = NULL;
+		irc->control_channels_all = g_slist_append( irc->control_channels_all, ic );
+		return;
+	}
+	
+	l = g_hash_table_lookup( irc->control_channels, icc->index_key );
+	g_hash_table_insert( irc->control_channels, (gpointer) icc->index_key,
+	                     g_slist_append( l, ic ) );
+}
+
 static gboolean control_channel_init( irc_channel_t *ic )
 {
 	struct irc_control_channel *icc;
@@ -642,6 +772,7 @@ static gboolean control_channel_init( irc_channel_t *ic )
 	
 	ic->data = icc = g_new0( struct irc_control_channel, 1 );
 	icc->type = IRC_CC_TYPE_DEFAULT;
+	control_channel_index( ic );
 	
 	/* Have to run the evaluator to initialize icc->modes. */
 	set_setstr( &ic->set, "show_users", "online+,away" );
@@ -670,7 +801,10 @@ static char *set_eval_by_account( set_t *set, char *value )
 	
 	icc->account = acc;
 	if( icc->type == IRC_CC_TYPE_ACCOUNT )
+	{
+		control_channel_index( ic );
 		bee_irc_channel_update( ic->irc, ic, NULL );
+	}
 	
 	return g_strdup( acc->tag );
 }
@@ -693,6 +827,7 @@ static char *set_eval_fill_by( set_t *set, char *value )
 	else
 		return SET_INVALID;
 	
+	control_channel_index( ic );
 	bee_irc_channel_update( ic->irc, ic, NULL );
 	return value;
 }
@@ -704,7 +839,10 @@ static char *set_eval_by_group( set_t *set, char *value )
 	
 	icc->group = bee_group_by_name( ic->irc->b, value, TRUE );
 	if( icc->type == IRC_CC_TYPE_GROUP )
+	{
+		control_channel_index( ic );
 		bee_irc_channel_update( ic->irc, ic, NULL );
+	}
 	
 	return g_strdup( icc->group->name );
 }
@@ -720,7 +858,10 @@ static char *set_eval_by_protocol( set_t *set, char *value )
 	
 	icc->protocol = prpl;
 	if( icc->type == IRC_CC_TYPE_PROTOCOL )
+	{
+		control_channel_index( ic );
 		bee_irc_channel_update( ic->irc, ic, NULL );
+	}
 	
 	return value;
 }
@@ -803,6 +944,7 @@ static gboolean control_channel_free( irc_channel_t *ic )
 	set_del( &ic->set, "protocol" );
 	set_del( &ic->set, "show_users" );
 	
+	control_channel_unindex( ic );
 	g_free( icc );
 	ic->data = NULL;
 	
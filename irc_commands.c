@@ -311,7 +311,7 @@ static void irc_cmd_who( irc_t *irc, char **cmd )
 	if( !channel || *channel == '0' || *channel == '*' || !*channel )
 		irc_send_who( irc, irc->users, "**" );
 	else if( ( ic = irc_channel_by_name( irc, channel ) ) )
-		irc_send_who( irc, ic->users, channel );
+		irc_send_who( irc, irc_channel_users( ic ), channel );
 	else if( ( iu = irc_user_by_name( irc, channel ) ) )
 	{
 		/* Tiny hack! */
@@ -678,7 +678,7 @@ static void irc_cmd_list( irc_t *irc, char **cmd )
 		irc_channel_t *ic = l->data;
 		
 		irc_send_num( irc, 322, "%s %d :%s",
-		              ic->name, g_slist_length( ic->users ), ic->topic ? : "" );
+		              ic->name, g_hash_table_size( ic->users ), ic->topic ? : "" );
 	}
 	irc_send_num( irc, 323, ":%s", "End of /LIST" );
 }
@@ -689,6 +689,26 @@ static void irc_cmd_version( irc_t *irc, char **cmd )
 	              PACKAGE, BITLBEE_VERSION, irc->root->host, ARCH, CPU );
 }
 
+static void irc_cmd_stats( irc_t *irc, char **cmd )
+{
+	slab_t *slab[3] = { irc->b->user_slab, irc->user_slab, irc->channel_user_slab };
+	int i;
+	
+	irc_send_num( irc, 249, ":Lines sent: %llu, write calls: %llu",
+	              (unsigned long long) irc->lines_out,
+	              (unsigned long long) irc->writes_out );
+	irc_send_num( irc, 249, ":Status updates: %llu, absorbed by presence_delay: %llu",
+	              (unsigned long long) irc->b->presence_in,
+	              (unsigned long long) irc->b->presence_absorbed );
+	
+	for( i = 0; i < 3; i ++ )
+		irc_send_num( irc, 249, ":Memory for %s: %u in use, %lu kB",
+		              slab[i]->name, slab[i]->used,
+		              (unsigned long) ( slab_bytes( slab[i] ) / 1024 ) );
+	
+	irc_send_num( irc, 219, "%s :End of /STATS report", cmd[1] ? cmd[1] : "*" );
+}
+
 static void irc_cmd_completions( irc_t *irc, char **cmd )
 {
 	help_t *h;
@@ -740,6 +760,7 @@ static const command_t irc_commands[] = {
 	{ "ns",          1, irc_cmd_nickserv,    IRC_CMD_LOGGED_IN },
 	{ "away",        0, irc_cmd_away,        IRC_CMD_LOGGED_IN },
 	{ "version",     0, irc_cmd_version,     IRC_CMD_LOGGED_IN },
+	{ "stats",       0, irc_cmd_stats,       IRC_CMD_LOGGED_IN },
 	{ "completions", 0, irc_cmd_completions, IRC_CMD_LOGGED_IN },
 	{ "userhost",    1, irc_cmd_userhost,    IRC_CMD_LOGGED_IN },
 	{ "ison",        1, irc_cmd_ison,        IRC_CMD_LOGGED_IN },
@@ -760,46 +781,50 @@ static const command_t irc_commands[] = {
 
 void irc_exec( irc_t *irc, char *cmd[] )
 {	
-	int i, n_arg;
+	static command_table_t *table = NULL;
+	const command_t *c;
+	int n_arg;
 	
 	if( !cmd[0] )
 		return;
 	
-	for( i = 0; irc_commands[i].command; i++ )
-		if( g_strcasecmp( irc_commands[i].command, cmd[0] ) == 0 )
+	if( table == NULL )
+		table = command_table_new( irc_commands );
+	
+	if( ( c = command_table_find( table, cmd[0] ) ) )
+	{
+		/* There should be no typo in the next line: */
+		for( n_arg = 0; cmd[n_arg]; n_arg ++ ); n_arg --;
+		
+		if( c->flags & IRC_CMD_PRE_LOGIN && irc->status & USTATUS_LOGGED_IN )
 		{
-			/* There should be no typo in the next line: */
-			for( n_arg = 0; cmd[n_arg]; n_arg ++ ); n_arg --;
-			
-			if( irc_commands[i].flags & IRC_CMD_PRE_LOGIN && irc->status & USTATUS_LOGGED_IN )
-			{
-				irc_send_num( irc, 462, ":Only allowed before logging in" );
-			}
-			else if( irc_commands[i].flags & IRC_CMD_LOGGED_IN && !( irc->status & USTATUS_LOGGED_IN ) )
-			{
-				irc_send_num( irc, 451, ":Register first" );
-			}
-			else if( irc_commands[i].flags & IRC_CMD_OPER_ONLY && !strchr( irc->umode, 'o' ) )
-			{
-				irc_send_num( irc, 481, ":Permission denied - You're not an IRC operator" );
-			}
-			else if( n_arg < irc_commands[i].required_parameters )
-			{
-				irc_send_num( irc, 461, "%s :Need more parameters", cmd[0] );
-			}
-			else if( irc_commands[i].flags & IRC_CMD_TO_MASTER )
-			{
-				/* IPC doesn't make sense in inetd mode,
-				    but the function will catch that. */
-				ipc_to_master( cmd );
-			}
-			else
-			{
-				irc_commands[i].execute( irc, cmd );
-			}
-			
-			return;
+			irc_send_num( irc, 462, ":Only allowed before logging in" );
 		}
+		else if( c->flags & IRC_CMD_LOGGED_IN && !( irc->status & USTATUS_LOGGED_IN ) )
+		{
+			irc_send_num( irc, 451, ":Register first" );
+		}
+		else if( c->flags & IRC_CMD_OPER_ONLY && !strchr( irc->umode, 'o' ) )
+		{
+			irc_send_num( irc, 481, ":Permission denied - You're not an IRC operator" );
+		}
+		else if( n_arg < c->required_parameters )
+		{
+			irc_send_num( irc, 461, "%s :Need more parameters", cmd[0] );
+		}
+		else if( c->flags & IRC_CMD_TO_MASTER )
+		{
+			/* IPC doesn't make sense in inetd mode,
+			    but the function will catch that. */
+			ipc_to_master( cmd );
+		}
+		else
+		{
+			c->execute( irc, cmd );
+		}
+		
+		return;
+	}
 	
 	if( irc->status & USTATUS_LOGGED_IN )
 		irc_send_num( irc, 421, "%s :Unknown command", cmd[0] );
@@ -48,8 +48,7 @@ static gboolean bee_irc_user_new( bee_t *bee, bee_user_t *bu )
 	irc_t *irc = (irc_t*) bee->ui_data;
 	char nick[MAX_NICK_LENGTH+1], *s;
 	
-	memset( nick, 0, MAX_NICK_LENGTH + 1 );
-	strcpy( nick, nick_get( bu ) );
+	nick_get( bu, nick );
 	
 	bu->ui_data = iu = irc_user_new( irc, nick );
 	iu->bu = bu;
@@ -61,16 +60,16 @@ static gboolean bee_irc_user_new( bee_t *bee, bee_user_t *bu )
 	
 	if( ( s = strchr( bu->handle, '@' ) ) )
 	{
-		iu->host = g_strdup( s + 1 );
+		iu->host = (char *) str_ref( s + 1 );
 		iu->user = g_strndup( bu->handle, s - bu->handle );
 	}
 	else
 	{
 		iu->user = g_strdup( bu->handle );
 		if( bu->ic->acc->server )
-			iu->host = g_strdup( bu->ic->acc->server );
+			iu->host = (char *) str_ref( bu->ic->acc->server );
 		else
-			iu->host = g_strdup( bu->ic->acc->prpl->name );
+			iu->host = (char *) str_ref( bu->ic->acc->prpl->name );
 	}
 	
 	while( ( s = strchr( iu->user, ' ' ) ) )
@@ -139,10 +138,65 @@ static gboolean bee_irc_user_status( bee_t *bee, bee_user_t *bu, bee_user_t *old
 	return TRUE;
 }
 
+/* Update iu in the control channels that can possibly want it. This
+   assumes the user isn't in any other channels already, which holds as
+   long as the user's group doesn't change. */
+static void bee_irc_channel_update_indexed( irc_t *irc, irc_user_t *iu )
+{
+	bee_user_t *bu = iu->bu;
+	const void *keys[3];
+	GSList *l;
+	int i;
+	
+	keys[0] = bu->group;
+	keys[1] = bu->ic->acc;
+	keys[2] = bu->ic->acc->prpl;
+	
+	for( l = irc->control_channels_all; l; l = l->next )
+		if( ( (irc_channel_t *) l->data )->flags & IRC_CHANNEL_JOINED )
+			bee_irc_channel_update( irc, l->data, iu );
+	
+	for( i = 0; i < 3; i ++ )
+		for( l = g_hash_table_lookup( irc->control_channels, keys[i] ); l; l = l->next )
+			if( ( (irc_channel_t *) l->data )->flags & IRC_CHANNEL_JOINED )
+				bee_irc_channel_update( irc, l->data, iu );
+}
+
+/* For when the user may also have to leave channels it's in now. */
+static void bee_irc_channel_update_all( irc_t *irc, irc_user_t *iu )
+{
+	GSList *l;
+	
+	for( l = irc->channels; l; l = l->next )
+	{
+		irc_channel_t *ic = l->data;
+		
+		if( ic->f == irc->default_channel->f &&
+		    ( ic->flags & IRC_CHANNEL_JOINED ) )
+			bee_irc_channel_update( irc, ic, iu );
+	}
+}
+
+/* Save up channel updates until the end of a contact list. */
+static void bee_irc_roster_queue( irc_t *irc, irc_user_t *iu, int flags )
+{
+	if( !( iu->flags & IRC_USER_ROSTER_PENDING ) )
+		irc->roster_pending = g_slist_prepend( irc->roster_pending, iu );
+	iu->flags |= IRC_USER_ROSTER_PENDING | flags;
+}
+
 void bee_irc_channel_update( irc_t *irc, irc_channel_t *ic, irc_user_t *iu )
 {
 	GSList *l;
 	
+	if( ic == NULL && iu && iu->bu )
+	{
+		if( irc->roster_batch )
+			bee_irc_roster_queue( irc, iu, 0 );
+		else
+			bee_irc_channel_update_indexed( irc, iu );
+		return;
+	}
 	if( ic == NULL )
 	{
 		for( l = irc->channels; l; l = l->next )
@@ -338,7 +392,12 @@ static gboolean bee_irc_user_group( bee_t *bee, bee_user_t *bu )
 	if( ( online = bu->flags & BEE_USER_ONLINE ) )
 		bu->flags &= ~BEE_USER_ONLINE;
 	
-	bee_irc_channel_update( irc, NULL, iu );
+	/* The user may be in channels for its old group, so this one can't
+	   use the index. */
+	if( irc->roster_batch )
+		bee_irc_roster_queue( irc, iu, IRC_USER_ROSTER_REGROUP );
+	else
+		bee_irc_channel_update_all( irc, iu );
 	bee_irc_user_nick_update( iu );
 	
 	if( online )
@@ -353,7 +412,7 @@ static gboolean bee_irc_user_group( bee_t *bee, bee_user_t *bu )
 static gboolean bee_irc_user_nick_update( irc_user_t *iu )
 {
 	bee_user_t *bu = iu->bu;
-	char *newnick;
+	char newnick[MAX_NICK_LENGTH+1];
 	
 	if( bu->flags & BEE_USER_ONLINE )
 		/* Ignore if the user is visible already. */
@@ -363,7 +422,7 @@ static gboolean bee_irc_user_nick_update( irc_user_t *iu )
 		/* The user already assigned a nickname to this person. */
 		return TRUE;
 	
-	newnick = nick_get( bu );
+	nick_get( bu, newnick );
 	
 	if( strcmp( iu->nick, newnick ) != 0 )
 	{
@@ -726,8 +785,7 @@ static gboolean bee_irc_chat_name_hint( bee_t *bee, struct groupchat *c, const c
 		}
 	}
 	
-	g_free( ic->name );
-	ic->name = full_name;
+	irc_channel_rename( ic, full_name );
 	
 	return TRUE;
 }
@@ -1075,6 +1133,57 @@ static void bee_irc_ft_finished( struct im_connection *ic, file_transfer_t *file
 		df->proto_finished = TRUE;
 }
 
+static gboolean bee_irc_roster_begin( bee_t *bee, struct im_connection *ic )
+{
+	irc_t *irc = bee->ui_data;
+	
+	irc->roster_batch ++;
+	
+	return TRUE;
+}
+
+/* Apply all the saved up channel updates. Instead of a JOIN (and MODE) per
+   contact, every channel that changed gets a single NAMES reply. */
+static gboolean bee_irc_roster_end( bee_t *bee, struct im_connection *ic )
+{
+	irc_t *irc = bee->ui_data;
+	GSList *l;
+	
+	if( irc->roster_batch == 0 || -- irc->roster_batch > 0 )
+		return TRUE;
+	
+	irc->users = g_slist_sort( irc->users, irc_user_cmp );
+	
+	for( l = irc->channels; l; l = l->next )
+		( (irc_channel_t *) l->data )->flags |= IRC_CHANNEL_QUIET;
+	
+	while( irc->roster_pending )
+	{
+		irc_user_t *iu = irc->roster_pending->data;
+		int flags = iu->flags;
+		
+		irc->roster_pending = g_slist_delete_link( irc->roster_pending, irc->roster_pending );
+		iu->flags &= ~( IRC_USER_ROSTER_PENDING | IRC_USER_ROSTER_REGROUP );
+		
+		if( flags & IRC_USER_ROSTER_REGROUP )
+			bee_irc_channel_update_all( irc, iu );
+		else
+			bee_irc_channel_update_indexed( irc, iu );
+	}
+	
+	for( l = irc->channels; l; l = l->next )
+	{
+		irc_channel_t *ic = l->data;
+		
+		if( ( ic->flags & IRC_CHANNEL_NAMES_PENDING ) &&
+		    ( ic->flags & IRC_CHANNEL_JOINED ) )
+			irc_send_names( ic );
+		ic->flags &= ~( IRC_CHANNEL_QUIET | IRC_CHANNEL_NAMES_PENDING );
+	}
+	
+	return TRUE;
+}
+
 const struct bee_ui_funcs irc_ui_funcs = {
 	bee_irc_imc_connected,
 	bee_irc_imc_disconnected,
@@ -1103,4 +1212,7 @@ const struct bee_ui_funcs irc_ui_funcs = {
 	bee_irc_ft_out_start,
 	bee_irc_ft_close,
 	bee_irc_ft_finished,
+	
+	bee_irc_roster_begin,
+	bee_irc_roster_end,
 };
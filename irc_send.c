@@ -206,7 +206,7 @@ void irc_send_names( irc_channel_t *ic )
 	
 	/* RFCs say there is no error reply allowed on NAMES, so when the
 	   channel is invalid, just give an empty reply. */
-	for( l = ic->users; l; l = l->next )
+	for( l = irc_channel_users( ic ); l; l = l->next )
 	{
 		irc_channel_user_t *icu = l->data;
 		irc_user_t *iu = icu->iu;
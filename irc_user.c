@@ -28,7 +28,7 @@
 
 irc_user_t *irc_user_new( irc_t *irc, const char *nick )
 {
-	irc_user_t *iu = g_new0( irc_user_t, 1 );
+	irc_user_t *iu = slab_alloc( irc->user_slab );
 	
 	iu->irc = irc;
 	iu->nick = g_strdup( nick );
@@ -40,11 +40,26 @@ irc_user_t *irc_user_new( irc_t *irc, const char *nick )
 	   through the list (since the GLib API doesn't have anything sane
 	   for that.) */
 	g_hash_table_insert( irc->nick_user_hash, iu->key, iu );
-	irc->users = g_slist_insert_sorted( irc->users, iu, irc_user_cmp );
+	if( irc->roster_batch )
+		irc->users = g_slist_prepend( irc->users, iu ); /* Sorted later. */
+	else
+		irc->users = g_slist_insert_sorted( irc->users, iu, irc_user_cmp );
 	
 	return iu;
 }
 
+/* Everything iu owns, but not iu itself. */
+static void irc_user_free_data( irc_user_t *iu )
+{
+	g_free( iu->nick );
+	if( iu->nick != iu->user ) g_free( iu->user );
+	if( iu->nick != iu->host ) str_unref( iu->host );
+	if( iu->nick != iu->fullname ) g_free( iu->fullname );
+	g_free( iu->pastebuf );
+	if( iu->pastebuf_timer ) b_event_remove( iu->pastebuf_timer );
+	g_free( iu->key );
+}
+
 int irc_user_free( irc_t *irc, irc_user_t *iu )
 {
 	static struct im_connection *last_ic;
@@ -53,6 +68,15 @@ int irc_user_free( irc_t *irc, irc_user_t *iu )
 	if( !iu )
 		return 0;
 	
+	/* The whole session is going away, irc_user_free_all() will take
+	   care of everyone at once. Just forget about the contact, that
+	   one is freed by now. */
+	if( irc->status & USTATUS_SHUTDOWN )
+	{
+		iu->bu = NULL;
+		return 1;
+	}
+	
 	if( iu->bu &&
 	    ( iu->bu->ic->flags & OPT_LOGGING_OUT ) &&
 	    iu->bu->ic != last_ic )
@@ -88,19 +112,32 @@ int irc_user_free( irc_t *irc, irc_user_t *iu )
 	
 	irc->users = g_slist_remove( irc->users, iu );
 	g_hash_table_remove( irc->nick_user_hash, iu->key );
+	nick_release( irc, iu->key );
+	if( iu->flags & IRC_USER_ROSTER_PENDING )
+		irc->roster_pending = g_slist_remove( irc->roster_pending, iu );
 	
-	g_free( iu->nick );
-	if( iu->nick != iu->user ) g_free( iu->user );
-	if( iu->nick != iu->host ) g_free( iu->host );
-	if( iu->nick != iu->fullname ) g_free( iu->fullname );
-	g_free( iu->pastebuf );
-	if( iu->pastebuf_timer ) b_event_remove( iu->pastebuf_timer );
-	g_free( iu->key );
-	g_free( iu );
+	irc_user_free_data( iu );
+	slab_free( iu );
 	
 	return 1;
 }
 
+/* For irc_free() only: one pass over all users instead of taking them out
+   of every list and table one by one. The objects themselves go away with
+   irc->user_slab. */
+void irc_user_free_all( irc_t *irc )
+{
+	GSList *l;
+	
+	g_hash_table_remove_all( irc->nick_user_hash );
+	for( l = irc->users; l; l = l->next )
+		irc_user_free_data( l->data );
+	
+	g_slist_free( irc->users );
+	g_slist_free( irc->roster_pending );
+	irc->users = irc->roster_pending = NULL;
+}
+
 irc_user_t *irc_user_by_name( irc_t *irc, const char *nick )
 {
 	char key[strlen(nick)+1];
@@ -141,6 +178,7 @@ int irc_user_set_nick( irc_user_t *iu, const char *new )
 	
 	irc->users = g_slist_remove( irc->users, iu );
 	g_hash_table_remove( irc->nick_user_hash, iu->key );
+	nick_release( irc, iu->key );
 	
 	if( iu->nick == iu->user ) iu->user = NULL;
 	if( iu->nick == iu->host ) iu->host = NULL;
@@ -148,13 +186,21 @@ int irc_user_set_nick( irc_user_t *iu, const char *new )
 	g_free( iu->nick );
 	iu->nick = g_strdup( new );
 	if( iu->user == NULL ) iu->user = g_strdup( iu->nick );
-	if( iu->host == NULL ) iu->host = g_strdup( iu->nick );
+	if( iu->host == NULL ) iu->host = (char *) str_ref( iu->nick );
 	if( iu->fullname == NULL ) iu->fullname = g_strdup( iu->nick );
 	
 	g_free( iu->key );
 	iu->key = g_strdup( key );
 	g_hash_table_insert( irc->nick_user_hash, iu->key, iu );
-	irc->users = g_slist_insert_sorted( irc->users, iu, irc_user_cmp );
+	if( irc->roster_batch )
+		irc->users = g_slist_prepend( irc->users, iu );
+	else
+		irc->users = g_slist_insert_sorted( irc->users, iu, irc_user_cmp );
+	
+	/* Channel member lists are sorted by nick too. */
+	for( cl = irc->channels; cl; cl = cl->next )
+		if( irc_channel_has_user( cl->data, iu ) )
+			irc_channel_users_changed( cl->data );
 	
 	if( iu == irc->user )
 		ipc_to_master_str( "NICK :%s\r\n", new );
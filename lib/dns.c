@@ -0,0 +1,489 @@
+/***************************************************************************\
+*                                                                           *
+*  BitlBee - An IRC to IM gateway                                           *
+*  Asynchronous name resolution with a small cache                           *
+*                                                                           *
+*  Copyright 2002-2012 Wilmer van der Gaast and others                      *
+*                                                                           *
+*  This program is free software; you can redistribute it and/or modify     *
+*  it under the terms of the GNU General Public License as published by     *
+*  the Free Software Foundation; either version 2 of the License, or        *
+*  (at your option) any later version.                                      *
+*                                                                           *
+*  This program is distributed in the hope that it will be useful,          *
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+*  GNU General Public License for more details.                             *
+*                                                                           *
+*  You should have received a copy of the GNU General Public License along  *
+*  with this program; if not, write to the Free Software Foundation, Inc.,  *
+*  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.              *
+*                                                                           *
+\***************************************************************************/
+
+/* getaddrinfo() blocks, and one slow DNS server used to be enough to
+   freeze every user in the process. Lookups now happen in a few helper
+   threads that don't touch anything but their own query; results are
+   passed back to the event loop through a pipe. */
+
+#define BITLBEE_CORE
+#include "bitlbee.h"
+#include "dns.h"
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#ifndef AI_ADDRCONFIG
+#define AI_ADDRCONFIG 0
+#endif
+
+struct dns_entry
+{
+	char *key;
+	struct addrinfo *res; /* Without port numbers. */
+	time_t expires;
+};
+
+struct dns_query
+{
+	struct dns_query *next;
+	char *key;
+	char *host;
+	int family;
+	GSList *waiters;
+	
+	/* Filled in by the resolver thread. */
+	struct addrinfo *gai;
+	int error;
+};
+
+struct dns_waiter
+{
+	gint id;
+	int port;
+	dns_callback func; /* NULL if cancelled. */
+	gpointer data;
+};
+
+static GHashTable *dns_cache;   /* key -> struct dns_entry */
+
+#ifndef _WIN32
+static GHashTable *dns_busy;    /* key -> struct dns_query */
+static GHashTable *dns_waiters; /* id -> struct dns_waiter */
+static gint dns_next_id = 0;
+
+static pid_t dns_pid = 0;
+static int dns_pipe[2] = { -1, -1 };
+static gint dns_pipe_inpa = 0;
+
+/* Everything below is shared with the resolver threads. */
+static pthread_mutex_t dns_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dns_wake = PTHREAD_COND_INITIALIZER;
+static struct dns_query *dns_todo, *dns_done;
+static int dns_threads, dns_idle;
+#endif
+
+static char *dns_key( const char *host, int family )
+{
+	char *lc = g_ascii_strdown( host, -1 );
+	char *s = g_strdup_printf( "%d/%s", family, lc );
+	
+	g_free( lc );
+	return s;
+}
+
+/* Copies a getaddrinfo() result into something we can keep around and
+   hand out, setting the port number along the way. */
+static struct addrinfo *dns_copy( const struct addrinfo *src, int port )
+{
+	struct addrinfo *res = NULL, **tail = &res;
+	
+	for( ; src; src = src->ai_next )
+	{
+		struct addrinfo *ai;
+		
+		if( src->ai_family != AF_INET && src->ai_family != AF_INET6 )
+			continue;
+		
+		ai = g_malloc( sizeof( struct addrinfo ) + src->ai_addrlen );
+		memcpy( ai, src, sizeof( struct addrinfo ) );
+		ai->ai_addr = (struct sockaddr *) ( ai + 1 );
+		memcpy( ai->ai_addr, src->ai_addr, src->ai_addrlen );
+		ai->ai_canonname = NULL;
+		ai->ai_next = NULL;
+		
+		if( ai->ai_family == AF_INET )
+			( (struct sockaddr_in *) ai->ai_addr )->sin_port = htons( port );
+		else
+			( (struct sockaddr_in6 *) ai->ai_addr )->sin6_port = htons( port );
+		
+		*tail = ai;
+		tail = &ai->ai_next;
+	}
+	
+	return res;
+}
+
+void dns_free( struct addrinfo *res )
+{
+	while( res )
+	{
+		struct addrinfo *next = res->ai_next;
+		
+		g_free( res );
+		res = next;
+	}
+}
+
+static void dns_entry_free( gpointer data )
+{
+	struct dns_entry *e = data;
+	
+	dns_free( e->res );
+	g_free( e->key );
+	g_free( e );
+}
+
+static gboolean dns_entry_expired( gpointer key, gpointer value, gpointer data )
+{
+	struct dns_entry *e = value;
+	
+	return e->expires < *(time_t*) data;
+}
+
+static void dns_cache_add( const char *key, const struct addrinfo *gai )
+{
+	struct dns_entry *e;
+	time_t now = time( NULL );
+	
+	if( dns_cache == NULL )
+		dns_cache = g_hash_table_new_full( g_str_hash, g_str_equal, NULL, dns_entry_free );
+	
+	if( g_hash_table_size( dns_cache ) >= DNS_CACHE_MAX )
+	{
+		g_hash_table_foreach_remove( dns_cache, dns_entry_expired, &now );
+		
+		/* Still full? Then it's time for a fresh start. */
+		if( g_hash_table_size( dns_cache ) >= DNS_CACHE_MAX )
+			g_hash_table_remove_all( dns_cache );
+	}
+	
+	e = g_new0( struct dns_entry, 1 );
+	e->key = g_strdup( key );
+	e->res = dns_copy( gai, 0 );
+	e->expires = now + DNS_CACHE_TIME;
+	g_hash_table_replace( dns_cache, e->key, e );
+}
+
+/* See if we can answer without asking anyone: numeric addresses and
+   cached names. */
+static gboolean dns_lookup_quick( const char *host, const char *key, int port, int family, struct addrinfo **res )
+{
+	struct addrinfo hints, *gai;
+	struct dns_entry *e;
+	
+	memset( &hints, 0, sizeof( hints ) );
+	hints.ai_family = family;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_NUMERICHOST;
+	
+	if( getaddrinfo( host, NULL, &hints, &gai ) == 0 )
+	{
+		*res = dns_copy( gai, port );
+		freeaddrinfo( gai );
+		return TRUE;
+	}
+	
+	if( dns_cache && ( e = g_hash_table_lookup( dns_cache, key ) ) )
+	{
+		if( e->expires >= time( NULL ) )
+		{
+			*res = dns_copy( e->res, port );
+			return TRUE;
+		}
+		g_hash_table_remove( dns_cache, key );
+	}
+	
+	return FALSE;
+}
+
+static int dns_getaddrinfo( const char *host, int family, struct addrinfo **gai )
+{
+	struct addrinfo hints;
+	
+	memset( &hints, 0, sizeof( hints ) );
+	hints.ai_family = family;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_ADDRCONFIG;
+	
+	return getaddrinfo( host, NULL, &hints, gai );
+}
+
+int dns_lookup_sync( const char *host, int port, int family, struct addrinfo **res )
+{
+	struct addrinfo *gai;
+	char *key = dns_key( host, family );
+	int st;
+	
+	*res = NULL;
+	if( dns_lookup_quick( host, key, port, family, res ) )
+	{
+		g_free( key );
+		return *res ? 0 : EAI_NONAME;
+	}
+	
+	if( ( st = dns_getaddrinfo( host, family, &gai ) ) == 0 )
+	{
+		dns_cache_add( key, gai );
+		*res = dns_copy( gai, port );
+		freeaddrinfo( gai );
+		
+		if( *res == NULL )
+			st = EAI_NONAME;
+	}
+	
+	g_free( key );
+	return st;
+}
+
+#ifndef _WIN32
+static void *dns_thread( void *data )
+{
+	pthread_mutex_lock( &dns_lock );
+	while( 1 )
+	{
+		struct dns_query *q;
+		
+		while( dns_todo == NULL )
+		{
+			dns_idle ++;
+			pthread_cond_wait( &dns_wake, &dns_lock );
+			dns_idle --;
+		}
+		q = dns_todo;
+		dns_todo = q->next;
+		pthread_mutex_unlock( &dns_lock );
+		
+		q->error = dns_getaddrinfo( q->host, q->family, &q->gai );
+		
+		pthread_mutex_lock( &dns_lock );
+		q->next = dns_done;
+		dns_done = q;
+		
+		if( write( dns_pipe[1], "", 1 ) != 1 )
+		{
+			/* Pipe's full, so there's a wakeup pending already. */
+		}
+	}
+	
+	return NULL;
+}
+
+static void dns_finish( struct dns_query *q )
+{
+	GSList *l;
+	
+	g_hash_table_remove( dns_busy, q->key );
+	if( q->error == 0 )
+		dns_cache_add( q->key, q->gai );
+	
+	for( l = q->waiters; l; l = l->next )
+	{
+		struct dns_waiter *w = l->data;
+		
+		if( w->func )
+		{
+			struct addrinfo *res = q->error ? NULL : dns_copy( q->gai, w->port );
+			
+			g_hash_table_remove( dns_waiters, &w->id );
+			w->func( w->data, res, res ? 0 : q->error ? q->error : EAI_NONAME );
+		}
+		g_free( w );
+	}
+	
+	if( q->gai )
+		freeaddrinfo( q->gai );
+	g_slist_free( q->waiters );
+	g_free( q->key );
+	g_free( q->host );
+	g_free( q );
+}
+
+static gboolean dns_pipe_read( gpointer data, gint fd, b_input_condition cond )
+{
+	struct dns_query *done, *q;
+	char buf[64];
+	
+	while( read( fd, buf, sizeof( buf ) ) > 0 );
+	
+	pthread_mutex_lock( &dns_lock );
+	done = dns_done;
+	dns_done = NULL;
+	pthread_mutex_unlock( &dns_lock );
+	
+	while( ( q = done ) )
+	{
+		done = q->next;
+		dns_finish( q );
+	}
+	
+	return TRUE;
+}
+
+/* Set things up on first use, and again after a fork(): the resolver
+   threads stay behind in the parent process. */
+static void dns_init()
+{
+	if( dns_pid == getpid() )
+		return;
+	
+	if( dns_pipe[0] >= 0 )
+	{
+		b_event_remove( dns_pipe_inpa );
+		close( dns_pipe[0] );
+		close( dns_pipe[1] );
+		dns_pipe[0] = dns_pipe[1] = -1;
+		
+		/* Lookups still in progress are the parent's problem. */
+		g_hash_table_remove_all( dns_busy );
+		g_hash_table_remove_all( dns_waiters );
+		pthread_mutex_init( &dns_lock, NULL );
+		pthread_cond_init( &dns_wake, NULL );
+		dns_todo = dns_done = NULL;
+		dns_threads = dns_idle = 0;
+	}
+	else
+	{
+		dns_busy = g_hash_table_new( g_str_hash, g_str_equal );
+		dns_waiters = g_hash_table_new( g_int_hash, g_int_equal );
+	}
+	
+	if( pipe( dns_pipe ) == -1 )
+	{
+		log_message( LOGLVL_ERROR, "Could not create pipe for DNS resolver: %s", strerror( errno ) );
+		dns_pipe[0] = dns_pipe[1] = -1;
+		return;
+	}
+	sock_make_nonblocking( dns_pipe[0] );
+	sock_make_nonblocking( dns_pipe[1] );
+	dns_pipe_inpa = b_input_add( dns_pipe[0], B_EV_IO_READ, dns_pipe_read, NULL );
+	
+	dns_pid = getpid();
+}
+
+static gboolean dns_queue( struct dns_query *q )
+{
+	gboolean ok = TRUE;
+	
+	pthread_mutex_lock( &dns_lock );
+	q->next = dns_todo;
+	dns_todo = q;
+	
+	if( dns_idle > 0 )
+	{
+		pthread_cond_signal( &dns_wake );
+	}
+	else if( dns_threads < DNS_MAX_THREADS )
+	{
+		pthread_t thread;
+		pthread_attr_t attr;
+		
+		pthread_attr_init( &attr );
+		pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_DETACHED );
+		if( pthread_create( &thread, &attr, dns_thread, NULL ) == 0 )
+			dns_threads ++;
+		else if( dns_threads == 0 )
+		{
+			/* Nobody to pick it up. */
+			dns_todo = q->next;
+			ok = FALSE;
+		}
+		pthread_attr_destroy( &attr );
+	}
+	pthread_mutex_unlock( &dns_lock );
+	
+	return ok;
+}
+
+gint dns_lookup( const char *host, int port, int family, dns_callback func, gpointer data )
+{
+	struct addrinfo *res = NULL;
+	struct dns_query *q;
+	struct dns_waiter *w;
+	char *key = dns_key( host, family );
+	int st;
+	
+	if( dns_lookup_quick( host, key, port, family, &res ) )
+	{
+		g_free( key );
+		func( data, res, res ? 0 : EAI_NONAME );
+		return 0;
+	}
+	
+	dns_init();
+	
+	if( ( q = g_hash_table_lookup( dns_busy, key ) ) )
+	{
+		/* Someone else is waiting for the same name already. */
+		g_free( key );
+	}
+	else
+	{
+		q = g_new0( struct dns_query, 1 );
+		q->key = key;
+		q->host = g_strdup( host );
+		q->family = family;
+		
+		if( dns_pipe[0] == -1 || !dns_queue( q ) )
+		{
+			/* No threads for us, so do it the old way. */
+			g_free( q->host );
+			g_free( q->key );
+			g_free( q );
+			
+			st = dns_lookup_sync( host, port, family, &res );
+			func( data, res, st );
+			return 0;
+		}
+		g_hash_table_insert( dns_busy, q->key, q );
+	}
+	
+	w = g_new0( struct dns_waiter, 1 );
+	dns_next_id = dns_next_id < G_MAXINT ? dns_next_id + 1 : 1;
+	w->id = dns_next_id;
+	w->port = port;
+	w->func = func;
+	w->data = data;
+	q->waiters = g_slist_append( q->waiters, w );
+	g_hash_table_insert( dns_waiters, &w->id, w );
+	
+	return w->id;
+}
+
+void dns_cancel( gint id )
+{
+	struct dns_waiter *w;
+	
+	if( id <= 0 || dns_waiters == NULL ||
+	    ( w = g_hash_table_lookup( dns_waiters, &id ) ) == NULL )
+		return;
+	
+	/* The query itself keeps going (maybe someone else wants to know
+	   too, and it'll be in the cache), we just won't call back. */
+	g_hash_table_remove( dns_waiters, &id );
+	w->func = NULL;
+}
+#else
+gint dns_lookup( const char *host, int port, int family, dns_callback func, gpointer data )
+{
+	struct addrinfo *res;
+	int st = dns_lookup_sync( host, port, family, &res );
+	
+	func( data, res, st );
+	return 0;
+}
+
+void dns_cancel( gint id )
+{
+}
+#endif
@@ -0,0 +1,63 @@
+/***************************************************************************\
+*                                                                           *
+*  BitlBee - An IRC to IM gateway                                           *
+*  Asynchronous name resolution with a small cache                           *
+*                                                                           *
+*  Copyright 2002-2012 Wilmer van der Gaast and others                      *
+*                                                                           *
+*  This program is free software; you can redistribute it and/or modify     *
+*  it under the terms of the GNU General Public License as published by     *
+*  the Free Software Foundation; either version 2 of the License, or        *
+*  (at your option) any later version.                                      *
+*                                                                           *
+*  This program is distributed in the hope that it will be useful,          *
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+*  GNU General Public License for more details.                             *
+*                                                                           *
+*  You should have received a copy of the GNU General Public License along  *
+*  with this program; if not, write to the Free Software Foundation, Inc.,  *
+*  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.              *
+*                                                                           *
+\***************************************************************************/
+
+#ifndef _DNS_H
+#define _DNS_H
+
+#include <glib.h>
+#include <gmodule.h>
+#include <sys/types.h>
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <netdb.h>
+#endif
+
+/* getaddrinfo() doesn't tell us the TTLs of the records it found, so just
+   keep results for a few minutes. Good enough to not look up the same
+   server again for every account reconnecting after a network hiccup. */
+#define DNS_CACHE_TIME 300
+#define DNS_CACHE_MAX 256
+
+/* Max. number of lookups running at the same time. */
+#define DNS_MAX_THREADS 4
+
+/* res is a list of addresses with the port number already filled in. It
+   belongs to the callee, free it with dns_free(). On failure res is NULL
+   and error is a getaddrinfo() error code (see gai_strerror()). */
+typedef void (*dns_callback)( gpointer data, struct addrinfo *res, int error );
+
+/* Look up the addresses of host for a stream socket. family can be
+   AF_UNSPEC, AF_INET or AF_INET6. Numeric addresses and names that are
+   in the cache are handled immediately: func is called before this
+   function returns, and the return value is 0. Otherwise the lookup is
+   done in a separate thread, func is called from the event loop when it's
+   done, and the return value is an ID that can be passed to dns_cancel(). */
+G_MODULE_EXPORT gint dns_lookup( const char *host, int port, int family, dns_callback func, gpointer data );
+G_MODULE_EXPORT void dns_cancel( gint id );
+
+/* Blocking version for code that can't wait (the cache is still used). */
+G_MODULE_EXPORT int dns_lookup_sync( const char *host, int port, int family, struct addrinfo **res );
+
+G_MODULE_EXPORT void dns_free( struct addrinfo *res );
+
+#endif
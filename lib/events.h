@@ -29,7 +29,9 @@
    This file offers some extra event handling toys, which will be handled
    by GLib or libevent. The advantage of using libevent is that it can use
    more advanced I/O polling functions like epoll() in recent Linux
-   kernels. This should improve BitlBee's scalability. */
+   kernels. This should improve BitlBee's scalability. On Linux there's
+   also a native epoll() backend (events_epoll.c) with O(1) administration
+   for both fds and timeouts. */
 
 
 #ifndef _EVENTS_H_
@@ -71,6 +73,12 @@ G_MODULE_EXPORT void b_main_init();
 G_MODULE_EXPORT void b_main_run();
 G_MODULE_EXPORT void b_main_quit();
 
+/* The function set here gets called every time the event loop is done
+   handling a batch of events, right before it goes back to sleep. Used
+   to write out all IRC output generated in one loop iteration at once. */
+typedef void (*b_flush_handler)(void);
+G_MODULE_EXPORT void b_main_set_flush(b_flush_handler func);
+
 
 /* Add event handlers (for I/O or a timeout). The event handler will be called
    every time the event "happens", until your event handler returns FALSE (or
@@ -80,8 +88,8 @@ G_MODULE_EXPORT gint b_input_add(int fd, b_input_condition cond, b_event_handler
 G_MODULE_EXPORT gint b_timeout_add(gint timeout, b_event_handler func, gpointer data);
 G_MODULE_EXPORT void b_event_remove(gint id);
 
-/* With libevent, this one also cleans up event handlers if that wasn't already
-   done (the caller is expected to do so but may miss it sometimes). */
+/* With libevent/epoll, this one also cleans up event handlers if that wasn't
+   already done (the caller is expected to do so but may miss it sometimes). */
 G_MODULE_EXPORT void closesocket(int fd);
 
 #endif /* _EVENTS_H_ */
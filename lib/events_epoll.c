@@ -0,0 +1,497 @@
+  /********************************************************************\
+  * BitlBee -- An IRC to other IM-networks gateway                     *
+  *                                                                    *
+  * Copyright 2002-2012 Wilmer van der Gaast and others                *
+  \********************************************************************/
+
+/*
+ * Event handling (using epoll directly, Linux only)
+ */
+
+/*
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License with
+  the Debian GNU/Linux distribution in /usr/share/common-licenses/GPL;
+  if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+  Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* GLib rebuilds its poll array on every iteration and every timeout is a
+   GSource of its own, which gets expensive with thousands of fds and
+   timers in one process. This backend talks to epoll directly, keeps all
+   event handlers in a table indexed by their ID and runs timeouts off a
+   timer wheel (see timerwheel.c), so adding/removing anything is O(1). */
+
+#define BITLBEE_CORE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/epoll.h>
+#include "proxy.h"
+#include "timerwheel.h"
+
+/* IDs are a slot number in the event table plus a generation counter in
+   the upper bits, so stale IDs (which BitlBee sometimes passes to
+   b_event_remove()) never hit a recycled slot. */
+#define EV_SLOT_BITS 20
+#define EV_SLOT_MASK ( ( 1 << EV_SLOT_BITS ) - 1 )
+#define EV_GEN_MASK  ( ( 1 << ( 31 - EV_SLOT_BITS ) ) - 1 )
+
+#define MAX_EVENTS 128    /* per epoll_wait() */
+
+struct b_event_data
+{
+	struct tw_timer timer; /* Timeouts only, must be the first member. */
+	gint id;
+	gint fd;             /* -1 for timeouts. */
+	b_input_condition flags;
+	b_event_handler function;
+	gpointer data;
+	gint timeout;
+};
+
+/* Per-fd administration: the read and write handler (may be the same
+   one) and the event mask currently registered with the kernel. */
+struct b_fd_data
+{
+	struct b_event_data *r, *w;
+	guint32 mask;
+};
+
+static int epfd = -1;
+static int quitting = 0;
+static int restarted = 0; /* Set when b_main_init() is called while dispatching. */
+
+static struct b_event_data **ev_table = NULL;
+static guint ev_table_size = 0;
+static guint ev_free_head = 0; /* Free slots form a list through ev_free_next. */
+static guint *ev_gen = NULL;
+static guint *ev_free_next = NULL;
+
+static struct b_fd_data *fd_table = NULL;
+static gint fd_table_size = 0;
+
+static struct tw_wheel wheel;
+
+static gint id_cur = 0;
+static gboolean id_dead;
+static b_flush_handler flush_func = NULL;
+
+void b_main_init()
+{
+	int fd;
+
+	if( epfd >= 0 )
+	{
+		/* Second call, most likely from a ForkDaemon child. Never share
+		   the epoll instance with our parent, but do keep all event
+		   handlers (like GLib does). */
+		close( epfd );
+		restarted = 1;
+	}
+	else
+	{
+		tw_init( &wheel );
+	}
+
+	epfd = epoll_create( 1024 );
+	if( epfd < 0 )
+	{
+		perror( "epoll_create" );
+		exit( 1 );
+	}
+	fcntl( epfd, F_SETFD, FD_CLOEXEC );
+
+	for( fd = 0; fd < fd_table_size; fd ++ )
+		if( fd_table[fd].mask )
+		{
+			struct epoll_event ev;
+
+			memset( &ev, 0, sizeof( ev ) );
+			ev.events = fd_table[fd].mask;
+			ev.data.fd = fd;
+			if( epoll_ctl( epfd, EPOLL_CTL_ADD, fd, &ev ) != 0 )
+				fd_table[fd].mask = 0;
+		}
+}
+
+static struct b_event_data *b_event_new()
+{
+	struct b_event_data *b_ev = g_new0( struct b_event_data, 1 );
+	guint slot;
+
+	if( ev_free_head == 0 )
+	{
+		guint i, n = ev_table_size ? ev_table_size * 2 : 256;
+
+		if( n > EV_SLOT_MASK )
+		{
+			/* A million events in one process? */
+			g_error( "Event table full" );
+		}
+
+		ev_table = g_renew( struct b_event_data *, ev_table, n );
+		ev_gen = g_renew( guint, ev_gen, n );
+		ev_free_next = g_renew( guint, ev_free_next, n );
+
+		/* Slot 0 is never used so that no ID is ever 0. */
+		for( i = ev_table_size ? ev_table_size : 1; i < n; i ++ )
+		{
+			ev_table[i] = NULL;
+			ev_gen[i] = 0;
+			ev_free_next[i] = ev_free_head;
+			ev_free_head = i;
+		}
+		ev_table_size = n;
+	}
+
+	slot = ev_free_head;
+	ev_free_head = ev_free_next[slot];
+
+	ev_gen[slot] = ( ev_gen[slot] + 1 ) & EV_GEN_MASK;
+	b_ev->id = ( ev_gen[slot] << EV_SLOT_BITS ) | slot;
+	ev_table[slot] = b_ev;
+
+	return b_ev;
+}
+
+static struct b_event_data *b_event_find( gint id )
+{
+	guint slot = id & EV_SLOT_MASK;
+
+	if( id <= 0 || slot >= ev_table_size || ev_table[slot] == NULL ||
+	    ev_table[slot]->id != id )
+		return NULL;
+
+	return ev_table[slot];
+}
+
+static struct b_fd_data *b_fd_get( gint fd )
+{
+	if( fd >= fd_table_size )
+	{
+		gint n = MAX( fd + 1, fd_table_size * 2 );
+
+		fd_table = g_renew( struct b_fd_data, fd_table, n );
+		memset( fd_table + fd_table_size, 0, sizeof( struct b_fd_data ) * ( n - fd_table_size ) );
+		fd_table_size = n;
+	}
+
+	return &fd_table[fd];
+}
+
+/* Tell the kernel about the current read/write interest in fd, if that
+   changed. Only does a syscall when necessary. */
+static void b_fd_update( gint fd )
+{
+	struct b_fd_data *bfd = b_fd_get( fd );
+	struct epoll_event ev;
+	guint32 mask = 0;
+	int op;
+
+	if( bfd->r )
+		mask |= EPOLLIN;
+	if( bfd->w )
+		mask |= EPOLLOUT;
+
+	if( mask == bfd->mask )
+		return;
+
+	memset( &ev, 0, sizeof( ev ) );
+	ev.events = mask;
+	ev.data.fd = fd;
+
+	if( mask == 0 )
+		op = EPOLL_CTL_DEL;
+	else if( bfd->mask == 0 )
+		op = EPOLL_CTL_ADD;
+	else
+		op = EPOLL_CTL_MOD;
+
+	if( epoll_ctl( epfd, op, fd, &ev ) != 0 )
+	{
+		/* The fd may have been closed (and reused) behind our back,
+		   in which case the kernel already forgot about it. */
+		if( op == EPOLL_CTL_MOD && errno == ENOENT )
+			epoll_ctl( epfd, EPOLL_CTL_ADD, fd, &ev );
+		else if( op != EPOLL_CTL_DEL )
+			event_debug( "epoll_ctl( %d, %d ) failed: %s\n", op, fd, strerror( errno ) );
+	}
+
+	bfd->mask = mask;
+}
+
+/* Takes one direction away from whatever handler is watching it. A
+   handler that was watching both directions keeps the other one, it's
+   only removed once it has nothing left to watch. */
+static void b_fd_release( struct b_fd_data *bfd, b_input_condition cond )
+{
+	struct b_event_data *b_ev = cond == B_EV_IO_READ ? bfd->r : bfd->w;
+
+	if( b_ev == NULL )
+		return;
+
+	if( cond == B_EV_IO_READ )
+		bfd->r = NULL;
+	else
+		bfd->w = NULL;
+
+	b_ev->flags &= ~cond;
+	if( !( b_ev->flags & ( B_EV_IO_READ | B_EV_IO_WRITE ) ) )
+		b_event_remove( b_ev->id );
+}
+
+gint b_input_add( gint fd, b_input_condition condition, b_event_handler function, gpointer data )
+{
+	struct b_event_data *b_ev;
+	struct b_fd_data *bfd = b_fd_get( fd );
+
+	/* Like with libevent, only one handler per fd-condition combination.
+	   A new one replaces the old one for that condition only. */
+	if( condition & B_EV_IO_READ )
+		b_fd_release( bfd, B_EV_IO_READ );
+	if( condition & B_EV_IO_WRITE )
+		b_fd_release( bfd, B_EV_IO_WRITE );
+
+	b_ev = b_event_new();
+	b_ev->fd = fd;
+	b_ev->flags = condition;
+	b_ev->function = function;
+	b_ev->data = data;
+
+	if( condition & B_EV_IO_READ )
+		bfd->r = b_ev;
+	if( condition & B_EV_IO_WRITE )
+		bfd->w = b_ev;
+
+	b_fd_update( fd );
+
+	event_debug( "b_input_add( %d, %d, 0x%x, 0x%x ) = %d\n", fd, condition, function, data, b_ev->id );
+
+	return b_ev->id;
+}
+
+gint b_timeout_add( gint timeout, b_event_handler function, gpointer data )
+{
+	struct b_event_data *b_ev = b_event_new();
+
+	b_ev->fd = -1;
+	b_ev->timeout = timeout;
+	b_ev->function = function;
+	b_ev->data = data;
+
+	tw_add( &wheel, &b_ev->timer, timeout );
+
+	event_debug( "b_timeout_add( %d, 0x%x, 0x%x ) = %d\n", timeout, function, data, b_ev->id );
+
+	return b_ev->id;
+}
+
+void b_event_remove( gint id )
+{
+	struct b_event_data *b_ev = b_event_find( id );
+	guint slot;
+
+	event_debug( "b_event_remove( %d )\n", id );
+
+	if( b_ev == NULL )
+	{
+		event_debug( "Already removed?\n" );
+		return;
+	}
+
+	if( id == id_cur )
+		id_dead = TRUE;
+
+	if( b_ev->fd >= 0 )
+	{
+		struct b_fd_data *bfd = b_fd_get( b_ev->fd );
+
+		if( bfd->r == b_ev )
+			bfd->r = NULL;
+		if( bfd->w == b_ev )
+			bfd->w = NULL;
+		b_fd_update( b_ev->fd );
+	}
+	else
+	{
+		tw_del( &wheel, &b_ev->timer );
+	}
+
+	slot = id & EV_SLOT_MASK;
+	ev_table[slot] = NULL;
+	ev_free_next[slot] = ev_free_head;
+	ev_free_head = slot;
+
+	g_free( b_ev );
+}
+
+/* Returns FALSE if the event handler got removed (by itself or because it
+   returned FALSE). */
+static gboolean b_event_call( struct b_event_data *b_ev, gint fd, b_input_condition cond )
+{
+	gboolean st;
+
+	id_cur = b_ev->id;
+	id_dead = FALSE;
+
+	st = b_ev->function( b_ev->data, fd, cond );
+
+	if( id_dead )
+	{
+		/* This event was killed already, don't touch it! */
+		id_cur = 0;
+		return FALSE;
+	}
+	id_cur = 0;
+
+	if( b_ev->flags & B_EV_FLAG_FORCE_ONCE ||
+	    ( !st && !( b_ev->flags & B_EV_FLAG_FORCE_REPEAT ) ) )
+	{
+		event_debug( "Handler returned FALSE: " );
+		b_event_remove( b_ev->id );
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void b_timers_run()
+{
+	struct tw_timer *due = NULL, *t;
+
+	tw_advance( &wheel, &due );
+
+	/* Handlers may add and remove timeouts (including ones that are on
+	   the due list still), that's all safe. */
+	while( ( t = due ) && !quitting )
+	{
+		struct b_event_data *b_ev = (struct b_event_data *) t;
+
+		tw_list_del( t );
+		if( b_event_call( b_ev, -1, 0 ) )
+			tw_add( &wheel, &b_ev->timer, b_ev->timeout );
+	}
+
+	/* Only when quitting. Put them back so b_event_remove() still
+	   works for them. */
+	while( ( t = due ) )
+	{
+		tw_list_del( t );
+		tw_add( &wheel, t, ( (struct b_event_data *) t )->timeout );
+	}
+}
+
+static void b_fds_run( struct epoll_event *evs, int n )
+{
+	int i;
+
+	for( i = 0; i < n && !quitting && !restarted; i ++ )
+	{
+		gint fd = evs[i].data.fd;
+		guint32 ev = evs[i].events;
+		struct b_fd_data *bfd;
+		gint r_id = 0;
+
+		if( fd >= fd_table_size )
+			continue;
+		bfd = &fd_table[fd];
+
+		if( bfd->r && ev & ( EPOLLIN | EPOLLHUP | EPOLLERR ) )
+		{
+			b_input_condition cond = B_EV_IO_READ;
+
+			/* A handler for both directions gets called just once. */
+			if( bfd->r == bfd->w && ev & ( EPOLLOUT | EPOLLHUP | EPOLLERR ) )
+				cond |= B_EV_IO_WRITE;
+
+			r_id = bfd->r->id;
+			b_event_call( bfd->r, fd, cond );
+			if( cond & B_EV_IO_WRITE )
+				continue;
+		}
+
+		/* Look up again, the read handler may have changed things. */
+		bfd = &fd_table[fd];
+		if( bfd->w && bfd->w->id != r_id && ev & ( EPOLLOUT | EPOLLHUP | EPOLLERR ) )
+			b_event_call( bfd->w, fd, B_EV_IO_WRITE );
+	}
+}
+
+void b_main_run()
+{
+	struct epoll_event evs[MAX_EVENTS];
+
+	quitting = 0;
+	while( !quitting )
+	{
+		int n;
+
+		n = epoll_wait( epfd, evs, MAX_EVENTS, tw_next_timeout( &wheel ) );
+		if( n < 0 && errno != EINTR )
+		{
+			perror( "epoll_wait" );
+			break;
+		}
+
+		restarted = 0;
+		if( n > 0 )
+			b_fds_run( evs, n );
+
+		b_timers_run();
+		
+		if( flush_func )
+			flush_func();
+	}
+}
+
+void b_main_quit()
+{
+	quitting = 1;
+}
+
+void b_main_set_flush( b_flush_handler func )
+{
+	flush_func = func;
+}
+
+void closesocket( int fd )
+{
+	struct b_fd_data *bfd;
+
+	proxy_cancel( fd );
+
+	/* Just like with libevent, remove any handlers that are still
+	   around before closing, otherwise our administration and the
+	   kernel's go out of sync. */
+	if( fd >= 0 && fd < fd_table_size )
+	{
+		bfd = &fd_table[fd];
+		if( bfd->r )
+		{
+			event_debug( "Warning: fd %d still had a read event handler when shutting down.\n", fd );
+			b_event_remove( bfd->r->id );
+		}
+		if( bfd->w )
+		{
+			event_debug( "Warning: fd %d still had a write event handler when shutting down.\n", fd );
+			b_event_remove( bfd->w->id );
+		}
+	}
+
+	close( fd );
+}
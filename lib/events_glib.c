@@ -44,6 +44,7 @@
 #include <fcntl.h>
 #include <errno.h>
 #include "proxy.h"
+#include "timerwheel.h"
 
 typedef struct _GaimIOClosure {
 	b_event_handler function;
@@ -51,12 +52,38 @@ typedef struct _GaimIOClosure {
 	guint flags;
 } GaimIOClosure;
 
+/* Timeouts don't get a GSource each, they all live on a timer wheel that
+   is driven by a single GLib timeout. IDs handed out for them have this
+   bit set so they don't collide with GLib's source IDs. */
+#define B_TIMEOUT_ID_BIT 0x40000000
+
+struct b_timeout {
+	struct tw_timer timer; /* Must be the first member. */
+	gint id;
+	gint timeout;
+	b_event_handler function;
+	gpointer data;
+};
+
 static GMainLoop *loop = NULL;
 
+static struct tw_wheel wheel;
+static GHashTable *timeouts; /* id -> struct b_timeout */
+static gint timeout_id_next = 0;
+static gint timeout_cur = 0; /* Timeout that we're currently handling. */
+static gboolean timeout_dead; /* Set if b_event_remove() removes timeout_cur. */
+static guint wheel_source = 0;
+static guint64 wheel_source_due = 0;
+static b_flush_handler flush_func = NULL;
+
 void b_main_init()
 {
 	if( loop == NULL )
+	{
 		loop = g_main_new( FALSE );
+		tw_init( &wheel );
+		timeouts = g_hash_table_new( g_int_hash, g_int_equal );
+	}
 }
 
 void b_main_run()
@@ -69,6 +96,45 @@ void b_main_quit()
 	g_main_quit( loop );
 }
 
+/* GLib has no hook for "done dispatching", but every source gets asked
+   to prepare right before the main loop goes back to polling. */
+static gboolean b_flush_prepare( GSource *source, gint *timeout )
+{
+	*timeout = -1;
+	if( flush_func )
+		flush_func();
+	return FALSE;
+}
+
+static gboolean b_flush_check( GSource *source )
+{
+	return FALSE;
+}
+
+static gboolean b_flush_dispatch( GSource *source, GSourceFunc callback, gpointer data )
+{
+	return TRUE;
+}
+
+static GSourceFuncs b_flush_funcs = {
+	b_flush_prepare,
+	b_flush_check,
+	b_flush_dispatch,
+	NULL
+};
+
+void b_main_set_flush( b_flush_handler func )
+{
+	static GSource *source = NULL;
+	
+	flush_func = func;
+	if( source == NULL )
+	{
+		source = g_source_new( &b_flush_funcs, sizeof( GSource ) );
+		g_source_attach( source, NULL );
+	}
+}
+
 static gboolean gaim_io_invoke(GIOChannel *source, GIOCondition condition, gpointer data)
 {
 	GaimIOClosure *closure = data;
@@ -130,27 +196,107 @@ gint b_input_add(gint source, b_input_condition condition, b_event_handler funct
 	return st;
 }
 
+static gboolean b_wheel_run( gpointer data );
+
+/* Make sure the GLib timeout driving the wheel goes off in time for the
+   first timer that's due. */
+static void b_wheel_arm()
+{
+	gint next = tw_next_timeout( &wheel );
+	guint64 due;
+	
+	if( next < 0 )
+		return;
+	
+	due = tw_now_ms() + next;
+	if( wheel_source > 0 && wheel_source_due <= due )
+		return;
+	
+	if( wheel_source > 0 )
+		g_source_remove( wheel_source );
+	wheel_source = g_timeout_add( next, b_wheel_run, NULL );
+	wheel_source_due = due;
+}
+
+static void b_timeout_free( struct b_timeout *to )
+{
+	tw_del( &wheel, &to->timer );
+	g_hash_table_remove( timeouts, &to->id );
+	g_free( to );
+}
+
+static gboolean b_wheel_run( gpointer data )
+{
+	struct tw_timer *due = NULL, *t;
+	
+	wheel_source = 0;
+	tw_advance( &wheel, &due );
+	
+	while( ( t = due ) )
+	{
+		struct b_timeout *to = (struct b_timeout *) t;
+		gboolean st;
+		
+		tw_list_del( t );
+		
+		timeout_cur = to->id;
+		timeout_dead = FALSE;
+		st = to->function( to->data, -1, 0 );
+		if( timeout_dead )
+			continue; /* Removed already, don't touch it! */
+		
+		if( st )
+			tw_add( &wheel, t, to->timeout );
+		else
+			b_timeout_free( to );
+	}
+	timeout_cur = 0;
+	
+	b_wheel_arm();
+	
+	return FALSE;
+}
+
 gint b_timeout_add(gint timeout, b_event_handler func, gpointer data)
 {
-	/* GSourceFunc and the BitlBee event handler function aren't
-	   really the same, but they're "compatible". ;-) It will do
-	   for now, BitlBee only looks at the "data" argument. */
-	gint st = g_timeout_add(timeout, (GSourceFunc) func, data);
+	struct b_timeout *to = g_new0( struct b_timeout, 1 );
 	
-	event_debug( "b_timeout_add( %d, %d, %d ) = %d\n", timeout, func, data, st );
+	timeout_id_next = ( timeout_id_next + 1 ) & ( B_TIMEOUT_ID_BIT - 1 );
+	to->id = B_TIMEOUT_ID_BIT | timeout_id_next;
+	to->timeout = timeout;
+	to->function = func;
+	to->data = data;
 	
-	return st;
+	g_hash_table_insert( timeouts, &to->id, to );
+	tw_add( &wheel, &to->timer, timeout );
+	b_wheel_arm();
+	
+	event_debug( "b_timeout_add( %d, %d, %d ) = %d\n", timeout, func, data, to->id );
+	
+	return to->id;
 }
 
 void b_event_remove(gint tag)
 {
 	event_debug( "b_event_remove( %d )\n", tag );
 	
-	if (tag > 0)
+	if (tag & B_TIMEOUT_ID_BIT)
+	{
+		struct b_timeout *to = g_hash_table_lookup( timeouts, &tag );
+		
+		if( to == NULL )
+			return;
+		if( tag == timeout_cur )
+			timeout_dead = TRUE;
+		b_timeout_free( to );
+	}
+	else if (tag > 0)
 		g_source_remove(tag);
 }
 
 void closesocket( int fd )
 {
+	proxy_cancel( fd );
+
 	close( fd );
 }
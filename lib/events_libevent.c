@@ -41,6 +41,7 @@ static guint id_cur = 0; /* Event ID that we're currently handling. */
 static guint id_dead; /* Set to 1 if b_event_remove removes id_cur. */
 static GHashTable *id_hash;
 static int quitting = 0; /* Prepare to quit, stop handling events. */
+static b_flush_handler flush_func = NULL;
 
 /* Since libevent doesn't handle two event handlers for one fd-condition
    very well (which happens sometimes when BitlBee changes event handlers
@@ -82,21 +83,30 @@ void b_main_init()
 void b_main_run()
 {
 	/* This while loop is necessary to exit the event loop and start a
-	   different one (necessary for ForkDaemon mode). */
-	while( event_base_dispatch( leh ) == 0 && !quitting )
+	   different one (necessary for ForkDaemon mode). It also runs just
+	   one iteration at a time, so we get to call the flush handler. */
+	while( event_base_loop( leh, EVLOOP_ONCE ) == 0 && !quitting )
 	{
+		if( flush_func )
+			flush_func();
+		
 		if( old_leh != NULL )
 		{
 			/* For some reason this just isn't allowed...
 			   Possibly a bug in older versions, will see later.
 			event_base_free( old_leh ); */
 			old_leh = NULL;
+			
+			event_debug( "New event loop.\n" );
 		}
-		
-		event_debug( "New event loop.\n" );
 	}
 }
 
+void b_main_set_flush( b_flush_handler func )
+{
+	flush_func = func;
+}
+
 static void b_main_restart()
 {
 	struct timeval tv;
@@ -272,6 +282,8 @@ void b_event_remove( gint id )
 void closesocket( int fd )
 {
 	struct b_event_data *b_ev;
+
+	proxy_cancel( fd );
 	
 	/* Since epoll() (the main reason we use libevent) automatically removes sockets from
 	   the epoll() list when a socket gets closed and some modules have a habit of
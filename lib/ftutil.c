@@ -38,7 +38,7 @@
 int ft_listen( struct sockaddr_storage *saddr_ptr, char *host, char *port, int copy_fd, int for_bitlbee_client, char **errptr )
 {
 	int fd, gret, saddrlen;
-	struct addrinfo hints, *rp;
+	struct addrinfo *rp;
 	socklen_t ssize = sizeof( struct sockaddr_storage );
 	struct sockaddr_storage saddrs, *saddr = &saddrs;
 	static char errmsg[1024];
@@ -96,11 +96,7 @@ int ft_listen( struct sockaddr_storage *saddr_ptr, char *host, char *port, int c
 		ASSERTSOCKOP( gethostname( host, HOST_NAME_MAX + 1 ), "gethostname()" );
 	}
 
-	memset( &hints, 0, sizeof( struct addrinfo ) );
-	hints.ai_socktype = SOCK_STREAM;
-	hints.ai_flags = AI_NUMERICSERV;
-
-	if ( ( gret = getaddrinfo( host, port, &hints, &rp ) ) != 0 )
+	if ( ( gret = dns_lookup_sync( host, atoi( port ), AF_UNSPEC, &rp ) ) != 0 )
 	{
 		sprintf( errmsg, "getaddrinfo() failed: %s", gai_strerror( gret ) );
 		return -1;
@@ -110,7 +106,7 @@ int ft_listen( struct sockaddr_storage *saddr_ptr, char *host, char *port, int c
 
 	memcpy( saddr, rp->ai_addr, saddrlen );
 
-	freeaddrinfo( rp );
+	dns_free( rp );
 
 	ASSERTSOCKOP( fd = socket( saddr->ss_family, SOCK_STREAM, 0 ), "Opening socket" );
 	ASSERTSOCKOP( bind( fd, ( struct sockaddr *)saddr, saddrlen ), "Binding socket" );
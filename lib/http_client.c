@@ -29,6 +29,7 @@
 #include "http_client.h"
 #include "url.h"
 #include "sock.h"
+#include "iobuf.h"
 
 
 static gboolean http_connected( gpointer data, int source, b_input_condition cond );
@@ -43,6 +44,7 @@ struct http_request *http_dorequest( char *host, int port, int ssl, char *reques
 	int error = 0;
 	
 	req = g_new0( struct http_request, 1 );
+	req->rxq = iobuf_new();
 	
 	if( ssl )
 	{
@@ -197,7 +199,7 @@ static gboolean http_handle_headers( struct http_request *req );
 static gboolean http_incoming_data( gpointer data, int source, b_input_condition cond )
 {
 	struct http_request *req = data;
-	char buffer[4096];
+	char *buffer = NULL;
 	char *s;
 	size_t content_length;
 	int st;
@@ -205,42 +207,32 @@ static gboolean http_incoming_data( gpointer data, int source, b_input_condition
 	if( req->inpa > 0 )
 		b_event_remove( req->inpa );
 	
-	if( req->ssl )
+	st = iobuf_read( req->rxq, req->fd, req->ssl, 0 );
+	if( st < 0 )
 	{
-		st = ssl_read( req->ssl, buffer, sizeof( buffer ) );
-		if( st < 0 )
+		if( req->ssl && ssl_errno != SSL_AGAIN )
 		{
-			if( ssl_errno != SSL_AGAIN )
-			{
-				/* goto cleanup; */
-				
-				/* YAY! We have to deal with crappy Microsoft
-				   servers that LOVE to send invalid TLS
-				   packets that abort connections! \o/ */
-				
-				goto eof;
-			}
+			/* goto cleanup; */
+			
+			/* YAY! We have to deal with crappy Microsoft
+			   servers that LOVE to send invalid TLS
+			   packets that abort connections! \o/ */
+			
+			goto eof;
 		}
-		else if( st == 0 )
+		else if( !req->ssl && !sockerr_again() )
 		{
-			goto eof;
+			req->status_string = g_strdup( strerror( errno ) );
+			goto cleanup;
 		}
 	}
+	else if( st == 0 )
+	{
+		goto eof;
+	}
 	else
 	{
-		st = read( req->fd, buffer, sizeof( buffer ) );
-		if( st < 0 )
-		{
-			if( !sockerr_again() )
-			{
-				req->status_string = g_strdup( strerror( errno ) );
-				goto cleanup;
-			}
-		}
-		else if( st == 0 )
-		{
-			goto eof;
-		}
+		buffer = iobuf_pullup( req->rxq );
 	}
 	
 	if( st > 0 && !req->sbuf )
@@ -290,8 +282,7 @@ static gboolean http_incoming_data( gpointer data, int source, b_input_condition
 			req->func( req );
 	}
 	
-	if( ssl_pending( req->ssl ) )
-		return http_incoming_data( data, source, cond );
+	iobuf_clear( req->rxq );
 	
 	/* There will be more! */
 	req->inpa = b_input_add( req->fd,
@@ -560,6 +551,7 @@ static gboolean http_handle_headers( struct http_request *req )
 		req->request_length = strlen( new_request );
 		req->bytes_read = req->bytes_written = req->inpa = 0;
 		req->reply_headers = req->reply_body = NULL;
+		iobuf_clear( req->rxq );
 		
 		return FALSE;
 	}
@@ -606,5 +598,6 @@ static void http_free( struct http_request *req )
 	g_free( req->reply_headers );
 	g_free( req->status_string );
 	g_free( req->sbuf );
+	iobuf_free( req->rxq );
 	g_free( req );
 }
@@ -36,6 +36,7 @@
 #include "ssl_client.h"
 
 struct http_request;
+struct iobuf;
 
 typedef enum http_client_flags
 {
@@ -74,6 +75,7 @@ struct http_request
 	int fd;
 	
 	int inpa;
+	struct iobuf *rxq;
 	int bytes_written;
 	int bytes_read;
 	
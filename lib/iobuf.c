@@ -0,0 +1,328 @@
+/***************************************************************************\
+*                                                                           *
+*  BitlBee - An IRC to IM gateway                                           *
+*  Length-tracked chunked byte buffers for socket I/O                       *
+*                                                                           *
+*  Copyright 2002-2012 Wilmer van der Gaast and others                      *
+*                                                                           *
+*  This program is free software; you can redistribute it and/or modify     *
+*  it under the terms of the GNU General Public License as published by     *
+*  the Free Software Foundation; either version 2 of the License, or        *
+*  (at your option) any later version.                                      *
+*                                                                           *
+*  This program is distributed in the hope that it will be useful,          *
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+*  GNU General Public License for more details.                             *
+*                                                                           *
+*  You should have received a copy of the GNU General Public License along  *
+*  with this program; if not, write to the Free Software Foundation, Inc.,  *
+*  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.              *
+*                                                                           *
+\***************************************************************************/
+
+/* The old IRC send/receive buffers were plain NUL-terminated strings that
+   got strlen()ed, g_renew()ed and g_strdup()ed on every read, write and
+   partial write, which made big bursts of output quadratic. These buffers
+   keep track of their length and just move offsets around. */
+
+#define BITLBEE_CORE
+#include "bitlbee.h"
+#include "iobuf.h"
+#include "ssl_client.h"
+#ifndef _WIN32
+#include <sys/uio.h>
+#endif
+
+static struct iobuf_chunk *iobuf_chunk_add( iobuf_t *b, gsize min )
+{
+	struct iobuf_chunk *c;
+
+	if( min <= IOBUF_CHUNK_SIZE && b->spare )
+	{
+		c = b->spare;
+		b->spare = NULL;
+	}
+	else
+	{
+		gsize size = MAX( min, IOBUF_CHUNK_SIZE );
+
+		c = g_malloc( sizeof( struct iobuf_chunk ) + size );
+		c->size = size;
+	}
+
+	c->head = c->tail = 0;
+	c->next = NULL;
+
+	if( b->last )
+		b->last->next = c;
+	else
+		b->first = c;
+	b->last = c;
+
+	return c;
+}
+
+static void iobuf_chunk_release( iobuf_t *b, struct iobuf_chunk *c )
+{
+	if( c->size == IOBUF_CHUNK_SIZE && b->spare == NULL )
+		b->spare = c;
+	else
+		g_free( c );
+}
+
+iobuf_t *iobuf_new( void )
+{
+	return g_new0( iobuf_t, 1 );
+}
+
+void iobuf_free( iobuf_t *b )
+{
+	if( b == NULL )
+		return;
+
+	iobuf_clear( b );
+	g_free( b->spare );
+	g_free( b );
+}
+
+void iobuf_clear( iobuf_t *b )
+{
+	while( b->first )
+	{
+		struct iobuf_chunk *c = b->first;
+
+		b->first = c->next;
+		iobuf_chunk_release( b, c );
+	}
+	b->last = NULL;
+	b->len = 0;
+}
+
+void iobuf_append( iobuf_t *b, const char *data, gsize len )
+{
+	while( len > 0 )
+	{
+		struct iobuf_chunk *c = b->last;
+		gsize n;
+
+		if( c == NULL || c->tail == c->size )
+			c = iobuf_chunk_add( b, len );
+
+		n = MIN( len, c->size - c->tail );
+		memcpy( c->data + c->tail, data, n );
+		c->tail += n;
+		b->len += n;
+		data += n;
+		len -= n;
+	}
+}
+
+void iobuf_append_from( iobuf_t *b, iobuf_t *src, gsize off )
+{
+	struct iobuf_chunk *c;
+
+	for( c = src->first; c; c = c->next )
+	{
+		gsize avail = c->tail - c->head;
+
+		if( off >= avail )
+		{
+			off -= avail;
+			continue;
+		}
+
+		iobuf_append( b, c->data + c->head + off, avail - off );
+		off = 0;
+	}
+}
+
+char *iobuf_reserve( iobuf_t *b, gsize len )
+{
+	struct iobuf_chunk *c = b->last;
+
+	if( c && c->head == c->tail )
+		c->head = c->tail = 0;
+
+	if( c && c == b->first && c->head > 0 &&
+	    c->size - c->tail < len && c->size - ( c->tail - c->head ) >= len )
+	{
+		/* Only one chunk, usually with just a partial line left at the
+		   end of it. Cheaper to move that than to start a new chunk. */
+		memmove( c->data, c->data + c->head, c->tail - c->head );
+		c->tail -= c->head;
+		c->head = 0;
+	}
+
+	if( c == NULL || c->size - c->tail < len )
+		c = iobuf_chunk_add( b, len );
+
+	return c->data + c->tail;
+}
+
+void iobuf_commit( iobuf_t *b, gsize n )
+{
+	b->last->tail += n;
+	b->len += n;
+}
+
+char *iobuf_head( iobuf_t *b, gsize *len )
+{
+	struct iobuf_chunk *c = b->first;
+
+	while( c && c->head == c->tail )
+		c = c->next;
+
+	if( c == NULL )
+	{
+		*len = 0;
+		return NULL;
+	}
+
+	*len = c->tail - c->head;
+	return c->data + c->head;
+}
+
+char *iobuf_pullup( iobuf_t *b )
+{
+	struct iobuf_chunk *c = b->first, *n;
+	gsize need = b->len + 1;
+
+	if( c == NULL )
+		return iobuf_reserve( b, 1 );
+
+	if( c == b->last )
+	{
+		if( c->size - c->head >= need )
+			return c->data + c->head;
+
+		if( c->size >= need )
+		{
+			memmove( c->data, c->data + c->head, b->len );
+			c->head = 0;
+			c->tail = b->len;
+			return c->data;
+		}
+	}
+
+	/* Data is spread over several chunks (or there's no room for the
+	   terminator), so copy it all into a new one. */
+	n = g_malloc( sizeof( struct iobuf_chunk ) + MAX( need, IOBUF_CHUNK_SIZE ) );
+	n->size = MAX( need, IOBUF_CHUNK_SIZE );
+	n->head = n->tail = 0;
+	n->next = NULL;
+
+	while( ( c = b->first ) )
+	{
+		memcpy( n->data + n->tail, c->data + c->head, c->tail - c->head );
+		n->tail += c->tail - c->head;
+		b->first = c->next;
+		iobuf_chunk_release( b, c );
+	}
+	b->first = b->last = n;
+
+	return n->data;
+}
+
+void iobuf_drop( iobuf_t *b, gsize n )
+{
+	struct iobuf_chunk *c;
+
+	while( ( c = b->first ) )
+	{
+		gsize avail = c->tail - c->head;
+
+		if( n < avail )
+		{
+			c->head += n;
+			b->len -= n;
+			break;
+		}
+
+		n -= avail;
+		b->len -= avail;
+
+		if( ( b->first = c->next ) == NULL )
+			b->last = NULL;
+		iobuf_chunk_release( b, c );
+	}
+}
+
+gssize iobuf_writev( iobuf_t *b, int fd )
+{
+	gssize st;
+#ifndef _WIN32
+	struct iovec iov[IOBUF_IOV_MAX];
+	struct iobuf_chunk *c;
+	int i = 0;
+
+	for( c = b->first; c && i < IOBUF_IOV_MAX; c = c->next )
+		if( c->tail > c->head )
+		{
+			iov[i].iov_base = c->data + c->head;
+			iov[i].iov_len = c->tail - c->head;
+			i ++;
+		}
+
+	if( i == 0 )
+		return 0;
+
+	st = writev( fd, iov, i );
+#else
+	gsize len;
+	char *data = iobuf_head( b, &len );
+
+	if( len == 0 )
+		return 0;
+
+	st = send( fd, data, len, 0 );
+#endif
+
+	if( st > 0 )
+		iobuf_drop( b, st );
+
+	return st;
+}
+
+gssize iobuf_read( iobuf_t *b, int fd, void *ssl, gsize budget )
+{
+	gsize want = IOBUF_CHUNK_SIZE, total = 0;
+	gssize st = 0;
+
+	if( budget == 0 )
+		budget = IOBUF_READ_BUDGET;
+
+	/* Start small so idle connections don't pin big buffers, but read
+	   bigger pieces as long as they keep coming back full. */
+	while( total < budget || ( ssl && ssl_pending( ssl ) ) )
+	{
+		char *p = iobuf_reserve( b, want );
+		gsize room = b->last->size - b->last->tail;
+
+		if( total < budget )
+			room = MIN( room, budget - total );
+
+		if( ssl )
+			st = ssl_read( ssl, p, room );
+		else
+			st = read( fd, p, room );
+
+		if( st <= 0 )
+			break;
+
+		iobuf_commit( b, st );
+		total += st;
+
+		/* A short read means the kernel has nothing left for us,
+		   no need to find that out with another syscall. SSL reads
+		   return one record at most, those just go on until the
+		   SSL library says it'd block. */
+		if( (gsize) st < room && ssl == NULL )
+			break;
+
+		if( (gsize) st == room )
+			want = MIN( want * 2, IOBUF_READ_MAX );
+	}
+
+	return total > 0 ? (gssize) total : st;
+}
@@ -0,0 +1,91 @@
+/***************************************************************************\
+*                                                                           *
+*  BitlBee - An IRC to IM gateway                                           *
+*  Length-tracked chunked byte buffers for socket I/O                       *
+*                                                                           *
+*  Copyright 2002-2012 Wilmer van der Gaast and others                      *
+*                                                                           *
+*  This program is free software; you can redistribute it and/or modify     *
+*  it under the terms of the GNU General Public License as published by     *
+*  the Free Software Foundation; either version 2 of the License, or        *
+*  (at your option) any later version.                                      *
+*                                                                           *
+*  This program is distributed in the hope that it will be useful,          *
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+*  GNU General Public License for more details.                             *
+*                                                                           *
+*  You should have received a copy of the GNU General Public License along  *
+*  with this program; if not, write to the Free Software Foundation, Inc.,  *
+*  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.              *
+*                                                                           *
+\***************************************************************************/
+
+#ifndef _IOBUF_H
+#define _IOBUF_H
+
+#include <glib.h>
+#include <gmodule.h>
+
+/* Default size of a chunk. Bigger appends get a chunk of their own. */
+#define IOBUF_CHUNK_SIZE 4096
+
+/* Max. number of chunks passed to a single writev() call. */
+#define IOBUF_IOV_MAX 16
+
+/* Default max. number of bytes iobuf_read() takes from a socket in one
+   go, and the biggest single read() it will do. */
+#define IOBUF_READ_BUDGET 65536
+#define IOBUF_READ_MAX 16384
+
+/* A buffer is a list of chunks. Only the bytes between head and tail of
+   every chunk are valid data, so consuming from the front and appending
+   at the end never have to move anything around. */
+struct iobuf_chunk
+{
+	struct iobuf_chunk *next;
+	gsize head, tail, size;
+	char data[];
+};
+
+typedef struct iobuf
+{
+	struct iobuf_chunk *first, *last;
+	struct iobuf_chunk *spare; /* Kept around to avoid malloc churn. */
+	gsize len; /* Total number of valid bytes in all chunks. */
+} iobuf_t;
+
+G_MODULE_EXPORT iobuf_t *iobuf_new( void );
+G_MODULE_EXPORT void iobuf_free( iobuf_t *b );
+G_MODULE_EXPORT void iobuf_clear( iobuf_t *b );
+
+G_MODULE_EXPORT void iobuf_append( iobuf_t *b, const char *data, gsize len );
+/* Appends everything in src from offset off onwards. */
+G_MODULE_EXPORT void iobuf_append_from( iobuf_t *b, iobuf_t *src, gsize off );
+
+/* For reading straight from a socket into the buffer: iobuf_reserve()
+   returns a pointer to at least len bytes of free space at the end of
+   the buffer, iobuf_commit() then marks n of them as valid data. */
+G_MODULE_EXPORT char *iobuf_reserve( iobuf_t *b, gsize len );
+G_MODULE_EXPORT void iobuf_commit( iobuf_t *b, gsize n );
+
+/* Contiguous data at the start of the buffer (possibly not all of it). */
+G_MODULE_EXPORT char *iobuf_head( iobuf_t *b, gsize *len );
+/* Makes all data contiguous and returns a pointer to it. There's always
+   room for one more byte after the data so callers can NUL-terminate. */
+G_MODULE_EXPORT char *iobuf_pullup( iobuf_t *b );
+G_MODULE_EXPORT void iobuf_drop( iobuf_t *b, gsize n );
+
+/* Writes as much as possible to fd using one writev() and drops whatever
+   was written. Return value is like write(). */
+G_MODULE_EXPORT gssize iobuf_writev( iobuf_t *b, int fd );
+
+/* Reads from fd (or from ssl if that's not NULL) until the socket is
+   empty or budget bytes (0 for IOBUF_READ_BUDGET) were read. Data that
+   was already decrypted by the SSL library is always read as well, since
+   select() won't tell us about it. Returns the number of bytes added to
+   the buffer, or if that's none, 0 on EOF and -1 on errors. Check
+   sockerr_again()/ssl_sockerr_again() in that case. */
+G_MODULE_EXPORT gssize iobuf_read( iobuf_t *b, int fd, void *ssl, gsize budget );
+
+#endif
@@ -342,6 +342,100 @@ char *strip_newlines( char *source )
 	return source;
 }
 
+/* Returns TRUE if the first len bytes of s are all 7-bit. Checks a whole
+   word at a time, this runs for every line going to and from the IRC
+   client. */
+gboolean str_is_ascii( const char *s, gsize len )
+{
+	const char *end = s + len;
+	gsize w;
+	
+	while( s < end && ( (gsize) s & ( sizeof( w ) - 1 ) ) )
+		if( *s++ & 0x80 )
+			return FALSE;
+	
+	for( ; s + sizeof( w ) <= end; s += sizeof( w ) )
+	{
+		memcpy( &w, s, sizeof( w ) );
+		if( w & (gsize) 0x8080808080808080ULL )
+			return FALSE;
+	}
+	
+	while( s < end )
+		if( *s++ & 0x80 )
+			return FALSE;
+	
+	return TRUE;
+}
+
+/* Case-insensitive (ASCII only) versions of g_str_hash()/g_str_equal(),
+   for hash tables with things like command names and setting keys. */
+guint str_case_hash( gconstpointer key )
+{
+	const char *s = key;
+	guint h = 5381;
+	
+	while( *s )
+		h = h * 33 + g_ascii_tolower( *s++ );
+	
+	return h;
+}
+
+gboolean str_case_equal( gconstpointer a, gconstpointer b )
+{
+	return a == b || g_ascii_strcasecmp( a, b ) == 0;
+}
+
+/* Shared, refcounted copies of strings that lots of objects have in
+   common, like hostnames and away states. Strings returned by str_ref()
+   must not be modified, and have to be released using str_unref(). */
+struct str_ref
+{
+	guint refs;
+	char s[];
+};
+
+static GHashTable *str_refs;
+
+const char *str_ref( const char *s )
+{
+	struct str_ref *r;
+	
+	if( s == NULL )
+		return NULL;
+	
+	if( str_refs == NULL )
+		str_refs = g_hash_table_new( g_str_hash, g_str_equal );
+	
+	if( ( r = g_hash_table_lookup( str_refs, s ) ) == NULL )
+	{
+		gsize len = strlen( s );
+		
+		r = g_malloc( sizeof( struct str_ref ) + len + 1 );
+		r->refs = 0;
+		memcpy( r->s, s, len + 1 );
+		g_hash_table_insert( str_refs, r->s, r );
+	}
+	r->refs ++;
+	
+	return r->s;
+}
+
+void str_unref( const char *s )
+{
+	struct str_ref *r;
+	
+	if( s == NULL || str_refs == NULL ||
+	    ( r = g_hash_table_lookup( str_refs, s ) ) == NULL || r->s != s )
+		return;
+	
+	if( -- r->refs == 0 )
+	{
+		g_hash_table_remove( str_refs, r->s );
+		g_free( r );
+	}
+}
+
 /* Wrap an IPv4 address into IPv6 space. Not thread-safe... */
 char *ipv6_wrap( char *src )
 {
@@ -40,6 +40,11 @@ struct ns_srv_reply
 G_MODULE_EXPORT void strip_linefeed( gchar *text );
 G_MODULE_EXPORT char *add_cr( char *text );
 G_MODULE_EXPORT char *strip_newlines(char *source);
+G_MODULE_EXPORT gboolean str_is_ascii( const char *s, gsize len );
+G_MODULE_EXPORT guint str_case_hash( gconstpointer key );
+G_MODULE_EXPORT gboolean str_case_equal( gconstpointer a, gconstpointer b );
+G_MODULE_EXPORT const char *str_ref( const char *s );
+G_MODULE_EXPORT void str_unref( const char *s );
 
 G_MODULE_EXPORT time_t get_time( int year, int month, int day, int hour, int min, int sec );
 G_MODULE_EXPORT time_t mktime_utc( struct tm *tp );
@@ -63,10 +63,51 @@ struct PHB {
 	int port;
 	int fd;
 	gint inpa;
+	gint dns_id;
 	struct addrinfo *gai, *gai_cur;
 };
 
-static int proxy_connect_none(const char *host, unsigned short port_, struct PHB *phb);
+/* Connections waiting for a DNS answer, by the fd number their caller
+   already got from us. If the caller closes that fd, closesocket() calls
+   proxy_cancel() so we don't touch it (or whatever reuses the number)
+   anymore once the answer comes in. */
+static GHashTable *phb_waiting = NULL;
+
+static int proxy_connect_next(struct PHB *phb);
+
+static void phb_wait(struct PHB *phb, gint id)
+{
+	if (phb_waiting == NULL)
+		phb_waiting = g_hash_table_new(g_direct_hash, g_direct_equal);
+	
+	/* Someone close()d a placeholder without telling us. */
+	proxy_cancel(phb->fd);
+	
+	phb->dns_id = id;
+	g_hash_table_insert(phb_waiting, GINT_TO_POINTER(phb->fd), phb);
+}
+
+static void phb_answered(struct PHB *phb)
+{
+	if (phb_waiting && phb->fd >= 0 &&
+	    g_hash_table_lookup(phb_waiting, GINT_TO_POINTER(phb->fd)) == phb)
+		g_hash_table_remove(phb_waiting, GINT_TO_POINTER(phb->fd));
+	phb->dns_id = 0;
+}
+
+void proxy_cancel(int fd)
+{
+	struct PHB *phb;
+	
+	if (phb_waiting == NULL ||
+	    (phb = g_hash_table_lookup(phb_waiting, GINT_TO_POINTER(fd))) == NULL)
+		return;
+	
+	g_hash_table_remove(phb_waiting, GINT_TO_POINTER(fd));
+	dns_cancel(phb->dns_id);
+	g_free(phb->host);
+	g_free(phb);
+}
 
 static gboolean gaim_io_connected(gpointer data, gint source, b_input_condition cond)
 {
@@ -77,31 +118,24 @@ static gboolean gaim_io_connected(gpointer data, gint source, b_input_condition
 	
 #ifndef _WIN32
 	if (getsockopt(source, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error) {
-		if ((phb->gai_cur = phb->gai_cur->ai_next)) {
-			int new_fd;
-			b_event_remove(phb->inpa);
-			if ((new_fd = proxy_connect_none(NULL, 0, phb))) {
-				b_event_remove(phb->inpa);
-				closesocket(source);
-				dup2(new_fd, source);
-				closesocket(new_fd);
-				phb->inpa = b_input_add(source, B_EV_IO_WRITE, gaim_io_connected, phb);
-				return FALSE;
-			}
-		}
-		freeaddrinfo(phb->gai);
+		b_event_remove(phb->inpa);
+		/* Try the next address, proxy_connect_next() will reuse our fd. */
+		if ((phb->gai_cur = phb->gai_cur->ai_next) && proxy_connect_next(phb) >= 0)
+			return FALSE;
+		dns_free(phb->gai);
 		closesocket(source);
 		b_event_remove(phb->inpa);
 		if( phb->proxy_func )
 			phb->proxy_func(phb->proxy_data, -1, B_EV_IO_READ);
 		else {
 			phb->func(phb->data, -1, B_EV_IO_READ);
+			g_free(phb->host);
 			g_free(phb);
 		}
 		return FALSE;
 	}
 #endif
-	freeaddrinfo(phb->gai);
+	dns_free(phb->gai);
 	sock_make_blocking(source);
 	b_event_remove(phb->inpa);
 	if( phb->proxy_func )
@@ -114,30 +148,14 @@ static gboolean gaim_io_connected(gpointer data, gint source, b_input_condition
 	return FALSE;
 }
 
-static int proxy_connect_none(const char *host, unsigned short port_, struct PHB *phb)
+/* Try the addresses we have left until connect() doesn't fail right away.
+   If the caller already has an fd number from us, the new socket is moved
+   there. */
+static int proxy_connect_next(struct PHB *phb)
 {
 	struct sockaddr_in me;
 	int fd = -1;
 	
-	if (phb->gai_cur == NULL)
-	{
-		int ret;
-		char port[6];
-		struct addrinfo hints;
-	
-		g_snprintf(port, sizeof(port), "%d", port_);
-	
-		memset(&hints, 0, sizeof(struct addrinfo));
-		hints.ai_family = AF_UNSPEC;
-		hints.ai_socktype = SOCK_STREAM;
-		hints.ai_flags = AI_ADDRCONFIG | AI_NUMERICSERV;
-	
-		if (!(ret = getaddrinfo(host, port, &hints, &phb->gai)))
-			phb->gai_cur = phb->gai;
-		else
-			event_debug("gai(): %s\n", gai_strerror(ret));
-	}
-	
 	for (; phb->gai_cur; phb->gai_cur = phb->gai_cur->ai_next)
 	{
 		if ((fd = socket(phb->gai_cur->ai_family, phb->gai_cur->ai_socktype, phb->gai_cur->ai_protocol)) < 0) {
@@ -157,7 +175,7 @@ static int proxy_connect_none(const char *host, unsigned short port_, struct PHB
 				event_debug("bind( %d, \"%s\" ) failure\n", fd, global.conf->iface_out);
 		}
 
-		event_debug("proxy_connect_none( \"%s\", %d ) = %d\n", host, port, fd);
+		event_debug("proxy_connect_next() = %d\n", fd);
 	
 		if (connect(fd, phb->gai_cur->ai_addr, phb->gai_cur->ai_addrlen) < 0 && !sockerr_again()) {
 			event_debug( "connect failed: %s\n", strerror(errno));
@@ -165,6 +183,13 @@ static int proxy_connect_none(const char *host, unsigned short port_, struct PHB
 			fd = -1;
 			continue;
 		} else {
+#ifndef _WIN32
+			if (phb->fd >= 0) {
+				dup2(fd, phb->fd);
+				closesocket(fd);
+				fd = phb->fd;
+			}
+#endif
 			phb->inpa = b_input_add(fd, B_EV_IO_WRITE, gaim_io_connected, phb);
 			phb->fd = fd;
 			
@@ -172,12 +197,68 @@ static int proxy_connect_none(const char *host, unsigned short port_, struct PHB
 		}
 	}
 	
-	if(fd < 0 && host)
-		g_free(phb);
-
 	return fd;
 }
 
+static void proxy_resolved(gpointer data, struct addrinfo *res, int error)
+{
+	struct PHB *phb = data;
+	
+	if (error)
+		event_debug("gai(): %s\n", gai_strerror(error));
+	
+	phb->gai = phb->gai_cur = res;
+	
+	/* Answered right away, proxy_connect_none() takes it from here. */
+	if (phb->fd < 0)
+		return;
+	
+	/* Still waiting means the caller still has our placeholder, or
+	   we'd have been cancelled. */
+	phb_answered(phb);
+	
+	if (proxy_connect_next(phb) < 0) {
+		dns_free(phb->gai);
+		closesocket(phb->fd);
+		if( phb->proxy_func )
+			phb->proxy_func(phb->proxy_data, -1, B_EV_IO_READ);
+		else {
+			phb->func(phb->data, -1, B_EV_IO_READ);
+			g_free(phb->host);
+			g_free(phb);
+		}
+	}
+}
+
+static int proxy_connect_none(const char *host, unsigned short port, struct PHB *phb)
+{
+	gint id;
+	int fd;
+	
+	phb->fd = -1;
+	if ((id = dns_lookup(host, port, AF_UNSPEC, proxy_resolved, phb)) == 0) {
+		if ((fd = proxy_connect_next(phb)) < 0) {
+			dns_free(phb->gai);
+			g_free(phb->host);
+			g_free(phb);
+		}
+		return fd;
+	}
+	
+	/* The lookup is going to take a while. The caller wants an fd now,
+	   so give it a placeholder; the real socket will be dup2()ed on top
+	   of it once we know where to connect to. */
+	if ((phb->fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+		dns_cancel(id);
+		g_free(phb->host);
+		g_free(phb);
+		return -1;
+	}
+	phb_wait(phb, id);
+	
+	return phb->fd;
+}
+
 
 /* Connecting to HTTP proxies */
 
@@ -311,52 +392,62 @@ static gboolean s4_canread(gpointer data, gint source, b_input_condition cond)
 	return FALSE;
 }
 
-static gboolean s4_canwrite(gpointer data, gint source, b_input_condition cond)
+static void s4_resolved(gpointer data, struct addrinfo *res, int error)
 {
 	unsigned char packet[12];
-	struct hostent *hp;
 	struct PHB *phb = data;
-	unsigned int len;
-	int error = ETIMEDOUT;
-	if (phb->inpa > 0)
-		b_event_remove(phb->inpa);
-	len = sizeof(error);
-	if (getsockopt(source, SOL_SOCKET, SO_ERROR, &error, &len) < 0) {
-		close(source);
-		phb->func(phb->data, -1, B_EV_IO_READ);
-		g_free(phb->host);
-		g_free(phb);
-		return FALSE;
-	}
-	sock_make_blocking(source);
+	int source = phb->fd;
 
-	/* XXX does socks4 not support host name lookups by the proxy? */
-	if (!(hp = gethostbyname(phb->host))) {
+	phb_answered(phb);
+	
+	if (res == NULL) {
 		close(source);
 		phb->func(phb->data, -1, B_EV_IO_READ);
 		g_free(phb->host);
 		g_free(phb);
-		return FALSE;
+		return;
 	}
 
 	packet[0] = 4;
 	packet[1] = 1;
 	packet[2] = phb->port >> 8;
 	packet[3] = phb->port & 0xff;
-	packet[4] = (unsigned char)(hp->h_addr_list[0])[0];
-	packet[5] = (unsigned char)(hp->h_addr_list[0])[1];
-	packet[6] = (unsigned char)(hp->h_addr_list[0])[2];
-	packet[7] = (unsigned char)(hp->h_addr_list[0])[3];
+	memcpy(packet + 4, &((struct sockaddr_in *) res->ai_addr)->sin_addr, 4);
 	packet[8] = 0;
+	dns_free(res);
 	if (write(source, packet, 9) != 9) {
 		close(source);
 		phb->func(phb->data, -1, B_EV_IO_READ);
 		g_free(phb->host);
 		g_free(phb);
-		return FALSE;
+		return;
 	}
 
 	phb->inpa = b_input_add(source, B_EV_IO_READ, s4_canread, phb);
+}
+
+static gboolean s4_canwrite(gpointer data, gint source, b_input_condition cond)
+{
+	struct PHB *phb = data;
+	unsigned int len;
+	int error = ETIMEDOUT;
+	gint id;
+	if (phb->inpa > 0)
+		b_event_remove(phb->inpa);
+	len = sizeof(error);
+	if (getsockopt(source, SOL_SOCKET, SO_ERROR, &error, &len) < 0) {
+		close(source);
+		phb->func(phb->data, -1, B_EV_IO_READ);
+		g_free(phb->host);
+		g_free(phb);
+		return FALSE;
+	}
+	sock_make_blocking(source);
+
+	/* XXX does socks4 not support host name lookups by the proxy? */
+	phb->fd = source;
+	if ((id = dns_lookup(phb->host, phb->port, AF_INET, s4_resolved, phb)) != 0)
+		phb_wait(phb, id);
 	
 	return FALSE;
 }
@@ -50,4 +50,8 @@ extern char proxypass[128];
 
 G_MODULE_EXPORT int proxy_connect(const char *host, int port, b_event_handler func, gpointer data);
 
+/* Drops a connection attempt that's still waiting for a DNS answer on fd.
+   closesocket() calls this, there's no need to call it yourself. */
+G_MODULE_EXPORT void proxy_cancel(int fd);
+
 #endif /* _PROXY_H_ */
@@ -0,0 +1,192 @@
+/***************************************************************************\
+*                                                                           *
+*  BitlBee - An IRC to IM gateway                                           *
+*  Pools for lots of small fixed-size objects                               *
+*                                                                           *
+*  Copyright 2002-2012 Wilmer van der Gaast and others                      *
+*                                                                           *
+*  This program is free software; you can redistribute it and/or modify     *
+*  it under the terms of the GNU General Public License as published by     *
+*  the Free Software Foundation; either version 2 of the License, or        *
+*  (at your option) any later version.                                      *
+*                                                                           *
+*  This program is distributed in the hope that it will be useful,          *
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+*  GNU General Public License for more details.                             *
+*                                                                           *
+*  You should have received a copy of the GNU General Public License along  *
+*  with this program; if not, write to the Free Software Foundation, Inc.,  *
+*  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.              *
+*                                                                           *
+\***************************************************************************/
+
+
+/* In daemon mode, one process serves lots of users with big contact lists.
+   Allocating every contact and channel member separately scatters them all
+   over the heap, and after a few people disconnect the process can't give
+   much of that memory back. Pools keep objects of the same session and
+   type together instead. */
+
+#include <string.h>
+#include "slab.h"
+
+#define SLAB_ALIGN 8
+#define SLAB_ROUND( n ) ( ( (n) + SLAB_ALIGN - 1 ) & ~( (gsize) SLAB_ALIGN - 1 ) )
+/* Room for the chunk pointer in front of every object. */
+#define SLAB_HDR SLAB_ROUND( sizeof( struct slab_chunk * ) )
+
+struct slab_chunk
+{
+	struct slab_chunk *prev, *next;
+	slab_t *slab;
+	gpointer free;   /* Freed objects, linked through their first word. */
+	guint used;
+	guint fresh;     /* Slots from here on were never used yet. */
+};
+
+#define SLAB_DATA( c ) ( (char *) (c) + SLAB_ROUND( sizeof( struct slab_chunk ) ) )
+
+static gboolean slab_chunk_full( slab_t *s, struct slab_chunk *c )
+{
+	return c->free == NULL && c->fresh == s->per_chunk;
+}
+
+static void slab_unlink( slab_t *s, struct slab_chunk *c )
+{
+	if( c->prev )
+		c->prev->next = c->next;
+	else
+		s->first = c->next;
+	if( c->next )
+		c->next->prev = c->prev;
+	else
+		s->last = c->prev;
+	c->prev = c->next = NULL;
+}
+
+static void slab_link_first( slab_t *s, struct slab_chunk *c )
+{
+	c->prev = NULL;
+	if( ( c->next = s->first ) )
+		c->next->prev = c;
+	else
+		s->last = c;
+	s->first = c;
+}
+
+static void slab_link_last( slab_t *s, struct slab_chunk *c )
+{
+	c->next = NULL;
+	if( ( c->prev = s->last ) )
+		c->prev->next = c;
+	else
+		s->first = c;
+	s->last = c;
+}
+
+slab_t *slab_new( const char *name, gsize size )
+{
+	slab_t *s = g_new0( slab_t, 1 );
+	gsize room = SLAB_CHUNK_SIZE - SLAB_ROUND( sizeof( struct slab_chunk ) );
+	
+	s->name = name;
+	s->size = size;
+	s->slot = SLAB_HDR + SLAB_ROUND( MAX( size, sizeof( gpointer ) ) );
+	s->per_chunk = MAX( room / s->slot, 1 );
+	
+	return s;
+}
+
+void slab_destroy( slab_t *s )
+{
+	struct slab_chunk *c;
+	
+	if( s == NULL )
+		return;
+	
+	while( ( c = s->first ) )
+	{
+		s->first = c->next;
+		g_free( c );
+	}
+	g_free( s );
+}
+
+gpointer slab_alloc( slab_t *s )
+{
+	struct slab_chunk *c = s->first;
+	char *p;
+	
+	if( c == NULL || slab_chunk_full( s, c ) )
+	{
+		c = g_malloc( SLAB_ROUND( sizeof( struct slab_chunk ) ) + s->slot * s->per_chunk );
+		c->slab = s;
+		c->free = NULL;
+		c->used = c->fresh = 0;
+		slab_link_first( s, c );
+		s->chunks ++;
+	}
+	
+	if( c->free )
+	{
+		p = c->free;
+		c->free = *(gpointer *) p;
+	}
+	else
+	{
+		char *slot = SLAB_DATA( c ) + s->slot * c->fresh ++;
+		
+		*(struct slab_chunk **) slot = c;
+		p = slot + SLAB_HDR;
+	}
+	
+	c->used ++;
+	s->used ++;
+	
+	/* Keep the chunks with room in front. */
+	if( slab_chunk_full( s, c ) && c != s->last )
+	{
+		slab_unlink( s, c );
+		slab_link_last( s, c );
+	}
+	
+	memset( p, 0, s->size );
+	return p;
+}
+
+void slab_free( gpointer p )
+{
+	struct slab_chunk *c;
+	slab_t *s;
+	gboolean full;
+	
+	if( p == NULL )
+		return;
+	
+	c = *(struct slab_chunk **) ( (char *) p - SLAB_HDR );
+	s = c->slab;
+	full = slab_chunk_full( s, c );
+	
+	*(gpointer *) p = c->free;
+	c->free = p;
+	c->used --;
+	s->used --;
+	
+	if( c->used == 0 && s->chunks > 1 )
+	{
+		slab_unlink( s, c );
+		g_free( c );
+		s->chunks --;
+	}
+	else if( full && c != s->first )
+	{
+		slab_unlink( s, c );
+		slab_link_first( s, c );
+	}
+}
+
+gsize slab_bytes( slab_t *s )
+{
+	return s->chunks * ( SLAB_ROUND( sizeof( struct slab_chunk ) ) + s->slot * s->per_chunk );
+}
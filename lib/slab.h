@@ -0,0 +1,60 @@
+/***************************************************************************\
+*                                                                           *
+*  BitlBee - An IRC to IM gateway                                           *
+*  Pools for lots of small fixed-size objects                               *
+*                                                                           *
+*  Copyright 2002-2012 Wilmer van der Gaast and others                      *
+*                                                                           *
+*  This program is free software; you can redistribute it and/or modify     *
+*  it under the terms of the GNU General Public License as published by     *
+*  the Free Software Foundation; either version 2 of the License, or        *
+*  (at your option) any later version.                                      *
+*                                                                           *
+*  This program is distributed in the hope that it will be useful,          *
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+*  GNU General Public License for more details.                             *
+*                                                                           *
+*  You should have received a copy of the GNU General Public License along  *
+*  with this program; if not, write to the Free Software Foundation, Inc.,  *
+*  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.              *
+*                                                                           *
+\***************************************************************************/
+
+
+#ifndef _SLAB_H
+#define _SLAB_H
+
+#include <glib.h>
+#include <gmodule.h>
+
+/* Size of the blocks objects get carved out of. */
+#define SLAB_CHUNK_SIZE 16384
+
+struct slab_chunk;
+
+/* A pool of objects of one size. Every object remembers which chunk it
+   came from, so slab_free() doesn't need the pool (and can be used as a
+   GDestroyNotify). Chunks go back to the system as soon as they're empty,
+   and slab_destroy() gets rid of everything at once. */
+typedef struct slab
+{
+	const char *name; /* For statistics. */
+	gsize size;       /* Object size as asked for. */
+	gsize slot;       /* Same, plus chunk pointer and alignment. */
+	guint per_chunk;
+	struct slab_chunk *first, *last; /* Chunks with free slots first. */
+	guint chunks, used;
+} slab_t;
+
+G_MODULE_EXPORT slab_t *slab_new( const char *name, gsize size );
+G_MODULE_EXPORT void slab_destroy( slab_t *s );
+
+/* Returns a zeroed object. */
+G_MODULE_EXPORT gpointer slab_alloc( slab_t *s );
+G_MODULE_EXPORT void slab_free( gpointer p );
+
+/* Memory used by the pool, including unused parts of its chunks. */
+G_MODULE_EXPORT gsize slab_bytes( slab_t *s );
+
+#endif
@@ -0,0 +1,227 @@
+/***************************************************************************\
+*                                                                           *
+*  BitlBee - An IRC to IM gateway                                           *
+*  Hierarchical timer wheel used by the event handlers                      *
+*                                                                           *
+*  Copyright 2002-2012 Wilmer van der Gaast and others                      *
+*                                                                           *
+*  This program is free software; you can redistribute it and/or modify     *
+*  it under the terms of the GNU General Public License as published by     *
+*  the Free Software Foundation; either version 2 of the License, or        *
+*  (at your option) any later version.                                      *
+*                                                                           *
+*  This program is distributed in the hope that it will be useful,          *
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+*  GNU General Public License for more details.                             *
+*                                                                           *
+*  You should have received a copy of the GNU General Public License along  *
+*  with this program; if not, write to the Free Software Foundation, Inc.,  *
+*  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.              *
+*                                                                           *
+\***************************************************************************/
+
+/* Every IM connection has a keepalive timer, every user/channel with a
+   paste buffer has one, so does every IRC connection, reconnecting
+   accounts, etc. With thousands of those, keeping them all in a sorted
+   structure (or worse, one GSource each) gets expensive. This is a
+   hierarchical timer wheel (like the one in the Linux kernel): arming and
+   cancelling a timer is O(1), and timers only move to a lower level once
+   per level on their way down. */
+
+#include <string.h>
+#include <time.h>
+#include "timerwheel.h"
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+guint64 tw_now_ms( void )
+{
+#ifndef _WIN32
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (guint64) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#else
+	return GetTickCount();
+#endif
+}
+
+void tw_list_add( struct tw_timer **list, struct tw_timer *t )
+{
+	t->list = list;
+	t->prev = NULL;
+	t->next = *list;
+	if( *list )
+		(*list)->prev = t;
+	*list = t;
+}
+
+void tw_list_del( struct tw_timer *t )
+{
+	if( t->list == NULL )
+		return;
+
+	if( t->prev )
+		t->prev->next = t->next;
+	else
+		*t->list = t->next;
+	if( t->next )
+		t->next->prev = t->prev;
+
+	t->list = NULL;
+	t->prev = t->next = NULL;
+}
+
+void tw_init( struct tw_wheel *w )
+{
+	memset( w, 0, sizeof( *w ) );
+	w->now = tw_now_ms() / TW_TICK;
+}
+
+/* Put t in the right slot relative to w->now. */
+static void tw_place( struct tw_wheel *w, struct tw_timer *t )
+{
+	guint64 delta = t->expire > w->now ? t->expire - w->now : 0;
+	guint64 e = t->expire;
+	int level;
+
+	for( level = 0; level < TW_LEVELS - 1; level ++ )
+		if( delta < ( (guint64) 1 << ( TW_BITS * ( level + 1 ) ) ) )
+			break;
+
+	if( level == TW_LEVELS - 1 &&
+	    delta >= ( (guint64) 1 << ( TW_BITS * TW_LEVELS ) ) )
+	{
+		/* Too far away, park it in the last slot we can reach. It
+		   will be put in the right place when it cascades down. */
+		e = w->now + ( (guint64) 1 << ( TW_BITS * TW_LEVELS ) ) - 1;
+	}
+	else if( delta == 0 )
+	{
+		e = w->now;
+	}
+
+	tw_list_add( &w->slot[level][( e >> ( TW_BITS * level ) ) & TW_MASK], t );
+}
+
+void tw_add( struct tw_wheel *w, struct tw_timer *t, gint timeout )
+{
+	guint64 now = tw_now_ms();
+	guint64 ticks = ( MAX( timeout, 0 ) + TW_TICK - 1 ) / TW_TICK;
+
+	tw_del( w, t );
+
+	/* Round up to whole ticks, so timers that are due within the same
+	   tick get coalesced. Also never go for a tick we already did. */
+	t->expire = MAX( now / TW_TICK, w->now ) + MAX( ticks, 1 );
+	tw_place( w, t );
+	w->count ++;
+}
+
+void tw_del( struct tw_wheel *w, struct tw_timer *t )
+{
+	/* Could also be on a list returned by tw_advance(), in which case
+	   it was already subtracted from the count. */
+	if( t->list >= &w->slot[0][0] && t->list < &w->slot[0][0] + TW_LEVELS * TW_SIZE )
+		w->count --;
+
+	tw_list_del( t );
+}
+
+/* Move everything from a higher-level slot to lower levels. */
+static void tw_cascade( struct tw_wheel *w, int level )
+{
+	struct tw_timer **slot = &w->slot[level][( w->now >> ( TW_BITS * level ) ) & TW_MASK];
+	struct tw_timer *list = NULL, *t;
+
+	/* Detach the list first, entries may end up in the same slot again
+	   if they were parked there for being too far away. */
+	while( ( t = *slot ) )
+	{
+		tw_list_del( t );
+		tw_list_add( &list, t );
+	}
+
+	while( ( t = list ) )
+	{
+		tw_list_del( t );
+		tw_place( w, t );
+	}
+}
+
+void tw_advance( struct tw_wheel *w, struct tw_timer **due )
+{
+	guint64 target = tw_now_ms() / TW_TICK;
+
+	if( w->count == 0 )
+	{
+		w->now = MAX( w->now, target );
+		return;
+	}
+
+	while( w->now < target )
+	{
+		struct tw_timer **slot, *t;
+		int level;
+
+		w->now ++;
+
+		for( level = 1; level < TW_LEVELS; level ++ )
+		{
+			if( ( w->now >> ( TW_BITS * ( level - 1 ) ) ) & TW_MASK )
+				break;
+			tw_cascade( w, level );
+		}
+
+		slot = &w->slot[0][w->now & TW_MASK];
+		while( ( t = *slot ) )
+		{
+			tw_list_del( t );
+			w->count --;
+			tw_list_add( due, t );
+		}
+
+		if( w->count == 0 )
+		{
+			w->now = target;
+			break;
+		}
+	}
+}
+
+gint tw_next_timeout( struct tw_wheel *w )
+{
+	guint64 now = tw_now_ms(), next = 0, t;
+	int level, i;
+
+	if( w->count == 0 )
+		return -1;
+
+	/* The first non-empty slot on every level tells us when something
+	   has to happen: timers going off on level 0, cascading on the
+	   other ones. */
+	for( level = 0; level < TW_LEVELS; level ++ )
+	{
+		int shift = TW_BITS * level;
+
+		for( i = 1; i <= TW_SIZE; i ++ )
+		{
+			guint64 tick = ( ( w->now >> shift ) + i ) << shift;
+
+			if( w->slot[level][( tick >> shift ) & TW_MASK] )
+			{
+				if( next == 0 || tick < next )
+					next = tick;
+				break;
+			}
+		}
+	}
+
+	if( next == 0 )
+		return -1;
+
+	t = next * TW_TICK;
+	return t > now ? t - now : 0;
+}
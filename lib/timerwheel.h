@@ -0,0 +1,70 @@
+/***************************************************************************\
+*                                                                           *
+*  BitlBee - An IRC to IM gateway                                           *
+*  Hierarchical timer wheel used by the event handlers                      *
+*                                                                           *
+*  Copyright 2002-2012 Wilmer van der Gaast and others                      *
+*                                                                           *
+*  This program is free software; you can redistribute it and/or modify     *
+*  it under the terms of the GNU General Public License as published by     *
+*  the Free Software Foundation; either version 2 of the License, or        *
+*  (at your option) any later version.                                      *
+*                                                                           *
+*  This program is distributed in the hope that it will be useful,          *
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+*  GNU General Public License for more details.                             *
+*                                                                           *
+*  You should have received a copy of the GNU General Public License along  *
+*  with this program; if not, write to the Free Software Foundation, Inc.,  *
+*  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.              *
+*                                                                           *
+\***************************************************************************/
+
+#ifndef _TIMERWHEEL_H
+#define _TIMERWHEEL_H
+
+#include <glib.h>
+
+#define TW_TICK   10 /* ms. All timers due within the same tick fire together. */
+#define TW_BITS   6
+#define TW_SIZE   ( 1 << TW_BITS )
+#define TW_MASK   ( TW_SIZE - 1 )
+#define TW_LEVELS 4  /* 64 slots per level, so level 3 reaches ~46 hours. */
+
+/* Embed this in whatever you want to put on the wheel. */
+struct tw_timer
+{
+	struct tw_timer *prev, *next;
+	struct tw_timer **list; /* The slot (or other list) we're on, if any. */
+	guint64 expire;         /* In ticks. */
+};
+
+struct tw_wheel
+{
+	struct tw_timer *slot[TW_LEVELS][TW_SIZE];
+	guint64 now;            /* Last tick that was processed. */
+	guint count;
+};
+
+guint64 tw_now_ms( void );
+
+void tw_init( struct tw_wheel *w );
+/* Arm t to go off after timeout ms. Also works to re-arm a timer that's
+   already on the wheel. */
+void tw_add( struct tw_wheel *w, struct tw_timer *t, gint timeout );
+void tw_del( struct tw_wheel *w, struct tw_timer *t );
+
+/* Processes all ticks up to now and moves every timer that's due to *due.
+   They're taken off the wheel, so use tw_add() to re-arm them. */
+void tw_advance( struct tw_wheel *w, struct tw_timer **due );
+
+/* Number of ms until something on the wheel needs attention, or -1 if
+   the wheel is empty. */
+gint tw_next_timeout( struct tw_wheel *w );
+
+/* For walking lists like the one returned by tw_advance(). */
+void tw_list_add( struct tw_timer **list, struct tw_timer *t );
+void tw_list_del( struct tw_timer *t );
+
+#endif
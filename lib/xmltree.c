@@ -27,38 +27,184 @@
 #include <ctype.h>
 #include <stdio.h>
 
+#include "iobuf.h"
 #include "xmltree.h"
 
 #define g_strcasecmp g_ascii_strcasecmp
 #define g_strncasecmp g_ascii_strncasecmp
 
+/* Everything the parser builds comes from an arena per stanza: a few
+   mallocs per stanza instead of a few per node, and xt_cleanup() can just
+   drop the whole thing. Nodes allocated like this have XT_ARENA set, and
+   only the stanza's top node (the one with ->arena set) really frees
+   anything. */
+struct xt_arena_block
+{
+	struct xt_arena_block *next;
+	gsize size, used;
+	char data[];
+};
+
+struct xt_arena
+{
+	struct xt_arena_block *blocks;
+	char *last;		/* Last allocation, can be grown in place. */
+};
+
+#define XT_ARENA_BLOCK_SIZE 1024
+#define XT_ARENA_BLOCK_MAX  16384
+#define XT_ARENA_ALIGN( n ) ( ( (n) + 7 ) & ~(gsize) 7 )
+
+/* Names that show up in almost every stanza, no need to copy those. */
+static const char *xt_names[] = {
+	"iq", "presence", "message", "xmlns", "id", "from", "to", "type",
+	"query", "item", "jid", "name", "subscription", "group", "body",
+	NULL
+};
+
+static struct xt_arena *xt_arena_new( void )
+{
+	struct xt_arena_block *b = g_malloc( sizeof( struct xt_arena_block ) + XT_ARENA_BLOCK_SIZE );
+	struct xt_arena *a;
+	
+	/* The arena itself lives at the start of its first block. */
+	b->next = NULL;
+	b->size = XT_ARENA_BLOCK_SIZE;
+	b->used = XT_ARENA_ALIGN( sizeof( struct xt_arena ) );
+	a = (struct xt_arena *) b->data;
+	a->blocks = b;
+	a->last = NULL;
+	
+	return a;
+}
+
+static void xt_arena_free( struct xt_arena *a )
+{
+	struct xt_arena_block *b = a->blocks, *next;
+	
+	for( ; b; b = next )
+	{
+		next = b->next;
+		g_free( b );
+	}
+}
+
+static void *xt_arena_alloc( struct xt_arena *a, gsize len )
+{
+	struct xt_arena_block *b = a->blocks;
+	gsize need = XT_ARENA_ALIGN( len );
+	
+	if( b->size - b->used < need )
+	{
+		gsize size = MAX( need, MIN( b->size * 2, XT_ARENA_BLOCK_MAX ) );
+		
+		b = g_malloc( sizeof( struct xt_arena_block ) + size );
+		b->size = size;
+		b->used = 0;
+		b->next = a->blocks;
+		a->blocks = b;
+	}
+	
+	a->last = b->data + b->used;
+	b->used += need;
+	
+	return a->last;
+}
+
+/* Like g_renew(), but p stays where it is if it was the last thing
+   allocated and there's still room behind it. */
+static void *xt_arena_grow( struct xt_arena *a, void *p, gsize len, gsize new_len )
+{
+	struct xt_arena_block *b = a->blocks;
+	void *ret;
+	
+	if( p && p == a->last && (char*) p + XT_ARENA_ALIGN( new_len ) <= b->data + b->size )
+	{
+		b->used = (char*) p - b->data + XT_ARENA_ALIGN( new_len );
+		return p;
+	}
+	
+	/* Get a block with room to spare so the next one can be done in
+	   place, but leave the spare room free for now. */
+	ret = xt_arena_alloc( a, new_len + len );
+	a->blocks->used = (char*) ret - a->blocks->data + XT_ARENA_ALIGN( new_len );
+	if( p )
+		memcpy( ret, p, len );
+	
+	return ret;
+}
+
+static char *xt_arena_strdup( struct xt_arena *a, const char *s )
+{
+	gsize len = strlen( s ) + 1;
+	
+	return memcpy( xt_arena_alloc( a, len ), s, len );
+}
+
+static char *xt_arena_name( struct xt_arena *a, const char *name )
+{
+	int i;
+	
+	for( i = 0; xt_names[i]; i ++ )
+		if( xt_names[i][0] == name[0] && strcmp( xt_names[i], name ) == 0 )
+			return (char*) xt_names[i];
+	
+	return xt_arena_strdup( a, name );
+}
+
+static struct xt_arena *xt_node_arena( struct xt_node *node )
+{
+	while( node->arena == NULL )
+		node = node->parent;
+	
+	return node->arena;
+}
+
 static void xt_start_element( GMarkupParseContext *ctx, const gchar *element_name, const gchar **attr_names, const gchar **attr_values, gpointer data, GError **error )
 {
 	struct xt_parser *xt = data;
-	struct xt_node *node = g_new0( struct xt_node, 1 ), *nt;
+	struct xt_node *node, *nt;
+	struct xt_arena *a;
 	int i;
 	
+	/* The root (<stream:stream> for XMPP) and every stanza right below
+	   it get their own arena, anything deeper goes into their parent's. */
+	if( xt->cur == NULL || xt->cur == xt->root )
+		a = xt_arena_new();
+	else
+		a = xt_node_arena( xt->cur );
+	
+	node = xt_arena_alloc( a, sizeof( struct xt_node ) );
+	memset( node, 0, sizeof( struct xt_node ) );
+	if( xt->cur == NULL || xt->cur == xt->root )
+		node->arena = a;
+	node->flags = XT_ARENA;
 	node->parent = xt->cur;
-	node->name = g_strdup( element_name );
+	node->name = xt_arena_name( a, element_name );
 	
 	/* First count the number of attributes */
 	for( i = 0; attr_names[i]; i ++ );
 	
 	/* Then allocate a NULL-terminated array. */
-	node->attr = g_new0( struct xt_attr, i + 1 );
+	node->attr = xt_arena_alloc( a, sizeof( struct xt_attr ) * ( i + 1 ) );
+	node->attr[i].key = node->attr[i].value = NULL;
 	
 	/* And fill it, saving one variable by starting at the end. */
 	for( i --; i >= 0; i -- )
 	{
-		node->attr[i].key = g_strdup( attr_names[i] );
-		node->attr[i].value = g_strdup( attr_values[i] );
+		node->attr[i].key = xt_arena_name( a, attr_names[i] );
+		node->attr[i].value = xt_arena_strdup( a, attr_values[i] );
 	}
 	
 	/* Add it to the linked list of children nodes, if we have a current
 	   node yet. */
 	if( xt->cur )
 	{
-		if( xt->cur->children )
+		if( xt->tail )
+		{
+			xt->tail->next = node;
+		}
+		else if( xt->cur->children )
 		{
 			for( nt = xt->cur->children; nt->next; nt = nt->next );
 			nt->next = node;
@@ -75,6 +221,7 @@ static void xt_start_element( GMarkupParseContext *ctx, const gchar *element_nam
 	
 	/* Now this node will be the new current node. */
 	xt->cur = node;
+	xt->tail = NULL;
 	/* And maybe this is the root? */
 	if( xt->root == NULL )
 		xt->root = node;
@@ -88,20 +235,177 @@ static void xt_text( GMarkupParseContext *ctx, const gchar *text, gsize text_len
 	if( node == NULL )
 		return;
 	
-	/* FIXME: Does g_renew also OFFICIALLY accept NULL arguments? */
-	node->text = g_renew( char, node->text, node->text_len + text_len + 1 );
+	node->text = xt_arena_grow( xt_node_arena( node ), node->text, node->text_len,
+	                            node->text_len + text_len + 1 );
 	memcpy( node->text + node->text_len, text, text_len );
 	node->text_len += text_len;
 	/* Zero termination is always nice to have. */
 	node->text[node->text_len] = 0;
 }
 
+/* Handlers are looked up by (parent, name). Both compared case-
+   insensitively, with "<root>" as the parent of the root element. */
+struct xt_handler_key
+{
+	const char *parent, *name;
+};
+
+static guint xt_handler_hash( gconstpointer key_ )
+{
+	const struct xt_handler_key *key = key_;
+	const char *s;
+	guint h = 5381;
+	
+	for( s = key->parent; *s; s ++ )
+		h = h * 33 + g_ascii_tolower( *s );
+	h = h * 33;
+	for( s = key->name; *s; s ++ )
+		h = h * 33 + g_ascii_tolower( *s );
+	
+	return h;
+}
+
+static gboolean xt_handler_equal( gconstpointer a_, gconstpointer b_ )
+{
+	const struct xt_handler_key *a = a_, *b = b_;
+	
+	return g_strcasecmp( a->parent, b->parent ) == 0 &&
+	       g_strcasecmp( a->name, b->name ) == 0;
+}
+
+static gboolean xt_handler_match( const struct xt_handler_entry *h, const char *parent, const char *name )
+{
+	/* If handler.name == NULL it means it should always match. If
+	   handler.parent == NULL, same thing. */
+	return ( h->name == NULL || g_strcasecmp( h->name, name ) == 0 ) &&
+	       ( h->parent == NULL || g_strcasecmp( h->parent, parent ) == 0 );
+}
+
+/* For every (parent, name) combination mentioned in the handler table,
+   make a list of all the handlers that match it (including wildcards),
+   in the order they have to be tried. */
+static void xt_handler_hash_build( struct xt_parser *xt )
+{
+	int i, j, n;
+	
+	xt->handler_hash = g_hash_table_new_full( xt_handler_hash, xt_handler_equal, g_free, g_free );
+	
+	for( i = 0; xt->handlers[i].func; i ++ )
+	{
+		const struct xt_handler_entry **list;
+		struct xt_handler_key *key;
+		
+		if( xt->handlers[i].name == NULL || xt->handlers[i].parent == NULL )
+			continue;
+		
+		key = g_new( struct xt_handler_key, 1 );
+		key->parent = xt->handlers[i].parent;
+		key->name = xt->handlers[i].name;
+		if( g_hash_table_lookup( xt->handler_hash, key ) )
+		{
+			g_free( key );
+			continue;
+		}
+		
+		for( j = n = 0; xt->handlers[j].func; j ++ )
+			if( xt_handler_match( &xt->handlers[j], key->parent, key->name ) )
+				n ++;
+		
+		list = g_new0( const struct xt_handler_entry *, n + 1 );
+		for( j = n = 0; xt->handlers[j].func; j ++ )
+			if( xt_handler_match( &xt->handlers[j], key->parent, key->name ) )
+				list[n++] = &xt->handlers[j];
+		
+		g_hash_table_insert( xt->handler_hash, key, list );
+	}
+}
+
+/* Call the handler(s) for one (complete) node. */
+static xt_status xt_dispatch( struct xt_parser *xt, struct xt_node *node )
+{
+	const struct xt_handler_entry **list = NULL;
+	struct xt_handler_key key;
+	xt_status st;
+	int i;
+	
+	if( xt->handlers == NULL )
+		return XT_HANDLED;
+	
+	key.parent = node->parent ? node->parent->name : "<root>";
+	key.name = node->name;
+	
+	if( xt->handler_hash )
+		list = g_hash_table_lookup( xt->handler_hash, &key );
+	
+	if( list )
+	{
+		for( i = 0; list[i]; i ++ )
+			if( ( st = list[i]->func( node, xt->data ) ) != XT_NEXT )
+				return st;
+	}
+	else
+	{
+		/* Nothing specific for this one, only wildcards may match. */
+		for( i = 0; xt->handlers[i].func; i ++ )
+			if( xt_handler_match( &xt->handlers[i], key.parent, key.name ) &&
+			    ( st = xt->handlers[i].func( node, xt->data ) ) != XT_NEXT )
+				return st;
+	}
+	
+	return XT_HANDLED;
+}
+
+/* Stream mode: Handle stanzas as soon as they're complete and throw them
+   away right after that. */
+static void xt_stream_dispatch( struct xt_parser *xt, struct xt_node *node, GError **error )
+{
+	struct xt_node *prev;
+	
+	if( xt_dispatch( xt, node ) == XT_ABORT || xt->freed )
+	{
+		/* Don't touch anything anymore, the handler may have
+		   destroyed the whole connection (xt_free() waits for
+		   xt_feed() to return though). Just make GMarkup stop. */
+		xt->aborted = TRUE;
+		g_set_error( error, G_MARKUP_ERROR, G_MARKUP_ERROR_INVALID_CONTENT,
+		             "Aborted by handler" );
+		return;
+	}
+	
+	node->flags |= XT_SEEN;
+	
+	/* </stream:stream>, keep the root, xt_feed() will report it. */
+	if( node->parent == NULL )
+		return;
+	
+	if( node->parent->children == node )
+	{
+		prev = NULL;
+		node->parent->children = node->next;
+	}
+	else
+	{
+		for( prev = node->parent->children; prev->next != node; prev = prev->next );
+		prev->next = node->next;
+	}
+	
+	if( xt->tail == node )
+		xt->tail = prev;
+	
+	xt_free_node( node );
+}
+
 static void xt_end_element( GMarkupParseContext *ctx, const gchar *element_name, gpointer data, GError **error )
 {
 	struct xt_parser *xt = data;
+	struct xt_node *node = xt->cur;
+	
+	node->flags |= XT_COMPLETE;
+	xt->tail = node;
+	xt->cur = node->parent;
 	
-	xt->cur->flags |= XT_COMPLETE;
-	xt->cur = xt->cur->parent;
+	if( xt->stream && ( node->parent == NULL || node->parent == xt->root ) )
+		xt_stream_dispatch( xt, node, error );
 }
 
 GMarkupParser xt_parser_funcs =
@@ -119,11 +423,27 @@ struct xt_parser *xt_new( const struct xt_handler_entry *handlers, gpointer data
 	
 	xt->data = data;
 	xt->handlers = handlers;
+	if( handlers )
+		xt_handler_hash_build( xt );
 	xt_reset( xt );
 	
 	return xt;
 }
 
+/* A parser for streams like XMPP's: xt_feed() calls the handler for every
+   element right below the root as soon as it's complete, and frees it
+   right after that. No need for xt_handle()/xt_cleanup(). In this mode,
+   xt_feed() returns 0 if a handler returned XT_ABORT, in which case the
+   parser may be gone already. */
+struct xt_parser *xt_new_stream( const struct xt_handler_entry *handlers, gpointer data )
+{
+	struct xt_parser *xt = xt_new( handlers, data );
+	
+	xt->stream = TRUE;
+	
+	return xt;
+}
+
 /* Reset the parser, flush everything we have so far. For example, we need
    this for XMPP when doing TLS/SASL to restart the stream. */
 void xt_reset( struct xt_parser *xt )
@@ -138,14 +458,30 @@ void xt_reset( struct xt_parser *xt )
 		xt_free_node( xt->root );
 		xt->root = NULL;
 		xt->cur = NULL;
+		xt->tail = NULL;
 	}
 }
 
-/* Feed the parser, don't execute any handler. Returns -1 on errors, 0 on
-   end-of-stream and 1 otherwise. */
+/* Feed the parser, don't execute any handler (unless this is a stream
+   parser). Returns -1 on errors, 0 on end-of-stream and 1 otherwise. */
 int xt_feed( struct xt_parser *xt, const char *text, int text_len )
 {
-	if( !g_markup_parse_context_parse( xt->parser, text, text_len, &xt->gerr ) )
+	gboolean ok;
+	
+	xt->feeding = TRUE;
+	ok = g_markup_parse_context_parse( xt->parser, text, text_len, &xt->gerr );
+	xt->feeding = FALSE;
+	
+	if( xt->aborted )
+	{
+		if( xt->freed )
+			xt_free( xt );
+		else
+			g_clear_error( &xt->gerr );
+		
+		return 0;
+	}
+	else if( !ok )
 	{
 		return -1;
 	}
@@ -159,8 +495,6 @@ int xt_feed( struct xt_parser *xt, const char *text, int text_len )
 int xt_handle( struct xt_parser *xt, struct xt_node *node, int depth )
 {
 	struct xt_node *c;
-	xt_status st;
-	int i;
 	
 	if( xt->root == NULL )
 		return 1;
@@ -175,29 +509,8 @@ int xt_handle( struct xt_parser *xt, struct xt_node *node, int depth )
 	
 	if( node->flags & XT_COMPLETE && !( node->flags & XT_SEEN ) )
 	{
-		if( xt->handlers ) for( i = 0; xt->handlers[i].func; i ++ )
-		{
-			/* This one is fun! \o/ */
-			
-			    /* If handler.name == NULL it means it should always match. */
-			if( ( xt->handlers[i].name == NULL || 
-			      /* If it's not, compare. There should always be a name. */
-			      g_strcasecmp( xt->handlers[i].name, node->name ) == 0 ) &&
-			    /* If handler.parent == NULL, it's a match. */
-			    ( xt->handlers[i].parent == NULL ||
-			      /* If there's a parent node, see if the name matches. */
-			      ( node->parent ? g_strcasecmp( xt->handlers[i].parent, node->parent->name ) == 0 : 
-			      /* If there's no parent, the handler should mention <root> as a parent. */
-			                       strcmp( xt->handlers[i].parent, "<root>" ) == 0 ) ) )
-			{
-				st = xt->handlers[i].func( node, xt->data );
-				
-				if( st == XT_ABORT )
-					return 0;
-				else if( st != XT_NEXT )
-					break;
-			}
-		}
+		if( xt_dispatch( xt, node ) == XT_ABORT )
+			return 0;
 		
 		node->flags |= XT_SEEN;
 	}
@@ -224,7 +537,7 @@ void xt_cleanup( struct xt_parser *xt, struct xt_node *node, int depth )
 	if( node->flags & XT_SEEN && node == xt->root )
 	{
 		xt_free_node( xt->root );
-		xt->root = xt->cur = NULL;
+		xt->root = xt->cur = xt->tail = NULL;
 		/* xt->cur should be NULL already, BTW... */
 		
 		return;
@@ -242,6 +555,9 @@ void xt_cleanup( struct xt_parser *xt, struct xt_node *node, int depth )
 			else
 				node->children = c->next;
 			
+			if( c == xt->tail )
+				xt->tail = prev;
+			
 			xt_free_node( c );
 			
 			/* Since the for loop wants to get c->next, make sure
@@ -281,53 +597,118 @@ struct xt_node *xt_from_string( const char *in, int len )
 	return ret;
 }
 
-static void xt_to_string_real( struct xt_node *node, GString *str )
+/* The serializer writes through one of these, so it can write into a
+   GString or straight into a connection's output buffer. */
+typedef void (*xt_append_func) ( gpointer buf, const char *s, gsize len );
+
+static void xt_append_gstring( gpointer buf, const char *s, gsize len )
+{
+	g_string_append_len( buf, s, len );
+}
+
+static void xt_append_iobuf( gpointer buf, const char *s, gsize len )
+{
+	iobuf_append( buf, s, len );
+}
+
+/* Same escaping as g_markup_escape_text(), but without allocating a copy:
+   unescaped runs are passed on as they are. */
+static void xt_escape( xt_append_func f, gpointer buf, const char *s, gsize len )
+{
+	const char *end = s + len, *run = s;
+	
+	for( ; s < end; s ++ )
+	{
+		unsigned char c = *s;
+		const char *ent = NULL;
+		char num[8];
+		int skip = 1;
+		
+		if( c == '&' )
+			ent = "&amp;";
+		else if( c == '<' )
+			ent = "&lt;";
+		else if( c == '>' )
+			ent = "&gt;";
+		else if( c == '\'' )
+			ent = "&apos;";
+		else if( c == '"' )
+			ent = "&quot;";
+		else if( ( c >= 0x1 && c <= 0x8 ) || c == 0xb || c == 0xc ||
+		         ( c >= 0xe && c <= 0x1f ) || c == 0x7f )
+			g_snprintf( ent = num, sizeof( num ), "&#x%x;", c );
+		else if( c == 0xc2 && s + 1 < end &&
+		         (unsigned char) s[1] >= 0x80 && (unsigned char) s[1] <= 0x9f &&
+		         (unsigned char) s[1] != 0x85 )
+		{
+			/* U+0080..U+009F are control characters too (except
+			   for NEL, which GLib leaves alone as well). */
+			g_snprintf( ent = num, sizeof( num ), "&#x%x;", (unsigned char) s[1] );
+			skip = 2;
+		}
+		
+		if( ent )
+		{
+			if( s > run )
+				f( buf, run, s - run );
+			f( buf, ent, strlen( ent ) );
+			s += skip - 1;
+			run = s + 1;
+		}
+	}
+	
+	if( s > run )
+		f( buf, run, s - run );
+}
+
+static void xt_serialize( struct xt_node *node, xt_append_func f, gpointer buf )
 {
-	char *buf;
 	struct xt_node *c;
 	int i;
 	
-	g_string_append_printf( str, "<%s", node->name );
+	f( buf, "<", 1 );
+	f( buf, node->name, strlen( node->name ) );
 	
 	for( i = 0; node->attr[i].key; i ++ )
 	{
-		buf = g_markup_printf_escaped( " %s=\"%s\"", node->attr[i].key, node->attr[i].value );
-		g_string_append( str, buf );
-		g_free( buf );
+		f( buf, " ", 1 );
+		f( buf, node->attr[i].key, strlen( node->attr[i].key ) );
+		f( buf, "=\"", 2 );
+		xt_escape( f, buf, node->attr[i].value, strlen( node->attr[i].value ) );
+		f( buf, "\"", 1 );
 	}
 	
 	if( node->text == NULL && node->children == NULL )
 	{
-		g_string_append( str, "/>" );
+		f( buf, "/>", 2 );
 		return;
 	}
 	
-	g_string_append( str, ">" );
+	f( buf, ">", 1 );
 	if( node->text_len > 0 )
-	{
-		buf = g_markup_escape_text( node->text, node->text_len );
-		g_string_append( str, buf );
-		g_free( buf );
-	}
+		xt_escape( f, buf, node->text, node->text_len );
 	
 	for( c = node->children; c; c = c->next )
-		xt_to_string_real( c, str );
+		xt_serialize( c, f, buf );
 	
-	g_string_append_printf( str, "</%s>", node->name );
+	f( buf, "</", 2 );
+	f( buf, node->name, strlen( node->name ) );
+	f( buf, ">", 1 );
 }
 
 char *xt_to_string( struct xt_node *node )
 {
-	GString *ret;
-	char *real;
-	
-	ret = g_string_new( "" );
-	xt_to_string_real( node, ret );
+	GString *ret = g_string_sized_new( 256 );
 	
-	real = ret->str;
-	g_string_free( ret, FALSE );
+	xt_serialize( node, xt_append_gstring, ret );
 	
-	return real;
+	return g_string_free( ret, FALSE );
+}
+
+/* Serialize a node and append it to b, no copies in between. */
+void xt_to_iobuf( struct xt_node *node, iobuf_t *b )
+{
+	xt_serialize( node, xt_append_iobuf, b );
 }
 
 void xt_print( struct xt_node *node )
@@ -398,7 +779,7 @@ struct xt_node *xt_dup( struct xt_node *node )
 	/* Let's NOT copy the parent element here BTW! Only do it for children. */
 	
 	dup->name = g_strdup( node->name );
-	dup->flags = node->flags;
+	dup->flags = node->flags & ~XT_ARENA;
 	if( node->text )
 	{
 		dup->text = g_memdup( node->text, node->text_len + 1 );
@@ -430,6 +811,27 @@ struct xt_node *xt_dup( struct xt_node *node )
 	return dup;
 }
 
+/* Whatever's in the arena goes in one go, but people may have added nodes
+   of their own to the tree, and stanzas below the root have their own
+   arena too. */
+static void xt_free_arena_node( struct xt_node *node )
+{
+	struct xt_node *c, *next;
+	
+	for( c = node->children; c; c = next )
+	{
+		next = c->next;
+		
+		if( !( c->flags & XT_ARENA ) || c->arena )
+			xt_free_node( c );
+		else
+			xt_free_arena_node( c );
+	}
+	
+	if( node->arena )
+		xt_arena_free( node->arena );
+}
+
 /* Frees a node. This doesn't clean up references to itself from parents! */
 void xt_free_node( struct xt_node *node )
 {
@@ -438,6 +840,12 @@ void xt_free_node( struct xt_node *node )
 	if( !node )
 		return;
 	
+	if( node->flags & XT_ARENA )
+	{
+		xt_free_arena_node( node );
+		return;
+	}
+	
 	g_free( node->name );
 	g_free( node->text );
 	
@@ -464,9 +872,20 @@ void xt_free( struct xt_parser *xt )
 	if( !xt )
 		return;
 	
+	if( xt->feeding )
+	{
+		/* Called from a handler, GMarkup is still busy with us.
+		   xt_feed() will come back here when it's done. */
+		xt->freed = TRUE;
+		return;
+	}
+	
 	if( xt->root )
 		xt_free_node( xt->root );
 	
+	if( xt->handler_hash )
+		g_hash_table_destroy( xt->handler_hash );
+	g_clear_error( &xt->gerr );
 	g_markup_parse_context_free( xt->parser );
 	
 	g_free( xt );
@@ -674,6 +1093,25 @@ void xt_add_attr( struct xt_node *node, const char *key, const char *value )
 		if( strcmp( node->attr[i].key, key ) == 0 )
 			break;
 	
+	if( node->flags & XT_ARENA )
+	{
+		/* Parsed node, the old array/value just stay in the arena. */
+		struct xt_arena *a = xt_node_arena( node );
+		
+		if( node->attr[i].key == NULL )
+		{
+			struct xt_attr *attr = xt_arena_alloc( a, sizeof( struct xt_attr ) * ( i + 2 ) );
+			
+			memcpy( attr, node->attr, sizeof( struct xt_attr ) * i );
+			node->attr = attr;
+			node->attr[i].key = xt_arena_strdup( a, key );
+			node->attr[i+1].key = node->attr[i+1].value = NULL;
+		}
+		
+		node->attr[i].value = xt_arena_strdup( a, value );
+		return;
+	}
+	
 	if( node->attr[i].key == NULL )
 	{
 		/* If not, allocate space for a new attribute. */
@@ -702,8 +1140,11 @@ int xt_remove_attr( struct xt_node *node, const char *key )
 	if( node->attr[i].key == NULL )
 		return 0;
 	
-	g_free( node->attr[i].key );
-	g_free( node->attr[i].value );
+	if( !( node->flags & XT_ARENA ) )
+	{
+		g_free( node->attr[i].key );
+		g_free( node->attr[i].value );
+	}
 	
 	/* If it's the last, this is easy: */
 	if( node->attr[i+1].key == NULL )
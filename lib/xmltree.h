@@ -28,6 +28,7 @@ typedef enum
 {
 	XT_COMPLETE	= 1,	/* </tag> reached */
 	XT_SEEN		= 2,	/* Handler called (or not defined) */
+	XT_ARENA	= 4,	/* Allocated by the parser, see xt_free_node() */
 } xt_flags;
 
 typedef enum
@@ -42,6 +43,9 @@ struct xt_attr
 	char *key, *value;
 };
 
+struct xt_arena;
+struct iobuf;
+
 struct xt_node
 {
 	struct xt_node *parent;
@@ -54,6 +58,10 @@ struct xt_node
 	
 	struct xt_node *next;
 	xt_flags flags;
+	
+	/* Only set on the top node of a stanza, everything below it (names,
+	   attributes, text and the nodes themselves) lives in here. */
+	struct xt_arena *arena;
 };
 
 typedef xt_status (*xt_handler_func) ( struct xt_node *node, gpointer data );
@@ -69,20 +77,30 @@ struct xt_parser
 	GMarkupParseContext *parser;
 	struct xt_node *root;
 	struct xt_node *cur;
+	struct xt_node *tail;	/* Last child of cur, so appending is O(1). */
 	
 	const struct xt_handler_entry *handlers;
+	GHashTable *handler_hash;	/* (parent, name) -> handlers that match. */
 	gpointer data;
 	
 	GError *gerr;
+	
+	/* See xt_new_stream(). */
+	gboolean stream;
+	gboolean feeding;	/* Inside xt_feed(), so xt_free() has to wait. */
+	gboolean aborted;	/* A handler returned XT_ABORT. */
+	gboolean freed;		/* xt_free() was called during xt_feed(). */
 };
 
 struct xt_parser *xt_new( const struct xt_handler_entry *handlers, gpointer data );
+struct xt_parser *xt_new_stream( const struct xt_handler_entry *handlers, gpointer data );
 void xt_reset( struct xt_parser *xt );
 int xt_feed( struct xt_parser *xt, const char *text, int text_len );
 int xt_handle( struct xt_parser *xt, struct xt_node *node, int depth );
 void xt_cleanup( struct xt_parser *xt, struct xt_node *node, int depth );
 struct xt_node *xt_from_string( const char *in, int text_len );
 char *xt_to_string( struct xt_node *node );
+void xt_to_iobuf( struct xt_node *node, struct iobuf *b );
 void xt_print( struct xt_node *node );
 struct xt_node *xt_dup( struct xt_node *node );
 void xt_free_node( struct xt_node *node );
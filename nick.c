@@ -40,13 +40,46 @@ static char *clean_handle( const char *orig )
 	
 	do {
 		if (*orig != ' ')
-			new[i++] = tolower( *orig );
+			new[i++] = g_ascii_tolower( (unsigned char) *orig );
 	}
 	while (*(orig++));
 	
 	return new;
 }
 
+/* acc->nicks is keyed by cleaned handles, these let us look things up
+   without cleaning (and allocating) a copy of the handle first. */
+guint nick_handle_hash( gconstpointer key )
+{
+	const char *s = key;
+	guint h = 5381;
+	
+	for( ; *s; s ++ )
+		if( *s != ' ' )
+			h = h * 33 + g_ascii_tolower( (unsigned char) *s );
+	
+	return h;
+}
+
+gboolean nick_handle_equal( gconstpointer a_, gconstpointer b_ )
+{
+	const char *a = a_, *b = b_;
+	
+	while( TRUE )
+	{
+		while( *a == ' ' ) a ++;
+		while( *b == ' ' ) b ++;
+		
+		if( g_ascii_tolower( (unsigned char) *a ) != g_ascii_tolower( (unsigned char) *b ) )
+			return FALSE;
+		else if( *a == '\0' )
+			return TRUE;
+		
+		a ++;
+		b ++;
+	}
+}
+
 void nick_set_raw( account_t *acc, const char *handle, const char *nick )
 {
 	char *store_handle, *store_nick = g_malloc( MAX_NICK_LENGTH + 1 );
@@ -64,28 +97,21 @@ void nick_set( bee_user_t *bu, const char *nick )
 	nick_set_raw( bu->ic->acc, bu->handle, nick );
 }
 
-char *nick_get( bee_user_t *bu )
+char *nick_get( bee_user_t *bu, char nick[MAX_NICK_LENGTH+1] )
 {
-	static char nick[MAX_NICK_LENGTH+1];
-	char *store_handle, *found_nick;
+	char *found_nick;
 	
 	memset( nick, 0, MAX_NICK_LENGTH + 1 );
 	
-	store_handle = clean_handle( bu->handle );
 	/* Find out if we stored a nick for this person already. If not, try
 	   to generate a sane nick automatically. */
-	if( ( found_nick = g_hash_table_lookup( bu->ic->acc->nicks, store_handle ) ) )
+	if( ( found_nick = g_hash_table_lookup( bu->ic->acc->nicks, bu->handle ) ) )
 	{
 		strncpy( nick, found_nick, MAX_NICK_LENGTH );
 	}
-	else if( ( found_nick = nick_gen( bu ) ) )
+	else if( !nick_gen( bu, nick ) )
 	{
-		strncpy( nick, found_nick, MAX_NICK_LENGTH );
-		g_free( found_nick );
-	}
-	else
-	{
-		/* Keep this fallback since nick_gen() can return NULL in some cases. */
+		/* Keep this fallback since nick_gen() can fail in some cases. */
 		char *s;
 		
 		g_snprintf( nick, MAX_NICK_LENGTH, "%s", bu->handle );
@@ -97,7 +123,6 @@ char *nick_get( bee_user_t *bu )
 		if( set_getbool( &bu->bee->set, "lcnicks" ) )
 			nick_lc( nick );
 	}
-	g_free( store_handle );
 	
 	/* Make sure the nick doesn't collide with an existing one by adding
 	   underscores and that kind of stuff, if necessary. */
@@ -106,21 +131,23 @@ char *nick_get( bee_user_t *bu )
 	return nick;
 }
 
-char *nick_gen( bee_user_t *bu )
+/* Writes the nick into ret (which is MAX_NICK_LENGTH+1 long), returns
+   FALSE if nick_format didn't give us anything useful. */
+gboolean nick_gen( bee_user_t *bu, char *ret )
 {
 	gboolean ok = FALSE; /* Set to true once the nick contains something unique. */
-	GString *ret = g_string_new( "" );
+	int pos = 0;
 	char *fmt = set_getstr( &bu->ic->acc->set, "nick_format" ) ? :
 	            set_getstr( &bu->bee->set, "nick_format" );
 	
-	while( fmt && *fmt && ret->len < MAX_NICK_LENGTH )
+	while( fmt && *fmt && pos < MAX_NICK_LENGTH )
 	{
 		char *part = NULL, chop = '\0', *asc = NULL;
 		int len = MAX_NICK_LENGTH;
 		
 		if( *fmt != '%' )
 		{
-			g_string_append_c( ret, *fmt );
+			ret[pos++] = *fmt;
 			fmt ++;
 			continue;
 		}
@@ -133,10 +160,7 @@ char *nick_gen( bee_user_t *bu )
 			{
 				chop = fmt[1];
 				if( chop == '\0' )
-				{
-					g_string_free( ret, TRUE );
-					return NULL;
-				}
+					return FALSE;
 				fmt += 2;
 			}
 			else if( isdigit( *fmt ) )
@@ -189,48 +213,74 @@ char *nick_gen( bee_user_t *bu )
 			}
 			else
 			{
-				g_string_free( ret, TRUE );
-				return NULL;
+				return FALSE;
 			}
 		}
 		
 		/* Credits to Josay_ in #bitlbee for this idea. //TRANSLIT
 		   should do lossy/approximate conversions, so letters with
 		   accents don't just get stripped. Note that it depends on
-		   LC_CTYPE being set to something other than C/POSIX. */
-		if( part )
+		   LC_CTYPE being set to something other than C/POSIX. Most
+		   handles are plain ASCII already, don't bother iconv then. */
+		if( part && !str_is_ascii( part, strlen( part ) ) )
 			part = asc = g_convert_with_fallback( part, -1, "ASCII//TRANSLIT",
 			                                      "UTF-8", "", NULL, NULL, NULL );
 		
-		if( ret->len == 0 && part && isdigit( *part ) )
-			g_string_append_c( ret, '_' );
+		if( pos == 0 && part && isdigit( *part ) )
+			ret[pos++] = '_';
 		
-		while( part && *part && *part != chop && len > 0 )
+		while( part && *part && *part != chop && len > 0 && pos < MAX_NICK_LENGTH )
 		{
 			if( strchr( nick_lc_chars, *part ) ||
 			    strchr( nick_uc_chars, *part ) )
-				g_string_append_c( ret, *part );
+				ret[pos++] = *part;
 			
 			part ++;
 			len --;
 		}
 		g_free( asc );
 	}
+	ret[pos] = '\0';
 	
-	/* This returns NULL if the nick is empty or otherwise not ok. */
-	return g_string_free( ret, ret->len == 0 || !ok );
+	/* Not ok if the nick is empty or doesn't contain anything unique. */
+	return pos > 0 && ok;
+}
+
+static gboolean nick_taken( irc_t *irc, bee_user_t *bu, const char *nick )
+{
+	irc_user_t *iu = irc_user_by_name( irc, nick );
+	
+	return iu && iu->bu != bu;
 }
 
 void nick_dedupe( bee_user_t *bu, char nick[MAX_NICK_LENGTH+1] )
 {
 	irc_t *irc = (irc_t*) bu->bee->ui_data;
 	int inf_protection = 256;
-	irc_user_t *iu;
+	char key[MAX_NICK_LENGTH+1];
+	int len, hint;
+	
+	if( nick_ok( nick ) && !nick_taken( irc, bu, nick ) )
+		return;
+	
+	/* Some accounts turn lots of handles into the same nick (common
+	   first names, numeric IDs, etc.). irc->nick_suffix remembers how
+	   many underscores the last one of those needed, so we don't have
+	   to try all the shorter ones again every time. */
+	len = strlen( nick );
+	strcpy( key, nick );
+	if( !nick_ok( nick ) || !nick_lc( key ) )
+		*key = '\0';
+	else if( ( hint = GPOINTER_TO_INT( g_hash_table_lookup( irc->nick_suffix, key ) ) ) &&
+	         len + hint < MAX_NICK_LENGTH )
+	{
+		memset( nick + len, '_', hint );
+		nick[len+hint] = '\0';
+	}
 	
 	/* Now, find out if the nick is already in use at the moment, and make
 	   subtle changes to make it unique. */
-	while( !nick_ok( nick ) ||
-	       ( ( iu = irc_user_by_name( irc, nick ) ) && iu->bu != bu ) )
+	while( !nick_ok( nick ) || nick_taken( irc, bu, nick ) )
 	{
 		if( strlen( nick ) < ( MAX_NICK_LENGTH - 1 ) )
 		{
@@ -265,19 +315,47 @@ void nick_dedupe( bee_user_t *bu, char nick[MAX_NICK_LENGTH+1] )
 			break;
 		}
 	}
+	
+	if( *key && strlen( nick ) > len && strspn( nick + len, "_" ) == strlen( nick + len ) )
+		g_hash_table_replace( irc->nick_suffix, g_strdup( key ),
+		                      GINT_TO_POINTER( strlen( nick ) - len ) );
+}
+
+/* Called when a nick goes away (key is the lower-case version). If
+   nick_dedupe() had to add underscores to get it, the next contact that
+   wants the same nick can start with fewer of them again. */
+void nick_release( irc_t *irc, const char *key )
+{
+	char base[MAX_NICK_LENGTH+1];
+	int len = strlen( key ), n = 0;
+	gpointer hint;
+	
+	if( ( irc->status & USTATUS_SHUTDOWN ) || len > MAX_NICK_LENGTH )
+		return;
+	
+	while( n < len && key[len-n-1] == '_' )
+		n ++;
+	if( n == len )
+		return;
+	
+	strncpy( base, key, len - n );
+	base[len-n] = '\0';
+	
+	if( ( hint = g_hash_table_lookup( irc->nick_suffix, base ) ) == NULL ||
+	    GPOINTER_TO_INT( hint ) <= n )
+		return;
+	
+	if( n == 0 )
+		g_hash_table_remove( irc->nick_suffix, base );
+	else
+		g_hash_table_replace( irc->nick_suffix, g_strdup( base ), GINT_TO_POINTER( n ) );
 }
 
 /* Just check if there is a nickname set for this buddy or if we'd have to
    generate one. */
 int nick_saved( bee_user_t *bu )
 {
-	char *store_handle, *found;
-	
-	store_handle = clean_handle( bu->handle );
-	found = g_hash_table_lookup( bu->ic->acc->nicks, store_handle );
-	g_free( store_handle );
-	
-	return found != NULL;
+	return g_hash_table_lookup( bu->ic->acc->nicks, bu->handle ) != NULL;
 }
 
 void nick_del( bee_user_t *bu )
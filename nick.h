@@ -25,9 +25,12 @@
 
 void nick_set_raw( account_t *acc, const char *handle, const char *nick );
 void nick_set( bee_user_t *bu, const char *nick );
-char *nick_get( bee_user_t *bu );
-char *nick_gen( bee_user_t *bu );
+guint nick_handle_hash( gconstpointer key );
+gboolean nick_handle_equal( gconstpointer a, gconstpointer b );
+char *nick_get( bee_user_t *bu, char nick[MAX_NICK_LENGTH+1] );
+gboolean nick_gen( bee_user_t *bu, char *ret );
 void nick_dedupe( bee_user_t *bu, char nick[MAX_NICK_LENGTH+1] );
+void nick_release( irc_t *irc, const char *key );
 int nick_saved( bee_user_t *bu );
 void nick_del( bee_user_t *bu );
 void nick_strip( char *nick );
@@ -1329,7 +1329,7 @@ struct im_connection *check_imc(void *opdata, const char *accountname,
 
 irc_user_t *peeruser(irc_t *irc, const char *handle, const char *protocol)
 {
-	GSList *l;
+	GList *l;
 	
 	for(l=irc->b->users; l; l = l->next) {
 		bee_user_t *bu = l->data;
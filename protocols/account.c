@@ -104,7 +104,7 @@ account_t *account_add( bee_t *bee, struct prpl *prpl, char *user, char *pass )
 	}
 	set_setstr( &a->set, "tag", tag );
 	
-	a->nicks = g_hash_table_new_full( g_str_hash, g_str_equal, g_free, g_free );
+	a->nicks = g_hash_table_new_full( nick_handle_hash, nick_handle_equal, g_free, g_free );
 	
 	/* This function adds some more settings (and might want to do more
 	   things that have to be done now, although I can't think of anything. */
@@ -40,12 +40,14 @@ bee_t *bee_new()
 	s->flags |= SET_NULL_OK | SET_HIDDEN;
 	s = set_add( &b->set, "debug", "false", set_eval_bool, b );
 	s = set_add( &b->set, "mobile_is_away", "false", set_eval_bool, b );
+	s = set_add( &b->set, "presence_delay", "0", set_eval_int, b );
 	s = set_add( &b->set, "save_on_quit", "true", set_eval_bool, b );
 	s = set_add( &b->set, "status", NULL, set_eval_away_status, b );
 	s->flags |= SET_NULL_OK;
 	s = set_add( &b->set, "strip_html", "true", NULL, b );
 	
 	b->user = g_malloc( 1 );
+	b->user_slab = slab_new( "contacts", sizeof( bee_user_t ) );
 	
 	return b;
 }
@@ -73,6 +75,7 @@ void bee_free( bee_t *b )
 	bee_group_free( b );
 	
 	g_free( b->user );
+	slab_destroy( b->user_slab );
 	g_free( b );
 }
 
@@ -35,7 +35,8 @@ typedef struct bee
 	   own settings here. */
 	struct set *set;
 	
-	GSList *users;  /* struct bee_user */
+	GList *users;   /* struct bee_user */
+	struct slab *user_slab; /* And where they're allocated from. */
 	GSList *groups; /* struct bee_group */
 	struct account *accounts; /* TODO(wilmer): Use GSList here too? */
 	
@@ -50,6 +51,10 @@ typedef struct bee
 	/* And this one will be passed to every callback for any state the
 	   UI may want to keep. */
 	void *ui_data;
+	
+	/* Status updates from IM modules, and how many of those never
+	   reached the UI thanks to presence_delay. */
+	guint64 presence_in, presence_absorbed;
 } bee_t;
 
 bee_t *bee_new();
@@ -80,6 +85,8 @@ typedef struct bee_user
 	time_t login_time, idle_time;
 	
 	bee_t *bee;
+	GList *link; /* Our node in bee->users. */
+	struct bee_user *status_old; /* See bee_user_status_changed(). */
 	void *ui_data;
 	void *data; /* Can be used by the IM module. */
 } bee_user_t;
@@ -130,6 +137,11 @@ typedef struct bee_ui_funcs
 	gboolean (*ft_out_start)( struct im_connection *ic, struct file_transfer *ft );
 	void (*ft_close)( struct im_connection *ic, struct file_transfer *ft );
 	void (*ft_finished)( struct im_connection *ic, struct file_transfer *ft );
+	
+	/* See imcb_roster_begin(). Changes to contacts of this connection
+	   in between may be shown to the user in one go at the end. */
+	gboolean (*roster_begin)( bee_t *bee, struct im_connection *ic );
+	gboolean (*roster_end)( bee_t *bee, struct im_connection *ic );
 } bee_ui_funcs_t;
 
 
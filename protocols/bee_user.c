@@ -26,6 +26,20 @@
 #define BITLBEE_CORE
 #include "bitlbee.h"
 
+static void bee_user_status( bee_user_t *bu, int flags, const char *state, const char *message, gboolean now );
+static void bee_user_status_free( bee_user_t *old );
+
+/* Every connection keeps its contacts in a hash table (ic->users), keyed
+   by a normalized version of the handle, so bee_user_by_handle() doesn't
+   have to handle_cmp() its way through the contacts of all accounts. */
+static char *bee_user_key( struct im_connection *ic, const char *handle )
+{
+	if( ic->acc->prpl->handle_normalize )
+		return ic->acc->prpl->handle_normalize( handle );
+	else
+		return g_ascii_strdown( handle, -1 );
+}
+
 bee_user_t *bee_user_new( bee_t *bee, struct im_connection *ic, const char *handle, bee_user_flags_t flags )
 {
 	bee_user_t *bu;
@@ -33,12 +47,14 @@ bee_user_t *bee_user_new( bee_t *bee, struct im_connection *ic, const char *hand
 	if( bee_user_by_handle( bee, ic, handle ) != NULL )
 		return NULL;
 	
-	bu = g_new0( bee_user_t, 1 );
+	bu = slab_alloc( bee->user_slab );
 	bu->bee = bee;
 	bu->ic = ic;
 	bu->flags = flags;
 	bu->handle = g_strdup( handle );
-	bee->users = g_slist_prepend( bee->users, bu );
+	bee->users = g_list_prepend( bee->users, bu );
+	bu->link = bee->users;
+	g_hash_table_insert( ic->users, bee_user_key( ic, handle ), bu );
 	
 	if( bee->ui->user_new )
 		bee->ui->user_new( bee, bu );
@@ -46,13 +62,15 @@ bee_user_t *bee_user_new( bee_t *bee, struct im_connection *ic, const char *hand
 		ic->acc->prpl->buddy_data_add( bu );
 	
 	/* Offline by default. This will set the right flags. */
-	imcb_buddy_status( ic, handle, 0, NULL, NULL );
+	bee_user_status( bu, 0, NULL, NULL, TRUE );
 	
 	return bu;
 }
 
 int bee_user_free( bee_t *bee, bee_user_t *bu )
 {
+	char *key;
+	
 	if( !bu )
 		return 0;
 	
@@ -61,31 +79,42 @@ int bee_user_free( bee_t *bee, bee_user_t *bu )
 	if( bu->ic->acc->prpl->buddy_data_free )
 		bu->ic->acc->prpl->buddy_data_free( bu );
 	
+	key = bee_user_key( bu->ic, bu->handle );
+	g_hash_table_remove( bu->ic->users, key );
+	g_free( key );
+	bee->users = g_list_delete_link( bee->users, bu->link );
+	
+	if( bu->status_old )
+	{
+		bu->ic->status_pending = g_slist_remove( bu->ic->status_pending, bu );
+		if( bu->ic->status_pending == NULL )
+		{
+			b_event_remove( bu->ic->status_timer );
+			bu->ic->status_timer = 0;
+		}
+		bee_user_status_free( bu->status_old );
+	}
+	
 	g_free( bu->handle );
 	g_free( bu->fullname );
 	g_free( bu->nick );
-	g_free( bu->status );
-	g_free( bu->status_msg );
-	g_free( bu );
-	
-	bee->users = g_slist_remove( bee->users, bu );
+	str_unref( bu->status );
+	str_unref( bu->status_msg );
+	slab_free( bu );
 	
 	return 1;
 }
 
 bee_user_t *bee_user_by_handle( bee_t *bee, struct im_connection *ic, const char *handle )
 {
-	GSList *l;
+	bee_user_t *bu;
+	char *key;
 	
-	for( l = bee->users; l; l = l->next )
-	{
-		bee_user_t *bu = l->data;
-		
-		if( bu->ic == ic && ic->acc->prpl->handle_cmp( bu->handle, handle ) == 0 )
-			return bu;
-	}
+	key = bee_user_key( ic, handle );
+	bu = g_hash_table_lookup( ic->users, key );
+	g_free( key );
 	
-	return NULL;
+	return bu;
 }
 
 int bee_user_msg( bee_t *bee, bee_user_t *bu, const char *msg, int flags )
@@ -156,16 +185,148 @@ void bee_group_free( bee_t *bee )
 }
 
 
+/* Some networks send lots of status updates for the same contact in a
+   short time, for example when mobile clients keep reconnecting. With
+   presence_delay set, the state from before the first update is kept and
+   the UI only gets to see the net change once the timer runs out. */
+static gboolean bee_user_str_equal( const char *a, const char *b )
+{
+	return a == b || ( a && b && strcmp( a, b ) == 0 );
+}
+
+/* Status strings are interned, see str_ref(). Lots of contacts have the
+   same away state, and most updates don't change it. */
+static void bee_user_status_str( char **dst, const char *s )
+{
+	if( bee_user_str_equal( *dst, s ) )
+		return;
+	
+	str_unref( *dst );
+	*dst = (char *) str_ref( s );
+}
+
+static void bee_user_status_free( bee_user_t *old )
+{
+	str_unref( old->status );
+	str_unref( old->status_msg );
+	g_free( old );
+}
+
+static gboolean bee_user_status_timeout( gpointer data, gint fd, b_input_condition cond )
+{
+	struct im_connection *ic = data;
+	bee_t *bee = ic->bee;
+	
+	ic->status_timer = 0;
+	
+	while( ic->status_pending )
+	{
+		bee_user_t *bu = ic->status_pending->data, *old = bu->status_old;
+		
+		ic->status_pending = g_slist_delete_link( ic->status_pending, ic->status_pending );
+		bu->status_old = NULL;
+		
+		if( old->flags == bu->flags &&
+		    bee_user_str_equal( old->status, bu->status ) &&
+		    bee_user_str_equal( old->status_msg, bu->status_msg ) )
+			bee->presence_absorbed ++;
+		else if( bee->ui->user_status )
+			bee->ui->user_status( bee, bu, old );
+		
+		bee_user_status_free( old );
+	}
+	
+	return FALSE;
+}
+
+/* Call before changing bu's status. Returns a copy of the current state
+   to compare against, unless an earlier one is still waiting for the
+   timer. */
+static bee_user_t *bee_user_status_save( bee_user_t *bu )
+{
+	bee_user_t *old;
+	
+	if( bu->status_old )
+		return NULL;
+	
+	old = g_memdup( bu, sizeof( bee_user_t ) );
+	old->status = (char *) str_ref( bu->status );
+	old->status_msg = (char *) str_ref( bu->status_msg );
+	
+	return old;
+}
+
+/* And this one after changing it: Either tells the UI right away, or
+   queues bu until the timer goes off. */
+static void bee_user_status_changed( bee_user_t *bu, bee_user_t *old, gboolean now )
+{
+	struct im_connection *ic = bu->ic;
+	bee_t *bee = bu->bee;
+	int delay;
+	
+	bee->presence_in ++;
+	
+	if( old == NULL )
+	{
+		/* Already waiting, the UI will see this one together with
+		   the earlier one(s). */
+		bee->presence_absorbed ++;
+		return;
+	}
+	
+	if( !now && ( delay = set_getint( &bee->set, "presence_delay" ) ) > 0 )
+	{
+		bu->status_old = old;
+		ic->status_pending = g_slist_prepend( ic->status_pending, bu );
+		if( ic->status_timer == 0 )
+			ic->status_timer = b_timeout_add( delay, bee_user_status_timeout, ic );
+		return;
+	}
+	
+	if( bee->ui->user_status )
+		bee->ui->user_status( bee, bu, old );
+	
+	bee_user_status_free( old );
+}
+
+static void bee_user_status( bee_user_t *bu, int flags, const char *state, const char *message, gboolean now )
+{
+	bee_user_t *old = bee_user_status_save( bu );
+	const char *status;
+	
+	/* TODO(wilmer): OPT_AWAY, or just state == NULL ? */
+	bu->flags = flags;
+	if( state && *state )
+		status = state;
+	else if( flags & OPT_AWAY )
+		status = "Away";
+	else
+		status = NULL;
+	
+	if( status == NULL && ( flags & OPT_MOBILE ) &&
+	    set_getbool( &bu->bee->set, "mobile_is_away" ) )
+	{
+		bu->flags |= BEE_USER_AWAY;
+		status = "Mobile";
+	}
+	
+	bee_user_status_str( &bu->status, status );
+	bee_user_status_str( &bu->status_msg, message );
+	
+	bee_user_status_changed( bu, old, now );
+}
+
 /* IM->UI callbacks */
 void imcb_buddy_status( struct im_connection *ic, const char *handle, int flags, const char *state, const char *message )
 {
 	bee_t *bee = ic->bee;
-	bee_user_t *bu, *old;
+	bee_user_t *bu;
 	
 	if( !( bu = bee_user_by_handle( bee, ic, handle ) ) )
 	{
 		if( g_strcasecmp( set_getstr( &ic->bee->set, "handle_unknown" ), "add" ) == 0 )
 		{
+			/* Does its own (immediate) status update. */
 			bu = bee_user_new( bee, ic, handle, BEE_USER_LOCAL );
 		}
 		else
@@ -181,32 +342,7 @@ void imcb_buddy_status( struct im_connection *ic, const char *handle, int flags,
 		}
 	}
 	
-	/* May be nice to give the UI something to compare against. */
-	old = g_memdup( bu, sizeof( bee_user_t ) );
-	
-	/* TODO(wilmer): OPT_AWAY, or just state == NULL ? */
-	bu->flags = flags;
-	bu->status_msg = g_strdup( message );
-	if( state && *state )
-		bu->status = g_strdup( state );
-	else if( flags & OPT_AWAY )
-		bu->status = g_strdup( "Away" );
-	else
-		bu->status = NULL;
-	
-	if( bu->status == NULL && ( flags & OPT_MOBILE ) &&
-	    set_getbool( &bee->set, "mobile_is_away" ) )
-	{
-		bu->flags |= BEE_USER_AWAY;
-		bu->status = g_strdup( "Mobile" );
-	}
-	
-	if( bee->ui->user_status )
-		bee->ui->user_status( bee, bu, old );
-	
-	g_free( old->status_msg );
-	g_free( old->status );
-	g_free( old );
+	bee_user_status( bu, flags, state, message, FALSE );
 }
 
 /* Same, but only change the away/status message, not any away/online state info. */
@@ -220,15 +356,11 @@ void imcb_buddy_status_msg( struct im_connection *ic, const char *handle, const
 		return;
 	}
 	
-	old = g_memdup( bu, sizeof( bee_user_t ) );
-	
-	bu->status_msg = message && *message ? g_strdup( message ) : NULL;
+	old = bee_user_status_save( bu );
 	
-	if( bee->ui->user_status )
-		bee->ui->user_status( bee, bu, old );
+	bee_user_status_str( &bu->status_msg, message && *message ? message : NULL );
 	
-	g_free( old->status_msg );
-	g_free( old );
+	bee_user_status_changed( bu, old, FALSE );
 }
 
 void imcb_buddy_times( struct im_connection *ic, const char *handle, time_t login, time_t idle )
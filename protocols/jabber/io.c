@@ -27,67 +27,101 @@
 static gboolean jabber_write_callback( gpointer data, gint fd, b_input_condition cond );
 static gboolean jabber_write_queue( struct im_connection *ic );
 
-int jabber_write_packet( struct im_connection *ic, struct xt_node *node )
+static void jabber_write_console( struct im_connection *ic, const char *buf )
 {
-	char *buf;
-	int st;
-	
-	buf = xt_to_string( node );
-	st = jabber_write( ic, buf, strlen( buf ) );
-	g_free( buf );
+	char *msg, *s;
 	
-	return st;
+	msg = g_strdup_printf( "TX: %s", buf );
+	/* Don't include auth info in XML logs. */
+	if( strncmp( msg, "TX: <auth ", 10 ) == 0 && ( s = strchr( msg, '>' ) ) )
+	{
+		s++;
+		while( *s && *s != '<' )
+			*(s++) = '*';
+	}
+	imcb_buddy_msg( ic, JABBER_XMLCONSOLE_HANDLE, msg, 0, 0 );
+	g_free( msg );
 }
 
-int jabber_write( struct im_connection *ic, char *buf, int len )
+/* Whatever's in jd->txq now gets sent. If the queue was empty before, try
+   if we can write it immediately so we don't have to do it via the event
+   handler. If not, add the handler. (In most cases it probably won't be
+   necessary.) */
+int jabber_write_start( struct im_connection *ic, gboolean was_empty )
 {
 	struct jabber_data *jd = ic->proto_data;
 	gboolean ret;
 	
+	if( was_empty )
+	{
+		if( ( ret = jabber_write_queue( ic ) ) && jd->txq->len > 0 )
+			jd->w_inpa = b_input_add( jd->fd, B_EV_IO_WRITE, jabber_write_callback, ic );
+	}
+	else
+	{
+		/* The event handler is already set. The return value for
+		   write() doesn't necessarily mean that everything got sent,
+		   it mainly means that the connection (officially) still
+		   exists and can still be accessed without hitting SIGSEGV.
+		   IOW: */
+		ret = TRUE;
+	}
+	
+	return ret;
+}
+
+int jabber_write_packet( struct im_connection *ic, struct xt_node *node )
+{
+	struct jabber_data *jd = ic->proto_data;
+	gboolean was_empty = jd->txq->len == 0;
+	
 	if( jd->flags & JFLAG_XMLCONSOLE && !( ic->flags & OPT_LOGGING_OUT ) )
 	{
-		char *msg, *s;
+		char *buf = xt_to_string( node );
 		
-		msg = g_strdup_printf( "TX: %s", buf );
-		/* Don't include auth info in XML logs. */
-		if( strncmp( msg, "TX: <auth ", 10 ) == 0 && ( s = strchr( msg, '>' ) ) )
-		{
-			s++;
-			while( *s && *s != '<' )
-				*(s++) = '*';
-		}
-		imcb_buddy_msg( ic, JABBER_XMLCONSOLE_HANDLE, msg, 0, 0 );
-		g_free( msg );
+		jabber_write_console( ic, buf );
+		g_free( buf );
 	}
 	
-	if( jd->tx_len == 0 )
+	if( ( jd->flags & JFLAG_SM_ENABLED ) && sm_is_stanza( node ) )
 	{
-		/* If the queue is empty, allocate a new buffer. */
-		jd->tx_len = len;
-		jd->txq = g_memdup( buf, len );
+		/* Keep a copy until the server confirms it got it. While
+		   we're trying to resume the session, that's all for now. */
+		gsize off = sm_queue( ic, node );
 		
-		/* Try if we can write it immediately so we don't have to do
-		   it via the event handler. If not, add the handler. (In
-		   most cases it probably won't be necessary.) */
-		if( ( ret = jabber_write_queue( ic ) ) && jd->tx_len > 0 )
-			jd->w_inpa = b_input_add( jd->fd, B_EV_IO_WRITE, jabber_write_callback, ic );
+		if( jd->flags & JFLAG_SM_RESUMING )
+			return TRUE;
+		
+		iobuf_append_from( jd->txq, jd->sm_unacked, off );
+		return jabber_write_start( ic, was_empty ) &&
+		       sm_request( ic, JABBER_SM_REQ_EVERY );
 	}
-	else
+	else if( jd->xt == NULL )
 	{
-		/* Just add it to the buffer if it's already filled. The
-		   event handler is already set. */
-		jd->txq = g_renew( char, jd->txq, jd->tx_len + len );
-		memcpy( jd->txq + jd->tx_len, buf, len );
-		jd->tx_len += len;
-		
-		/* The return value for write() doesn't necessarily mean
-		   that everything got sent, it mainly means that the
-		   connection (officially) still exists and can still
-		   be accessed without hitting SIGSEGV. IOW: */
-		ret = TRUE;
+		/* Lost the connection, anything but stanzas is useless now. */
+		return TRUE;
 	}
 	
-	return ret;
+	/* Serialize straight into the queue. */
+	xt_to_iobuf( node, jd->txq );
+	
+	return jabber_write_start( ic, was_empty );
+}
+
+int jabber_write( struct im_connection *ic, char *buf, int len )
+{
+	struct jabber_data *jd = ic->proto_data;
+	gboolean was_empty = jd->txq->len == 0;
+	
+	if( jd->flags & JFLAG_XMLCONSOLE && !( ic->flags & OPT_LOGGING_OUT ) )
+		jabber_write_console( ic, buf );
+	
+	if( jd->xt == NULL )
+		return TRUE;
+	
+	iobuf_append( jd->txq, buf, len );
+	
+	return jabber_write_start( ic, was_empty );
 }
 
 /* Splitting up in two separate functions: One to use as a callback and one
@@ -104,30 +138,46 @@ static gboolean jabber_write_callback( gpointer data, gint fd, b_input_condition
 	
 	return jd->fd != -1 &&
 	       jabber_write_queue( data ) &&
-	       jd->tx_len > 0;
+	       jd->txq->len > 0;
 }
 
 static gboolean jabber_write_queue( struct im_connection *ic )
 {
 	struct jabber_data *jd = ic->proto_data;
-	int st;
+	gssize st = 0;
 	
 	if( jd->ssl )
-		st = ssl_write( jd->ssl, jd->txq, jd->tx_len );
+	{
+		char *head;
+		gsize len;
+		
+		/* One chunk at a time, until one of them doesn't go out
+		   completely. */
+		while( ( head = iobuf_head( jd->txq, &len ) ) )
+		{
+			if( ( st = ssl_write( jd->ssl, head, len ) ) > 0 )
+				iobuf_drop( jd->txq, st );
+			if( st != (gssize) len )
+				break;
+		}
+	}
 	else
-		st = write( jd->fd, jd->txq, jd->tx_len );
+	{
+		st = iobuf_writev( jd->txq, jd->fd );
+	}
 	
-	if( st == jd->tx_len )
+	if( jd->txq->len == 0 )
 	{
-		/* We wrote everything, clear the buffer. */
-		g_free( jd->txq );
-		jd->txq = NULL;
-		jd->tx_len = 0;
-		
+		/* We wrote everything. */
 		return TRUE;
 	}
 	else if( st == 0 || ( st < 0 && !ssl_sockerr_again( jd->ssl ) ) )
 	{
+		/* If we can resume the session later, everything that
+		   matters will be sent again. */
+		if( sm_lost( ic ) )
+			return TRUE;
+		
 		/* Set fd to -1 to make sure we won't write to it anymore. */
 		closesocket( jd->fd );	/* Shouldn't be necessary after errors? */
 		jd->fd = -1;
@@ -136,21 +186,10 @@ static gboolean jabber_write_queue( struct im_connection *ic )
 		imc_logout( ic, TRUE );
 		return FALSE;
 	}
-	else if( st > 0 )
-	{
-		char *s;
-		
-		s = g_memdup( jd->txq + st, jd->tx_len - st );
-		jd->tx_len -= st;
-		g_free( jd->txq );
-		jd->txq = s;
-		
-		return TRUE;
-	}
 	else
 	{
-		/* Just in case we had EINPROGRESS/EAGAIN: */
-		
+		/* Partial write, or EINPROGRESS/EAGAIN. The rest will go
+		   when the socket is ready again. */
 		return TRUE;
 	}
 }
@@ -159,29 +198,47 @@ static gboolean jabber_read_callback( gpointer data, gint fd, b_input_condition
 {
 	struct im_connection *ic = data;
 	struct jabber_data *jd = ic->proto_data;
-	char buf[512];
+	iobuf_t *rx;
 	int st;
 	
 	if( jd->fd == -1 )
 		return FALSE;
 	
-	if( jd->ssl )
-		st = ssl_read( jd->ssl, buf, sizeof( buf ) );
-	else
-		st = read( jd->fd, buf, sizeof( buf ) );
+	st = iobuf_read( jd->rxq, jd->fd, jd->ssl, ic->acc->prpl->read_budget );
 	
 	if( st > 0 )
 	{
-		/* Parse. */
-		if( xt_feed( jd->xt, buf, st ) < 0 )
+		/* The handlers may log us out (and free jd) while we're
+		   still feeding, so take the buffer away from jd for now. */
+		rx = jd->rxq;
+		jd->rxq = NULL;
+		
+		/* Parse, this also executes the handlers for (and frees)
+		   every stanza that's complete. */
+		while( rx->len > 0 && st > 0 )
+		{
+			gsize len;
+			char *s = iobuf_head( rx, &len );
+			
+			st = xt_feed( jd->xt, s, len );
+			iobuf_drop( rx, len );
+		}
+		
+		if( g_slist_find( jabber_connections, ic ) == NULL )
+		{
+			iobuf_free( rx );
+			return FALSE;
+		}
+		iobuf_clear( rx );
+		jd->rxq = rx;
+		
+		if( st < 0 )
 		{
 			imcb_error( ic, "XML stream error" );
 			imc_logout( ic, TRUE );
 			return FALSE;
 		}
-		
-		/* Execute all handlers. */
-		if( !xt_handle( jd->xt, NULL, 1 ) )
+		else if( st == 0 )
 		{
 			/* Don't do anything, the handlers should have
 			   aborted the connection already. */
@@ -194,9 +251,6 @@ static gboolean jabber_read_callback( gpointer data, gint fd, b_input_condition
 			jabber_start_stream( ic );
 		}
 		
-		/* Garbage collection. */
-		xt_cleanup( jd->xt, NULL, 1 );
-		
 		/* This is a bit hackish, unfortunately. Although xmltree
 		   has nifty event handler stuff, it only calls handlers
 		   when nodes are complete. Since the server should only
@@ -239,6 +293,9 @@ static gboolean jabber_read_callback( gpointer data, gint fd, b_input_condition
 	}
 	else if( st == 0 || ( st < 0 && !ssl_sockerr_again( jd->ssl ) ) )
 	{
+		if( sm_lost( ic ) )
+			return FALSE;
+		
 		closesocket( jd->fd );
 		jd->fd = -1;
 		
@@ -247,22 +304,19 @@ static gboolean jabber_read_callback( gpointer data, gint fd, b_input_condition
 		return FALSE;
 	}
 	
-	if( ssl_pending( jd->ssl ) )
-		/* OpenSSL empties the TCP buffers completely but may keep some
-		   data in its internap buffers. select() won't see that, but
-		   ssl_pending() does. */
-		return jabber_read_callback( data, fd, cond );
-	else
-		return TRUE;
+	return TRUE;
 }
 
 gboolean jabber_connected_plain( gpointer data, gint source, b_input_condition cond )
 {
 	struct im_connection *ic = data;
+	struct jabber_data *jd;
 	
 	if( g_slist_find( jabber_connections, ic ) == NULL )
 		return FALSE;
 	
+	jd = ic->proto_data;
+	
 	if( source == -1 )
 	{
 		imcb_error( ic, "Could not connect to server" );
@@ -270,7 +324,9 @@ gboolean jabber_connected_plain( gpointer data, gint source, b_input_condition c
 		return FALSE;
 	}
 	
-	imcb_log( ic, "Connected to server, logging in" );
+	/* Resuming a session is supposed to go unnoticed. */
+	if( !( jd->flags & JFLAG_SM_RESUMING ) )
+		imcb_log( ic, "Connected to server, logging in" );
 	
 	return jabber_start_stream( ic );
 }
@@ -308,7 +364,9 @@ gboolean jabber_connected_ssl( gpointer data, int returncode, void *source, b_in
 		return FALSE;
 	}
 	
-	imcb_log( ic, "Connected to server, logging in" );
+	/* Resuming a session is supposed to go unnoticed. */
+	if( !( jd->flags & JFLAG_SM_RESUMING ) )
+		imcb_log( ic, "Connected to server, logging in" );
 	
 	return jabber_start_stream( ic );
 }
@@ -398,7 +456,14 @@ static xt_status jabber_pkt_features( struct xt_node *node, gpointer data )
 	if( ( c = xt_find_node( node->children, "session" ) ) )
 		jd->flags |= JFLAG_WANT_SESSION;
 	
-	if( jd->flags & JFLAG_AUTHENTICATED )
+	if( sm_supported( node ) )
+		jd->flags |= JFLAG_SM_SUPPORTED;
+	
+	/* Reconnecting after losing the connection? Then don't bind to a
+	   resource but take over the old session. */
+	if( ( jd->flags & JFLAG_AUTHENTICATED ) && ( jd->flags & JFLAG_SM_RESUMING ) )
+		return sm_resume( ic, jd->flags & JFLAG_SM_SUPPORTED ) ? XT_HANDLED : XT_ABORT;
+	else if( jd->flags & JFLAG_AUTHENTICATED )
 		return jabber_pkt_bind_sess( ic, NULL, NULL );
 	
 	return XT_HANDLED;
@@ -420,18 +485,17 @@ static xt_status jabber_pkt_proceed_tls( struct xt_node *node, gpointer data )
 	/* We don't want event handlers to touch our TLS session while it's
 	   still initializing! */
 	b_event_remove( jd->r_inpa );
-	if( jd->tx_len > 0 )
+	if( jd->txq->len > 0 )
 	{
 		/* Actually the write queue should be empty here, but just
 		   to be sure... */
 		b_event_remove( jd->w_inpa );
-		g_free( jd->txq );
-		jd->txq = NULL;
-		jd->tx_len = 0;
+		iobuf_clear( jd->txq );
 	}
 	jd->w_inpa = jd->r_inpa = 0;
 	
-	imcb_log( ic, "Converting stream to TLS" );
+	if( !( jd->flags & JFLAG_SM_RESUMING ) )
+		imcb_log( ic, "Converting stream to TLS" );
 	
 	jd->flags |= JFLAG_STARTTLS_DONE;
 
@@ -538,6 +602,7 @@ static xt_status jabber_xmlconsole( struct xt_node *node, gpointer data )
 
 static const struct xt_handler_entry jabber_handlers[] = {
 	{ NULL,                 "stream:stream",        jabber_xmlconsole },
+	{ NULL,                 "stream:stream",        sm_count },
 	{ "stream:stream",      "<root>",               jabber_end_of_stream },
 	{ "message",            "stream:stream",        jabber_pkt_message },
 	{ "presence",           "stream:stream",        jabber_pkt_presence },
@@ -548,6 +613,11 @@ static const struct xt_handler_entry jabber_handlers[] = {
 	{ "challenge",          "stream:stream",        sasl_pkt_challenge },
 	{ "success",            "stream:stream",        sasl_pkt_result },
 	{ "failure",            "stream:stream",        sasl_pkt_result },
+	{ "enabled",            "stream:stream",        sm_pkt_enabled },
+	{ "resumed",            "stream:stream",        sm_pkt_resumed },
+	{ "failed",             "stream:stream",        sm_pkt_failed },
+	{ "r",                  "stream:stream",        sm_pkt_r },
+	{ "a",                  "stream:stream",        sm_pkt_a },
 	{ NULL,                 NULL,                   NULL }
 };
 
@@ -560,7 +630,7 @@ gboolean jabber_start_stream( struct im_connection *ic )
 	/* We'll start our stream now, so prepare everything to receive one
 	   from the server too. */
 	xt_free( jd->xt );	/* In case we're RE-starting. */
-	jd->xt = xt_new( jabber_handlers, ic );
+	jd->xt = xt_new_stream( jabber_handlers, ic );
 	
 	if( jd->r_inpa <= 0 )
 		jd->r_inpa = b_input_add( jd->fd, B_EV_IO_READ, jabber_read_callback, ic );
@@ -583,7 +653,7 @@ void jabber_end_stream( struct im_connection *ic )
 	
 	/* Let's only do this if the queue is currently empty, otherwise it'd
 	   take too long anyway. */
-	if( jd->tx_len == 0 )
+	if( jd->txq->len == 0 )
 	{
 		char eos[] = "</stream:stream>";
 		struct xt_node *node;
@@ -236,6 +236,10 @@ int jabber_init_iq_auth( struct im_connection *ic )
 	struct xt_node *node;
 	int st;
 	
+	/* No stream features, so no way to resume the session we lost. */
+	if( jd->flags & JFLAG_SM_RESUMING )
+		return sm_resume( ic, FALSE );
+	
 	node = xt_new_node( "query", NULL, xt_new_node( "username", jd->username, NULL ) );
 	xt_add_attr( node, "xmlns", XMLNS_AUTH );
 	node = jabber_make_packet( "iq", "get", NULL, node );
@@ -392,6 +396,8 @@ xt_status jabber_pkt_bind_sess( struct im_connection *ic, struct xt_node *node,
 	}
 	else if( ( jd->flags & ( JFLAG_WANT_BIND | JFLAG_WANT_SESSION ) ) == 0 )
 	{
+		if( !sm_enable( ic ) )
+			return XT_ABORT;
 		if( !jabber_get_roster( ic ) )
 			return XT_ABORT;
 		if( !jabber_iq_disco_server( ic ) )
@@ -429,6 +435,8 @@ static xt_status jabber_parse_roster( struct im_connection *ic, struct xt_node *
 		return XT_HANDLED;
 	}
 	
+	imcb_roster_begin( ic );
+	
 	c = query->children;
 	while( ( c = xt_find_node( c, "item" ) ) )
 	{
@@ -457,6 +465,8 @@ static xt_status jabber_parse_roster( struct im_connection *ic, struct xt_node *
 		c = c->next;
 	}
 	
+	imcb_roster_end( ic );
+	
 	if( initial )
 		imcb_connected( ic );
 	
@@ -84,6 +84,9 @@ static void jabber_init( account_t *acc )
 	s = set_add( &acc->set, "ssl", "false", set_eval_bool, acc );
 	s->flags |= ACC_SET_OFFLINE_ONLY;
 	
+	s = set_add( &acc->set, "stream_management", "true", set_eval_bool, acc );
+	s->flags |= ACC_SET_OFFLINE_ONLY;
+	
 	s = set_add( &acc->set, "tls", "try", set_eval_tls, acc );
 	s->flags |= ACC_SET_OFFLINE_ONLY;
 	
@@ -112,6 +115,8 @@ static void jabber_login( account_t *acc )
 	jabber_connections = g_slist_prepend( jabber_connections, ic );
 	
 	jd->ic = ic;
+	jd->rxq = iobuf_new();
+	jd->txq = iobuf_new();
 	ic->proto_data = jd;
 	
 	jabber_set_me( ic, acc->user );
@@ -222,24 +227,22 @@ void jabber_connect( struct im_connection *ic )
 	{
 		imcb_log( ic, "Illegal port number" );
 		imc_logout( ic, FALSE );
+		srv_free( srvl );
 		return;
 	}
 	
 	/* For non-SSL connections we can try to use the port # from the SRV
 	   reply, but let's not do that when using SSL, SSL usually runs on
 	   non-standard ports... */
-	if( set_getbool( &acc->set, "ssl" ) )
-	{
-		jd->ssl = ssl_connect( connect_to, set_getint( &acc->set, "port" ), set_getbool( &acc->set, "tls_verify" ), jabber_connected_ssl, ic );
-		jd->fd = jd->ssl ? ssl_getfd( jd->ssl ) : -1;
-	}
+	g_free( jd->connect_to );
+	jd->connect_to = g_strdup( connect_to );
+	if( srv && !set_getbool( &acc->set, "ssl" ) )
+		jd->connect_port = srv->port;
 	else
-	{
-		jd->fd = proxy_connect( connect_to, srv ? srv->port : set_getint( &acc->set, "port" ), jabber_connected_plain, ic );
-	}
+		jd->connect_port = set_getint( &acc->set, "port" );
 	srv_free( srvl );
 	
-	if( jd->fd == -1 )
+	if( !jabber_connect_start( ic ) )
 	{
 		imcb_error( ic, "Could not connect to server" );
 		imc_logout( ic, TRUE );
@@ -258,6 +261,27 @@ void jabber_connect( struct im_connection *ic )
 	jabber_generate_id_hash( jd );
 }
 
+/* Opens a connection to the host jabber_connect() picked. Used again
+   (without any blocking SRV lookups) to resume a session, see sm.c.
+   Returns FALSE if that failed right away. */
+gboolean jabber_connect_start( struct im_connection *ic )
+{
+	struct jabber_data *jd = ic->proto_data;
+	account_t *acc = ic->acc;
+	
+	if( set_getbool( &acc->set, "ssl" ) )
+	{
+		jd->ssl = ssl_connect( jd->connect_to, jd->connect_port, set_getbool( &acc->set, "tls_verify" ), jabber_connected_ssl, ic );
+		jd->fd = jd->ssl ? ssl_getfd( jd->ssl ) : -1;
+	}
+	else
+	{
+		jd->fd = proxy_connect( jd->connect_to, jd->connect_port, jabber_connected_plain, ic );
+	}
+	
+	return jd->fd != -1;
+}
+
 /* This generates an unfinished md5_state_t variable. Every time we generate
    an ID, we finish the state by adding a sequence number and take the hash. */
 static void jabber_generate_id_hash( struct jabber_data *jd )
@@ -306,8 +330,9 @@ static void jabber_logout( struct im_connection *ic )
 	if( jd->fd >= 0 )
 		closesocket( jd->fd );
 	
-	if( jd->tx_len )
-		g_free( jd->txq );
+	iobuf_free( jd->rxq );
+	iobuf_free( jd->txq );
+	sm_free( ic );
 	
 	if( jd->node_cache )
 		g_hash_table_destroy( jd->node_cache );
@@ -319,6 +344,7 @@ static void jabber_logout( struct im_connection *ic )
 	g_free( jd->oauth2_access_token );
 	g_free( jd->away_message );
 	g_free( jd->username );
+	g_free( jd->connect_to );
 	g_free( jd->me );
 	g_free( jd );
 	
@@ -529,6 +555,10 @@ static void jabber_keepalive( struct im_connection *ic )
 	if( !jabber_write( ic, "\n", 1 ) )
 		return;
 	
+	/* Don't let unconfirmed stanzas pile up when it's quiet. */
+	if( !sm_request( ic, 1 ) )
+		return;
+	
 	/* This runs the garbage collection every minute, which means every packet
 	   is in the cache for about a minute (which should be enough AFAIK). */
 	jabber_cache_clean( ic );
@@ -46,6 +46,10 @@ typedef enum
 	                                   activates all XEP-85 related code. */
 	JFLAG_XMLCONSOLE = 64,          /* If the user added an xmlconsole buddy. */
 	JFLAG_STARTTLS_DONE = 128,      /* If a plaintext session was converted to TLS. */
+	JFLAG_SM_SUPPORTED = 256,       /* Server offers XEP-0198 stream management. */
+	JFLAG_SM_ENABLED = 512,         /* We asked for it, so now we count stanzas. */
+	JFLAG_SM_RESUMING = 1024,       /* Lost the connection, trying to resume the
+	                                   session. Stanzas only get queued meanwhile. */
 
 	JFLAG_GTALK =  0x100000,        /* Is Google Talk, as confirmed by iq discovery */
 
@@ -86,8 +90,7 @@ struct jabber_data
 	
 	int fd;
 	void *ssl;
-	char *txq;
-	int tx_len;
+	iobuf_t *rxq, *txq;
 	int r_inpa, w_inpa;
 	
 	struct xt_parser *xt;
@@ -96,6 +99,8 @@ struct jabber_data
 	char *username;		/* USERNAME@server */
 	char *server;		/* username@SERVER -=> server/domain, not hostname */
 	char *me;		/* bare jid */
+	char *connect_to;	/* Host/port we really connect to, after SRV lookups. */
+	int connect_port;
 	
 	const struct oauth2_service *oauth2_service;
 	char *oauth2_access_token;
@@ -112,6 +117,15 @@ struct jabber_data
 	GSList *filetransfers;
 	GSList *streamhosts;
 	int have_streamhosts;
+	
+	/* XEP-0198 stream management. */
+	char *sm_id;            /* Session ID for resuming, if allowed. */
+	int sm_max;             /* Seconds we may take to come back. */
+	guint32 sm_in;          /* Stanzas received. */
+	guint32 sm_acked;       /* Stanzas the server confirmed. */
+	iobuf_t *sm_unacked;    /* Copies of stanzas that weren't confirmed yet, */
+	GQueue *sm_lens;        /* and the length of each of them. */
+	int sm_timer;
 };
 
 struct jabber_away_state
@@ -211,6 +225,11 @@ struct jabber_transfer
    them. This gc is done on every keepalive (every minute). */
 #define JABBER_CACHE_MAX_AGE 600
 
+/* XEP-0198: Ask the server for an ack after this many unconfirmed stanzas,
+   and don't wait longer than this many seconds to resume a session. */
+#define JABBER_SM_REQ_EVERY 8
+#define JABBER_SM_TIMEOUT 120
+
 /* RFC 392[01] stuff */
 #define XMLNS_TLS          "urn:ietf:params:xml:ns:xmpp-tls"
 #define XMLNS_SASL         "urn:ietf:params:xml:ns:xmpp-sasl"
@@ -241,9 +260,11 @@ struct jabber_transfer
 #define XMLNS_FILETRANSFER "http://jabber.org/protocol/si/profile/file-transfer" /* XEP-0096 */
 #define XMLNS_BYTESTREAMS  "http://jabber.org/protocol/bytestreams"              /* XEP-0065 */
 #define XMLNS_IBB          "http://jabber.org/protocol/ibb"                      /* XEP-0047 */
+#define XMLNS_SM           "urn:xmpp:sm:3"                                       /* XEP-0198 */
 
 /* jabber.c */
 void jabber_connect( struct im_connection *ic );
+gboolean jabber_connect_start( struct im_connection *ic );
 
 /* iq.c */
 xt_status jabber_pkt_iq( struct xt_node *node, gpointer data );
@@ -320,6 +341,7 @@ extern const struct jabber_away_state jabber_away_state_list[];
 /* io.c */
 int jabber_write_packet( struct im_connection *ic, struct xt_node *node );
 int jabber_write( struct im_connection *ic, char *buf, int len );
+int jabber_write_start( struct im_connection *ic, gboolean was_empty );
 gboolean jabber_connected_plain( gpointer data, gint source, b_input_condition cond );
 gboolean jabber_connected_ssl( gpointer data, int returncode, void *source, b_input_condition cond );
 gboolean jabber_start_stream( struct im_connection *ic );
@@ -338,6 +360,22 @@ extern const struct oauth2_service oauth2_service_google;
 extern const struct oauth2_service oauth2_service_facebook;
 extern const struct oauth2_service oauth2_service_mslive;
 
+/* sm.c */
+gboolean sm_is_stanza( struct xt_node *node );
+gboolean sm_supported( struct xt_node *features );
+int sm_enable( struct im_connection *ic );
+int sm_resume( struct im_connection *ic, gboolean supported );
+gsize sm_queue( struct im_connection *ic, struct xt_node *node );
+int sm_request( struct im_connection *ic, int every );
+gboolean sm_lost( struct im_connection *ic );
+void sm_free( struct im_connection *ic );
+xt_status sm_count( struct xt_node *node, gpointer data );
+xt_status sm_pkt_enabled( struct xt_node *node, gpointer data );
+xt_status sm_pkt_resumed( struct xt_node *node, gpointer data );
+xt_status sm_pkt_failed( struct xt_node *node, gpointer data );
+xt_status sm_pkt_r( struct xt_node *node, gpointer data );
+xt_status sm_pkt_a( struct xt_node *node, gpointer data );
+
 /* conference.c */
 struct groupchat *jabber_chat_join( struct im_connection *ic, const char *room, const char *nick, const char *password );
 struct groupchat *jabber_chat_with( struct im_connection *ic, char *who );
@@ -45,6 +45,7 @@ struct bs_transfer {
 	char *pseudoadr;
 
 	gint connect_timeout;
+	gint dns_id;
 	
 	char peek_buf[64];
 	int peek_buf_len;
@@ -99,6 +100,7 @@ gboolean jabber_bs_recv_read( gpointer data, gint fd, b_input_condition cond );
 gboolean jabber_bs_recv_write_request( file_transfer_t *ft );
 gboolean jabber_bs_recv_handshake( gpointer data, gint fd, b_input_condition cond );
 gboolean jabber_bs_recv_handshake_abort( struct bs_transfer *bt, char *error );
+void jabber_bs_recv_resolved( gpointer data, struct addrinfo *rp, int error );
 int jabber_bs_recv_request( struct im_connection *ic, struct xt_node *node, struct xt_node *qnode );
 
 gboolean jabber_bs_send_handshake_abort( struct bs_transfer *bt, char *error );
@@ -121,6 +123,8 @@ void jabber_bs_free_transfer( file_transfer_t *ft) {
 		bt->connect_timeout = 0;
 	}
 
+	dns_cancel( bt->dns_id );
+
 	if ( tf->watch_in )
 		b_event_remove( tf->watch_in );
 	
@@ -374,7 +378,6 @@ gboolean jabber_bs_recv_handshake( gpointer data, gint fd, b_input_condition con
 
 	struct bs_transfer *bt = data;
 	short revents;
-	int gret;
 
 	if ( ( fd != -1 ) && !jabber_bs_poll( bt, fd, &revents ) )
 		return FALSE;
@@ -383,34 +386,13 @@ gboolean jabber_bs_recv_handshake( gpointer data, gint fd, b_input_condition con
 	{
 	case BS_PHASE_CONNECT:
 		{
-			struct addrinfo hints, *rp;
-
-			memset( &hints, 0, sizeof( struct addrinfo ) );
-			hints.ai_socktype = SOCK_STREAM;
-
-			if ( ( gret = getaddrinfo( bt->sh->host, bt->sh->port, &hints, &rp ) ) != 0 )
-				return jabber_bs_abort( bt, "getaddrinfo() failed: %s", gai_strerror( gret ) );
+			gint id;
 
-			ASSERTSOCKOP( bt->tf->fd = fd = socket( rp->ai_family, rp->ai_socktype, 0 ), "Opening socket" );
-
-			sock_make_nonblocking( fd );
+			/* Continues in jabber_bs_recv_resolved(), which might
+			   have happened (and freed bt) already when this returns. */
+			if( ( id = dns_lookup( bt->sh->host, atoi( bt->sh->port ), AF_UNSPEC, jabber_bs_recv_resolved, bt ) ) )
+				bt->dns_id = id;
 
-			imcb_log( bt->tf->ic, "File %s: Connecting to streamhost %s:%s", bt->tf->ft->file_name, bt->sh->host, bt->sh->port );
-
-			if( ( connect( fd, rp->ai_addr, rp->ai_addrlen ) == -1 ) &&
-			    ( errno != EINPROGRESS ) )
-				return jabber_bs_abort( bt , "connect() failed: %s", strerror( errno ) );
-
-			freeaddrinfo( rp );
-
-			bt->phase = BS_PHASE_CONNECTED;
-			
-			bt->tf->watch_out = b_input_add( fd, B_EV_IO_WRITE, jabber_bs_recv_handshake, bt );
-
-			/* since it takes forever(3mins?) till connect() fails on itself we schedule a timeout */
-			bt->connect_timeout = b_timeout_add( JABBER_BS_CONTIMEOUT * 1000, jabber_bs_connect_timeout, bt );
-
-			bt->tf->watch_in = 0;
 			return FALSE;
 		}
 	case BS_PHASE_CONNECTED:
@@ -532,6 +514,51 @@ gboolean jabber_bs_recv_handshake( gpointer data, gint fd, b_input_condition con
  * per streamhost should be kept short. If one or two firewalled adresses are specified,
  * they have to timeout first before a proxy is tried.
  */
+void jabber_bs_recv_resolved( gpointer data, struct addrinfo *rp, int error )
+{
+	struct bs_transfer *bt = data;
+	int fd;
+
+	bt->dns_id = 0;
+
+	if( rp == NULL )
+	{
+		jabber_bs_abort( bt, "getaddrinfo() failed: %s", gai_strerror( error ) );
+		return;
+	}
+
+	bt->tf->fd = fd = socket( rp->ai_family, rp->ai_socktype, 0 );
+	if( fd == -1 )
+	{
+		dns_free( rp );
+		jabber_bs_abort( bt, "Opening socket: %s", strerror( errno ) );
+		return;
+	}
+
+	sock_make_nonblocking( fd );
+
+	imcb_log( bt->tf->ic, "File %s: Connecting to streamhost %s:%s", bt->tf->ft->file_name, bt->sh->host, bt->sh->port );
+
+	if( ( connect( fd, rp->ai_addr, rp->ai_addrlen ) == -1 ) &&
+	    ( errno != EINPROGRESS ) )
+	{
+		dns_free( rp );
+		jabber_bs_abort( bt , "connect() failed: %s", strerror( errno ) );
+		return;
+	}
+
+	dns_free( rp );
+
+	bt->phase = BS_PHASE_CONNECTED;
+	
+	bt->tf->watch_out = b_input_add( fd, B_EV_IO_WRITE, jabber_bs_recv_handshake, bt );
+
+	/* since it takes forever(3mins?) till connect() fails on itself we schedule a timeout */
+	bt->connect_timeout = b_timeout_add( JABBER_BS_CONTIMEOUT * 1000, jabber_bs_connect_timeout, bt );
+
+	bt->tf->watch_in = 0;
+}
+
 gboolean jabber_bs_recv_handshake_abort( struct bs_transfer *bt, char *error )
 {
 	struct jabber_transfer *tf = bt->tf;
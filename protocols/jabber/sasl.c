@@ -432,7 +432,8 @@ xt_status sasl_pkt_result( struct xt_node *node, gpointer data )
 	
 	if( strcmp( node->name, "success" ) == 0 )
 	{
-		imcb_log( ic, "Authentication finished" );
+		if( !( jd->flags & JFLAG_SM_RESUMING ) )
+			imcb_log( ic, "Authentication finished" );
 		jd->flags |= JFLAG_AUTHENTICATED | JFLAG_STREAM_RESTART;
 	}
 	else if( strcmp( node->name, "failure" ) == 0 )
@@ -0,0 +1,390 @@
+/***************************************************************************\
+*                                                                           *
+*  BitlBee - An IRC to IM gateway                                           *
+*  Jabber module - XEP-0198 stream management                               *
+*                                                                           *
+*  Copyright 2006-2012 Wilmer van der Gaast <wilmer@gaast.net>              *
+*                                                                           *
+*  This program is free software; you can redistribute it and/or modify     *
+*  it under the terms of the GNU General Public License as published by     *
+*  the Free Software Foundation; either version 2 of the License, or        *
+*  (at your option) any later version.                                      *
+*                                                                           *
+*  This program is distributed in the hope that it will be useful,          *
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+*  GNU General Public License for more details.                             *
+*                                                                           *
+*  You should have received a copy of the GNU General Public License along  *
+*  with this program; if not, write to the Free Software Foundation, Inc.,  *
+*  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.              *
+*                                                                           *
+\***************************************************************************/
+
+/* Both sides count the stanzas they receive and tell each other about it
+   once in a while. We keep a copy of everything we sent until the server
+   confirms it. If the TCP connection dies, we can then log in again and
+   <resume/> the old session instead of starting a new one: the server
+   tells us what it got and re-sends what we missed, and we re-send what
+   it missed. The user (and the IRC side) doesn't notice a thing, no need
+   to fetch the whole roster and all presence information again. */
+
+#include "jabber.h"
+#include "ssl_client.h"
+
+static gboolean sm_reconnect( gpointer data, gint fd, b_input_condition cond );
+static gboolean sm_give_up( gpointer data, gint fd, b_input_condition cond );
+
+gboolean sm_is_stanza( struct xt_node *node )
+{
+	return strcmp( node->name, "message" ) == 0 ||
+	       strcmp( node->name, "presence" ) == 0 ||
+	       strcmp( node->name, "iq" ) == 0;
+}
+
+/* Servers may advertise older versions of the protocol too. */
+gboolean sm_supported( struct xt_node *features )
+{
+	struct xt_node *c = features->children;
+	char *xmlns;
+
+	while( ( c = xt_find_node( c, "sm" ) ) )
+	{
+		if( ( xmlns = xt_find_attr( c, "xmlns" ) ) && strcmp( xmlns, XMLNS_SM ) == 0 )
+			return TRUE;
+		c = c->next;
+	}
+
+	return FALSE;
+}
+
+static int sm_write_nonza( struct im_connection *ic, char *name, char *attr, char *value )
+{
+	struct xt_node *node;
+	int st;
+
+	node = xt_new_node( name, NULL, NULL );
+	xt_add_attr( node, "xmlns", XMLNS_SM );
+	if( attr )
+		xt_add_attr( node, attr, value );
+	st = jabber_write_packet( ic, node );
+	xt_free_node( node );
+
+	return st;
+}
+
+/* Call this once we're bound to a resource. */
+int sm_enable( struct im_connection *ic )
+{
+	struct jabber_data *jd = ic->proto_data;
+
+	if( !( jd->flags & JFLAG_SM_SUPPORTED ) ||
+	    !set_getbool( &ic->acc->set, "stream_management" ) )
+		return 1;
+
+	if( !sm_write_nonza( ic, "enable", "resume", "true" ) )
+		return 0;
+
+	/* Everything from here on counts. */
+	if( jd->sm_unacked == NULL )
+	{
+		jd->sm_unacked = iobuf_new();
+		jd->sm_lens = g_queue_new();
+	}
+	jd->sm_acked = 0;
+	jd->flags |= JFLAG_SM_ENABLED;
+
+	return 1;
+}
+
+/* Called instead of binding to a resource when we're reconnecting. */
+int sm_resume( struct im_connection *ic, gboolean supported )
+{
+	struct jabber_data *jd = ic->proto_data;
+	struct xt_node *node;
+	char h[16];
+	int st;
+
+	if( !supported )
+	{
+		imcb_error( ic, "Server doesn't support resuming sessions anymore" );
+		imc_logout( ic, TRUE );
+		return 0;
+	}
+
+	g_snprintf( h, sizeof( h ), "%u", jd->sm_in );
+	node = xt_new_node( "resume", NULL, NULL );
+	xt_add_attr( node, "xmlns", XMLNS_SM );
+	xt_add_attr( node, "h", h );
+	xt_add_attr( node, "previd", jd->sm_id );
+	st = jabber_write_packet( ic, node );
+	xt_free_node( node );
+
+	return st;
+}
+
+/* Keeps a copy of a stanza we're about to send. Returns the offset in
+   jd->sm_unacked where it starts. */
+gsize sm_queue( struct im_connection *ic, struct xt_node *node )
+{
+	struct jabber_data *jd = ic->proto_data;
+	gsize off = jd->sm_unacked->len;
+
+	xt_to_iobuf( node, jd->sm_unacked );
+	g_queue_push_tail( jd->sm_lens, GSIZE_TO_POINTER( jd->sm_unacked->len - off ) );
+
+	return off;
+}
+
+/* Asks the server for an ack if the number of unconfirmed stanzas is a
+   multiple of every. */
+int sm_request( struct im_connection *ic, int every )
+{
+	struct jabber_data *jd = ic->proto_data;
+	guint n;
+
+	if( !( jd->flags & JFLAG_SM_ENABLED ) || ( jd->flags & JFLAG_SM_RESUMING ) )
+		return 1;
+
+	n = g_queue_get_length( jd->sm_lens );
+	if( n == 0 || n % every != 0 )
+		return 1;
+
+	return sm_write_nonza( ic, "r", NULL, NULL );
+}
+
+/* The server got everything up to stanza h, forget about those. */
+static void sm_ack( struct im_connection *ic, char *s )
+{
+	struct jabber_data *jd = ic->proto_data;
+	guint32 h, n;
+	gsize len = 0;
+
+	if( s == NULL || !( jd->flags & JFLAG_SM_ENABLED ) )
+		return;
+
+	h = strtoul( s, NULL, 10 );
+	n = h - jd->sm_acked;
+	if( n > g_queue_get_length( jd->sm_lens ) )
+	{
+		imcb_log( ic, "Warning: Server confirmed more stanzas than we sent" );
+		n = g_queue_get_length( jd->sm_lens );
+	}
+
+	jd->sm_acked = h;
+	while( n-- > 0 )
+		len += GPOINTER_TO_SIZE( g_queue_pop_head( jd->sm_lens ) );
+	iobuf_drop( jd->sm_unacked, len );
+}
+
+/* Call this when the connection dies. If the session can be resumed,
+   this tears down the connection but leaves everything else alone, and
+   returns TRUE. Otherwise, log out as usual. */
+gboolean sm_lost( struct im_connection *ic )
+{
+	struct jabber_data *jd = ic->proto_data;
+
+	if( !( jd->flags & JFLAG_SM_ENABLED ) || jd->sm_id == NULL ||
+	    ( jd->flags & JFLAG_SM_RESUMING ) || !( ic->flags & OPT_LOGGED_IN ) )
+		return FALSE;
+
+	imcb_log( ic, "Lost connection to server, trying to resume the session" );
+
+	if( jd->r_inpa > 0 )
+		b_event_remove( jd->r_inpa );
+	if( jd->w_inpa > 0 )
+		b_event_remove( jd->w_inpa );
+	jd->r_inpa = jd->w_inpa = -1;
+
+	if( jd->ssl )
+		ssl_disconnect( jd->ssl );
+	else if( jd->fd >= 0 )
+		closesocket( jd->fd );
+	jd->ssl = NULL;
+	jd->fd = -1;
+
+	/* Any stanzas in there are in sm_unacked too. The read queue may
+	   be in use by the read handler right now, it'll clean up. */
+	iobuf_clear( jd->txq );
+	if( jd->rxq )
+		iobuf_clear( jd->rxq );
+
+	/* No stream means nothing gets written until we have a new one. */
+	xt_free( jd->xt );
+	jd->xt = NULL;
+
+	jd->flags &= ~( JFLAG_STREAM_STARTED | JFLAG_AUTHENTICATED |
+	                JFLAG_STREAM_RESTART | JFLAG_WANT_SESSION |
+	                JFLAG_WANT_BIND | JFLAG_STARTTLS_DONE |
+	                JFLAG_SM_SUPPORTED );
+	jd->flags |= JFLAG_SM_RESUMING;
+
+	jd->sm_timer = b_timeout_add( 0, sm_reconnect, ic );
+
+	return TRUE;
+}
+
+static gboolean sm_reconnect( gpointer data, gint fd, b_input_condition cond )
+{
+	struct im_connection *ic = data;
+	struct jabber_data *jd = ic->proto_data;
+
+	/* Set this one first, a failure below logs us out already. Same
+	   server as last time, so no SRV lookups (which would block). */
+	jd->sm_timer = b_timeout_add( jd->sm_max * 1000, sm_give_up, ic );
+	if( !jabber_connect_start( ic ) )
+	{
+		imcb_error( ic, "Could not connect to server" );
+		imc_logout( ic, TRUE );
+	}
+
+	return FALSE;
+}
+
+static gboolean sm_give_up( gpointer data, gint fd, b_input_condition cond )
+{
+	struct im_connection *ic = data;
+	struct jabber_data *jd = ic->proto_data;
+
+	jd->sm_timer = 0;
+	imcb_error( ic, "Could not resume session in time" );
+	imc_logout( ic, TRUE );
+
+	return FALSE;
+}
+
+void sm_free( struct im_connection *ic )
+{
+	struct jabber_data *jd = ic->proto_data;
+
+	if( jd->sm_timer > 0 )
+		b_event_remove( jd->sm_timer );
+
+	iobuf_free( jd->sm_unacked );
+	if( jd->sm_lens )
+		g_queue_free( jd->sm_lens );
+	g_free( jd->sm_id );
+}
+
+/* Runs for everything the server sends us. */
+xt_status sm_count( struct xt_node *node, gpointer data )
+{
+	struct im_connection *ic = data;
+	struct jabber_data *jd = ic->proto_data;
+
+	if( sm_is_stanza( node ) )
+		jd->sm_in ++;
+
+	return XT_NEXT;
+}
+
+static gboolean sm_is_ours( struct xt_node *node )
+{
+	char *xmlns = xt_find_attr( node, "xmlns" );
+
+	return xmlns && strcmp( xmlns, XMLNS_SM ) == 0;
+}
+
+xt_status sm_pkt_enabled( struct xt_node *node, gpointer data )
+{
+	struct im_connection *ic = data;
+	struct jabber_data *jd = ic->proto_data;
+	char *s, *id;
+
+	if( !sm_is_ours( node ) )
+		return XT_HANDLED;
+
+	/* The server counts from here on. */
+	jd->sm_in = 0;
+
+	s = xt_find_attr( node, "resume" );
+	id = xt_find_attr( node, "id" );
+	if( s && id && ( strcmp( s, "true" ) == 0 || strcmp( s, "1" ) == 0 ) )
+	{
+		g_free( jd->sm_id );
+		jd->sm_id = g_strdup( id );
+	}
+
+	s = xt_find_attr( node, "max" );
+	jd->sm_max = s ? atoi( s ) : 0;
+	if( jd->sm_max <= 0 || jd->sm_max > JABBER_SM_TIMEOUT )
+		jd->sm_max = JABBER_SM_TIMEOUT;
+
+	return XT_HANDLED;
+}
+
+xt_status sm_pkt_resumed( struct xt_node *node, gpointer data )
+{
+	struct im_connection *ic = data;
+	struct jabber_data *jd = ic->proto_data;
+	gboolean was_empty;
+
+	if( !sm_is_ours( node ) || !( jd->flags & JFLAG_SM_RESUMING ) )
+		return XT_HANDLED;
+
+	if( jd->sm_timer > 0 )
+		b_event_remove( jd->sm_timer );
+	jd->sm_timer = 0;
+	jd->flags &= ~JFLAG_SM_RESUMING;
+
+	sm_ack( ic, xt_find_attr( node, "h" ) );
+	imcb_log( ic, "Session resumed" );
+
+	/* Whatever the server didn't get (or what was queued while we were
+	   gone) goes out again now. */
+	if( jd->sm_unacked->len == 0 )
+		return XT_HANDLED;
+
+	was_empty = jd->txq->len == 0;
+	iobuf_append_from( jd->txq, jd->sm_unacked, 0 );
+	if( !jabber_write_start( ic, was_empty ) || !sm_request( ic, 1 ) )
+		return XT_ABORT;
+
+	return XT_HANDLED;
+}
+
+xt_status sm_pkt_failed( struct xt_node *node, gpointer data )
+{
+	struct im_connection *ic = data;
+	struct jabber_data *jd = ic->proto_data;
+
+	if( !sm_is_ours( node ) || !( jd->flags & JFLAG_SM_ENABLED ) )
+		return XT_HANDLED;
+
+	if( jd->flags & JFLAG_SM_RESUMING )
+	{
+		/* Too late, start from scratch. */
+		imcb_error( ic, "Could not resume session" );
+		imc_logout( ic, TRUE );
+		return XT_ABORT;
+	}
+
+	/* <enable/> didn't work, just do without. */
+	jd->flags &= ~JFLAG_SM_ENABLED;
+	iobuf_clear( jd->sm_unacked );
+	g_queue_clear( jd->sm_lens );
+
+	return XT_HANDLED;
+}
+
+xt_status sm_pkt_r( struct xt_node *node, gpointer data )
+{
+	struct im_connection *ic = data;
+	struct jabber_data *jd = ic->proto_data;
+	char h[16];
+
+	if( !sm_is_ours( node ) )
+		return XT_HANDLED;
+
+	g_snprintf( h, sizeof( h ), "%u", jd->sm_in );
+
+	return sm_write_nonza( ic, "a", "h", h ) ? XT_HANDLED : XT_ABORT;
+}
+
+xt_status sm_pkt_a( struct xt_node *node, gpointer data )
+{
+	if( sm_is_ours( node ) )
+		sm_ack( data, xt_find_attr( node, "h" ) );
+
+	return XT_HANDLED;
+}
@@ -102,8 +102,7 @@ typedef enum
 struct msn_handler_data
 {
 	int fd, inpa;
-	int rxlen;
-	char *rxq;
+	iobuf_t *rxq;
 	
 	int msglen;
 	char *cmd_text;
@@ -260,19 +260,22 @@ char **msn_linesplit( char *line )
 
 int msn_handler( struct msn_handler_data *h )
 {
-	int st;
+	char *rxq;
+	int rxlen, st;
 	
-	h->rxq = g_renew( char, h->rxq, h->rxlen + 1024 );
-	st = read( h->fd, h->rxq + h->rxlen, 1024 );
-	h->rxlen += st;
-	
-	if( st <= 0 )
+	st = iobuf_read( h->rxq, h->fd, NULL, 0 );
+	if( st < 0 && sockerr_again() )
+		return( 1 );
+	else if( st <= 0 )
 		return( -1 );
 	
+	rxq = iobuf_pullup( h->rxq );
+	rxlen = h->rxq->len;
+	
 	if( getenv( "BITLBEE_DEBUG" ) )
 	{
 		write( 2, "->C:", 4 );
-		write( 2, h->rxq + h->rxlen - st, st );
+		write( 2, rxq + rxlen - st, st );
 	}
 	
 	while( st )
@@ -281,14 +284,14 @@ int msn_handler( struct msn_handler_data *h )
 		
 		if( h->msglen == 0 )
 		{
-			for( i = 0; i < h->rxlen; i ++ )
+			for( i = 0; i < rxlen; i ++ )
 			{
-				if( h->rxq[i] == '\r' || h->rxq[i] == '\n' )
+				if( rxq[i] == '\r' || rxq[i] == '\n' )
 				{
 					char *cmd_text, **cmd;
 					int count;
 					
-					cmd_text = g_strndup( h->rxq, i );
+					cmd_text = g_strndup( rxq, i );
 					cmd = msn_linesplit( cmd_text );
 					for( count = 0; cmd[count]; count ++ );
 					st = h->exec_command( h, cmd, count );
@@ -299,10 +302,10 @@ int msn_handler( struct msn_handler_data *h )
 						return( 0 );
 					
 					if( h->msglen )
-						h->cmd_text = g_strndup( h->rxq, i );
+						h->cmd_text = g_strndup( rxq, i );
 					
 					/* Skip to the next non-emptyline */
-					while( i < h->rxlen && ( h->rxq[i] == '\r' || h->rxq[i] == '\n' ) ) i ++;
+					while( i < rxlen && ( rxq[i] == '\r' || rxq[i] == '\n' ) ) i ++;
 					
 					break;
 				}
@@ -310,7 +313,7 @@ int msn_handler( struct msn_handler_data *h )
 			
 			/* If we reached the end of the buffer, there's still an incomplete command there.
 			   Return and wait for more data. */
-			if( i == h->rxlen && h->rxq[i-1] != '\r' && h->rxq[i-1] != '\n' )
+			if( i == rxlen && rxq[i-1] != '\r' && rxq[i-1] != '\n' )
 				break;
 		}
 		else
@@ -319,10 +322,10 @@ int msn_handler( struct msn_handler_data *h )
 			int count;
 			
 			/* Do we have the complete message already? */
-			if( h->msglen > h->rxlen )
+			if( h->msglen > rxlen )
 				break;
 			
-			msg = g_strndup( h->rxq, h->msglen );
+			msg = g_strndup( rxq, h->msglen );
 			cmd = msn_linesplit( h->cmd_text );
 			for( count = 0; cmd[count]; count ++ );
 			
@@ -338,25 +341,14 @@ int msn_handler( struct msn_handler_data *h )
 			h->msglen = 0;
 		}
 		
-		/* More data after this block? */
-		if( i < h->rxlen )
-		{
-			char *tmp;
-			
-			tmp = g_memdup( h->rxq + i, h->rxlen - i );
-			g_free( h->rxq );
-			h->rxq = tmp;
-			h->rxlen -= i;
-			i = 0;
-		}
-		else
-		/* If not, reset the rx queue and get lost. */
-		{
-			g_free( h->rxq );
-			h->rxq = g_new0( char, 1 );
-			h->rxlen = 0;
+		/* Done with this block, the rest (if any) is still in one
+		   piece so this doesn't have to copy anything. */
+		iobuf_drop( h->rxq, i );
+		if( h->rxq->len == 0 )
 			return( 1 );
-		}
+		
+		rxq = iobuf_pullup( h->rxq );
+		rxlen = h->rxq->len;
 	}
 	
 	return( 1 );
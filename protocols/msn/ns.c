@@ -108,9 +108,8 @@ static gboolean msn_ns_connected( gpointer data, gint source, b_input_condition
 		return FALSE;
 	}
 	
-	g_free( handler->rxq );
-	handler->rxlen = 0;
-	handler->rxq = g_new0( char, 1 );
+	iobuf_free( handler->rxq );
+	handler->rxq = iobuf_new();
 	
 	if( md->uuid == NULL )
 	{
@@ -147,10 +146,9 @@ void msn_ns_close( struct msn_handler_data *handler )
 	}
 	
 	handler->fd = handler->inpa = -1;
-	g_free( handler->rxq );
+	iobuf_free( handler->rxq );
 	g_free( handler->cmd_text );
 	
-	handler->rxlen = 0;
 	handler->rxq = NULL;
 	handler->cmd_text = NULL;
 }
@@ -939,7 +937,7 @@ static void msn_ns_send_adl( struct im_connection *ic )
 static void msn_ns_send_adl_start( struct im_connection *ic )
 {
 	struct msn_data *md;
-	GSList *l;
+	GList *l;
 	
 	/* Dead connection? */
 	if( g_slist_find( msn_connections, ic ) == NULL )
@@ -290,7 +290,7 @@ void msn_sb_destroy( struct msn_switchboard *sb )
 	
 	if( sb->handler )
 	{
-		if( sb->handler->rxq ) g_free( sb->handler->rxq );
+		iobuf_free( sb->handler->rxq );
 		if( sb->handler->cmd_text ) g_free( sb->handler->cmd_text );
 		g_free( sb->handler );
 	}
@@ -327,7 +327,7 @@ gboolean msn_sb_connected( gpointer data, gint source, b_input_condition cond )
 	/* Prepare the callback */
 	sb->handler = g_new0( struct msn_handler_data, 1 );
 	sb->handler->fd = sb->fd;
-	sb->handler->rxq = g_new0( char, 1 );
+	sb->handler->rxq = iobuf_new();
 	sb->handler->data = sb;
 	sb->handler->exec_command = msn_sb_command;
 	sb->handler->exec_message = msn_sb_message;
@@ -154,7 +154,10 @@ static void msn_soap_handle_response( struct http_request *http_req )
 			/* TODO: Handle/report other errors. */
 		}
 		
+		/* Address book and membership lists add lots of contacts. */
+		imcb_roster_begin( soap_req->ic );
 		xt_handle( parser, NULL, -1 );
+		imcb_roster_end( soap_req->ic );
 		xt_free( parser );
 	}
 	
@@ -704,6 +707,7 @@ static xt_status msn_soap_addressbook_contact( struct xt_node *node, gpointer da
 		set_t *set = set_find( &ic->acc->set, "display_name" );
 		g_free( set->value );
 		set->value = g_strdup( display_name );
+		set_parse( set );
 		
 		/* Try to fetch the profile; if the user has one, that's where
 		   we can find the persistent display_name. */
@@ -744,7 +748,7 @@ static const struct xt_handler_entry msn_soap_addressbook_parser[] = {
 
 static int msn_soap_addressbook_handle_response( struct msn_soap_req_data *soap_req )
 {
-	GSList *l;
+	GList *l;
 	int wtf = 0;
 	
 	for( l = soap_req->ic->bee->users; l; l = l->next )
@@ -938,6 +942,7 @@ static xt_status msn_soap_profile_get_result( struct xt_node *node, gpointer dat
 		set_t *set = set_find( &ic->acc->set, "display_name" );
 		g_free( set->value );
 		set->value = g_strdup( dn->text );
+		set_parse( set );
 		
 		md->flags |= MSN_GOT_PROFILE_DN;
 	}
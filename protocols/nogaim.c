@@ -171,6 +171,7 @@ struct im_connection *imcb_new( account_t *acc )
 	ic->bee = acc->bee;
 	ic->acc = acc;
 	acc->ic = ic;
+	ic->users = g_hash_table_new_full( g_str_hash, g_str_equal, g_free, NULL );
 	
 	connections = g_slist_append( connections, ic );
 	
@@ -190,6 +191,7 @@ void imc_free( struct im_connection *ic )
 		}
 	
 	connections = g_slist_remove( connections, ic );
+	g_hash_table_destroy( ic->users );
 	g_free( ic );
 }
 
@@ -330,7 +332,7 @@ void imc_logout( struct im_connection *ic, int allow_reconnect )
 {
 	bee_t *bee = ic->bee;
 	account_t *a;
-	GSList *l;
+	GList *users, *l;
 	int delay;
 	
 	/* Nested calls might happen sometimes, this is probably the best
@@ -360,17 +362,18 @@ void imc_logout( struct im_connection *ic, int allow_reconnect )
 		          "an OAuth token: account %s set password \"\"", a->tag );
 	}
 	
-	for( l = bee->users; l; )
+	/* Don't leave the UI waiting for the rest of a contact list. */
+	if( ic->roster_batch > 0 )
 	{
-		bee_user_t *bu = l->data;
-		GSList *next = l->next;
-		
-		if( bu->ic == ic )
-			bee_user_free( bee, bu );
-		
-		l = next;
+		ic->roster_batch = 1;
+		imcb_roster_end( ic );
 	}
 	
+	users = g_hash_table_get_values( ic->users );
+	for( l = users; l; l = l->next )
+		bee_user_free( bee, l->data );
+	g_list_free( users );
+	
 	b_event_remove( ic->keepalive );
 	ic->keepalive = 0;
 	ic->acc->prpl->logout( ic );
@@ -424,6 +427,25 @@ void imcb_add_buddy( struct im_connection *ic, const char *handle, const char *g
 		bee->ui->user_group( bee, bu );
 }
 
+void imcb_roster_begin( struct im_connection *ic )
+{
+	bee_t *bee = ic->bee;
+	
+	if( ic->roster_batch ++ == 0 && bee->ui->roster_begin )
+		bee->ui->roster_begin( bee, ic );
+}
+
+void imcb_roster_end( struct im_connection *ic )
+{
+	bee_t *bee = ic->bee;
+	
+	if( ic->roster_batch == 0 )
+		return;
+	
+	if( -- ic->roster_batch == 0 && bee->ui->roster_end )
+		bee->ui->roster_end( bee, ic );
+}
+
 void imcb_rename_buddy( struct im_connection *ic, const char *handle, const char *fullname )
 {
 	bee_t *bee = ic->bee;
@@ -93,6 +93,10 @@ struct im_connection
 	
 	/* BitlBee */
 	bee_t *bee;
+	GHashTable *users; /* Normalized handle -> bee_user_t, see bee_user.c. */
+	int roster_batch; /* See imcb_roster_begin(). */
+	GSList *status_pending; /* See bee_user_status_changed(). */
+	gint status_timer;
 	
 	GSList *groupchats;
 };
@@ -148,6 +152,10 @@ struct prpl {
 	 * - Introduced for OTR, in order to fragment large protocol messages.
 	 * - 0 means "unlimited". */
 	unsigned int mms;
+	/* Max. number of bytes to read from the server in one go before other
+	 * connections get their turn, see iobuf_read().
+	 * - 0 means IOBUF_READ_BUDGET. */
+	unsigned int read_budget;
 
 	/* Added this one to be able to add per-account settings, don't think
 	 * it should be used for anything else. You are supposed to use the
@@ -248,6 +256,12 @@ struct prpl {
 	/* Mainly for AOL, since they think "Bung hole" == "Bu ngho le". *sigh*
 	 * - Most protocols will just want to set this to g_strcasecmp().*/
 	int (* handle_cmp) (const char *who1, const char *who2);
+	
+	/* Should return (in a new string) a version of the handle that's
+	 * equal for all handles that handle_cmp() considers equal. Used to
+	 * index contacts, if not set the handle is just lowercased, which
+	 * is what you want if you use g_strcasecmp() above. */
+	char *(* handle_normalize) (const char *handle);
 
 	/* Implement these callbacks if you want to use imcb_ask_auth() */
 	void (* auth_allow)	(struct im_connection *, const char *who);
@@ -317,6 +331,11 @@ G_MODULE_EXPORT void imcb_ask_add( struct im_connection *ic, const char *handle,
  * user, usually after a login, or if the user added a buddy and the IM
  * server confirms that the add was successful. Don't forget to do this! */
 G_MODULE_EXPORT void imcb_add_buddy( struct im_connection *ic, const char *handle, const char *group );
+/* Call these around processing a (big) contact list, so the UI can show all
+ * the contacts at once at the end instead of one by one. They can be nested,
+ * only the outermost imcb_roster_end() counts. */
+G_MODULE_EXPORT void imcb_roster_begin( struct im_connection *ic );
+G_MODULE_EXPORT void imcb_roster_end( struct im_connection *ic );
 G_MODULE_EXPORT void imcb_remove_buddy( struct im_connection *ic, const char *handle, char *group );
 G_MODULE_EXPORT struct buddy *imcb_find_buddy( struct im_connection *ic, char *handle );
 G_MODULE_EXPORT void imcb_rename_buddy( struct im_connection *ic, const char *handle, const char *realname );
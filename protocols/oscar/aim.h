@@ -784,6 +784,7 @@ int aim_chatnav_createroom(aim_session_t *sess, aim_conn_t *conn, const char *na
 
 
 int aim_sncmp(const char *a, const char *b);
+char *aim_snnormalize(const char *sn);
 
 #include <aim_internal.h>
 
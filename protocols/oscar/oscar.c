@@ -1955,6 +1955,7 @@ static int gaim_ssi_parselist(aim_session_t *sess, aim_frame_t *fr, ...) {
 
 	/* Add from server list to local list */
 	tmp = 0;
+	imcb_roster_begin(ic);
 	for (curitem=sess->ssi.items; curitem; curitem=curitem->next) {
 		nrm = curitem->name ? normalize(curitem->name) : NULL;
 		
@@ -2021,6 +2022,7 @@ static int gaim_ssi_parselist(aim_session_t *sess, aim_frame_t *fr, ...) {
 				break;
 		} /* End of switch on curitem->type */
 	} /* End of for loop */
+	imcb_roster_end(ic);
 
 	aim_ssi_enable(sess, fr->conn);
 	
@@ -2571,6 +2573,7 @@ void oscar_initmodule()
 	ret->send_typing = oscar_send_typing;
 	
 	ret->handle_cmp = aim_sncmp;
+	ret->handle_normalize = aim_snnormalize;
 
 	register_protocol(ret);
 }
@@ -69,3 +69,23 @@ int aim_sncmp(const char *sn1, const char *sn2)
 
 	return 0;
 }
+
+/*
+* char *aim_snnormalize(const char *)
+*
+* Returns a new string with the screen name in lowercase and without
+* spaces, so that screen names that aim_sncmp() considers equal end up
+* the same.
+*
+*/
+char *aim_snnormalize(const char *sn)
+{
+	char *ret = g_malloc(strlen(sn) + 1), *s = ret;
+
+	for (; *sn; sn++)
+		if (*sn != ' ')
+			*s++ = tolower(*sn);
+	*s = '\0';
+
+	return ret;
+}
@@ -697,6 +697,7 @@ static void prplcb_conn_connected( PurpleConnection *gc )
 	{
 		g_free( s->value );
 		s->value = g_strdup( dn );
+		set_parse( s );
 	}
 
 	// user list needs to be requested for Gadu-Gadu
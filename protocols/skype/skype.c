@@ -63,6 +63,8 @@ struct skype_data {
 	int bfd;
 	/* ssl_getfd() uses this to get the file desciptor. */
 	void *ssl;
+	/* Received data, up to the last complete line. */
+	iobuf_t *rxq;
 	/* When we receive a new message id, we query the properties, finally
 	 * the chatname. Store the properties here so that we can use
 	 * imcb_buddy_msg() when we got the chatname. */
@@ -1093,9 +1095,9 @@ static gboolean skype_read_callback(gpointer data, gint fd,
 {
 	struct im_connection *ic = data;
 	struct skype_data *sd = ic->proto_data;
-	char buf[IRC_LINE_SIZE];
+	iobuf_t *rx;
 	int st, i;
-	char **lines, **lineptr, *line;
+	char *buf, *line, *eol;
 	static struct parse_map {
 		char *k;
 		skype_parser v;
@@ -1121,28 +1123,37 @@ static gboolean skype_read_callback(gpointer data, gint fd,
 
 	if (!sd || sd->fd == -1)
 		return FALSE;
-	/* Read the whole data. */
-	st = ssl_read(sd->ssl, buf, sizeof(buf));
+	/* Read everything that's there. Only complete lines are handled,
+	 * the last one may still be incomplete and stays in the buffer. */
+	st = iobuf_read(sd->rxq, sd->fd, sd->ssl, ic->acc->prpl->read_budget);
 	if (st > 0) {
-		buf[st] = '\0';
-		/* Then split it up to lines. */
-		lines = g_strsplit(buf, "\n", 0);
-		lineptr = lines;
-		while ((line = *lineptr)) {
-			if (!strlen(line))
-				break;
-			if (set_getbool(&ic->acc->set, "skypeconsole_receive"))
+		/* Parsers can log us out (a failed login, or a write error
+		 * in skype_printf()), which frees sd. So keep the buffer to
+		 * ourselves and check after every line. */
+		rx = sd->rxq;
+		sd->rxq = NULL;
+		buf = iobuf_pullup(rx);
+		buf[rx->len] = '\0';
+		line = buf;
+		while ((eol = strchr(line, '\n'))) {
+			*eol = '\0';
+			if (*line && set_getbool(&ic->acc->set, "skypeconsole_receive"))
 				imcb_buddy_msg(ic, "skypeconsole", line, 0, 0);
-			for (i = 0; i < ARRAY_SIZE(parsers); i++)
+			for (i = 0; *line && i < ARRAY_SIZE(parsers); i++)
 				if (!strncmp(line, parsers[i].k,
 					strlen(parsers[i].k))) {
 					parsers[i].v(ic, line);
 					break;
 				}
-			lineptr++;
+			if (!g_slist_find(get_connections(), ic)) {
+				iobuf_free(rx);
+				return FALSE;
+			}
+			line = eol + 1;
 		}
-		g_strfreev(lines);
-	} else if (st == 0 || (st < 0 && !sockerr_again())) {
+		iobuf_drop(rx, line - buf);
+		sd->rxq = rx;
+	} else if (st == 0 || (st < 0 && !ssl_sockerr_again(sd->ssl))) {
 		ssl_disconnect(sd->ssl);
 		sd->fd = -1;
 		sd->ssl = NULL;
@@ -1213,6 +1224,7 @@ static void skype_login(account_t *acc)
 		set_getint(&acc->set, "port"), FALSE, skype_connected, ic);
 	sd->fd = sd->ssl ? ssl_getfd(sd->ssl) : -1;
 	sd->username = g_strdup(acc->user);
+	sd->rxq = iobuf_new();
 
 	sd->ic = ic;
 
@@ -1238,6 +1250,7 @@ static void skype_logout(struct im_connection *ic)
 	if (sd->ssl)
 		ssl_disconnect(sd->ssl);
 
+	iobuf_free(sd->rxq);
 	g_free(sd->username);
 	g_free(sd->handle);
 	g_free(sd);
@@ -84,7 +84,7 @@ struct groupchat *twitter_groupchat_init(struct im_connection *ic)
 	char *name_hint;
 	struct groupchat *gc;
 	struct twitter_data *td = ic->proto_data;
-	GSList *l;
+	GList *l;
 
 	if (td->timeline_gc)
 		return td->timeline_gc;
@@ -574,7 +574,7 @@ static guint64 twitter_message_id_from_command_arg(struct im_connection *ic, cha
 			bu = td->log[id].bu;
 			id = td->log[id].id;
 			/* Beware of dangling pointers! */
-			if (!g_slist_find(ic->bee->users, bu))
+			if (!g_list_find(ic->bee->users, bu))
 				bu = NULL;
 		} else if (sscanf(arg, "%" G_GINT64_MODIFIER "d", &id) == 1) {
 			/* Allow normal tweet IDs as well; not a very useful
@@ -385,10 +385,12 @@ static void twitter_http_get_users_lookup(struct http_request *req)
 	json_value_free(parsed);
 
 	// Add the users as buddies.
+	imcb_roster_begin(ic);
 	for (l = txl->list; l; l = g_slist_next(l)) {
 		user = l->data;
 		twitter_add_buddy(ic, user->screen_name, user->name);
 	}
+	imcb_roster_end(ic);
 
 	// Free the structure.
 	txl_free(txl);
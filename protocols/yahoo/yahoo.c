@@ -548,6 +548,7 @@ void ext_yahoo_got_buddies( int id, YList *buds )
 	struct byahoo_data *yd = ic->proto_data;
 	YList *bl = buds;
 	
+	imcb_roster_begin( ic );
 	while( bl )
 	{
 		struct yahoo_buddy *b = bl->data;
@@ -567,6 +568,7 @@ void ext_yahoo_got_buddies( int id, YList *buds )
 		
 		bl = bl->next;
 	}
+	imcb_roster_end( ic );
 }
 
 void ext_yahoo_got_identities( int id, YList *ids )
@@ -46,13 +46,28 @@ void root_command_string( irc_t *irc, char *command )
 			}                                                      \
 	} while( 0 )
 
+static command_table_t *root_command_table = NULL;
+
 void root_command( irc_t *irc, char *cmd[] )
 {	
+	const command_t *c;
 	int i, len;
 	
 	if( !cmd[0] )
 		return;
 	
+	if( root_command_table == NULL )
+		root_command_table = command_table_new( root_commands );
+	
+	if( ( c = command_table_find( root_command_table, cmd[0] ) ) )
+	{
+		MIN_ARGS( c->required_parameters );
+		
+		c->execute( irc, cmd );
+		return;
+	}
+	
+	/* Not a full command name, so try to find a unique prefix. */
 	len = strlen( cmd[0] );
 	for( i = 0; root_commands[i].command; i++ )
 		if( g_strncasecmp( root_commands[i].command, cmd[0], len ) == 0 )
@@ -614,21 +629,21 @@ static void cmd_channel( irc_t *irc, char **cmd )
 	
 	if( len >= 1 && g_strncasecmp( cmd[1], "list", len ) == 0 )
 	{
-		GSList *l;
-		int i = 0;
+		int i;
 		
 		if( strchr( irc->umode, 'b' ) )
 			irc_rootmsg( irc, "Channel list:" );
 		
-		for( l = irc->channels; l; l = l->next )
+		for( i = 0; i < irc->channel_ids->len; i ++ )
 		{
-			irc_channel_t *ic = l->data;
+			irc_channel_t *ic = g_ptr_array_index( irc->channel_ids, i );
+			
+			if( ic == NULL )
+				continue;
 			
-			irc_rootmsg( irc, "%2d. %s, %s channel%s", i, ic->name,
+			irc_rootmsg( irc, "%2d. %s, %s channel%s", ic->id, ic->name,
 			             set_getstr( &ic->set, "type" ),
 			             ic->flags & IRC_CHANNEL_JOINED ? " (joined)" : "" );
-			
-			i ++;
 		}
 		irc_rootmsg( irc, "End of channel list" );
 		
@@ -1448,5 +1463,8 @@ gboolean root_command_add( const char *command, int params, void (*func)(irc_t *
 	root_commands[i].execute = func;
 	root_commands[i].flags = flags;
 	
+	if( root_command_table )
+		command_table_add( root_command_table, &root_commands[i] );
+	
 	return TRUE;
 }
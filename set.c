@@ -28,6 +28,19 @@
 /* Used to use NULL for this, but NULL is actually a "valid" value. */
 char *SET_INVALID = "nee";
 
+void set_parse( set_t *s )
+{
+	char *v = set_value( s );
+	
+	s->value_int = s->value_bool = 0;
+	if( v )
+	{
+		if( sscanf( v, "%d", &s->value_int ) != 1 )
+			s->value_int = 0;
+		s->value_bool = bool2int( v );
+	}
+}
+
 set_t *set_add( set_t **head, const char *key, const char *def, set_eval eval, void *data )
 {
 	set_t *s = set_find( head, key );
@@ -45,8 +58,11 @@ set_t *set_add( set_t **head, const char *key, const char *def, set_eval eval, v
 		else
 		{
 			s = *head = g_new0( set_t, 1 );
+			s->index = g_hash_table_new( str_case_hash, str_case_equal );
 		}
-		s->key = g_strdup( key );
+		/* Thousands of accounts and channels all have the same keys. */
+		s->key = (char*) g_intern_string( key );
+		g_hash_table_insert( (*head)->index, s->key, s );
 	}
 	
 	if( s->def )
@@ -58,6 +74,7 @@ set_t *set_add( set_t **head, const char *key, const char *def, set_eval eval, v
 	
 	s->eval = eval;
 	s->data = data;
+	set_parse( s );
 	
 	return s;
 }
@@ -66,13 +83,16 @@ set_t *set_find( set_t **head, const char *key )
 {
 	set_t *s = *head;
 	
-	while( s )
-	{
-		if( g_strcasecmp( s->key, key ) == 0 ||
-		    ( s->old_key && g_strcasecmp( s->old_key, key ) == 0 ) )
+	if( s == NULL )
+		return NULL;
+	
+	if( ( s = g_hash_table_lookup( s->index, key ) ) )
+		return s;
+	
+	/* Old names aren't in the index, they're only for upgrades anyway. */
+	for( s = *head; s; s = s->next )
+		if( s->old_key && g_strcasecmp( s->old_key, key ) == 0 )
 			break;
-		s = s->next;
-	}
 	
 	return s;
 }
@@ -89,26 +109,16 @@ char *set_getstr( set_t **head, const char *key )
 
 int set_getint( set_t **head, const char *key )
 {
-	char *s = set_getstr( head, key );
-	int i = 0;
-	
-	if( !s )
-		return 0;
-	
-	if( sscanf( s, "%d", &i ) != 1 )
-		return 0;
+	set_t *s = set_find( head, key );
 	
-	return i;
+	return s ? s->value_int : 0;
 }
 
 int set_getbool( set_t **head, const char *key )
 {
-	char *s = set_getstr( head, key );
-	
-	if( !s )
-		return 0;
+	set_t *s = set_find( head, key );
 	
-	return bool2int( s );
+	return s ? s->value_bool : 0;
 }
 
 int set_isvisible( set_t *set )
@@ -155,6 +165,8 @@ int set_setstr( set_t **head, const char *key, char *value )
 	if( nv != value )
 		g_free( nv );
 	
+	set_parse( s );
+	
 	return 1;
 }
 
@@ -170,25 +182,28 @@ void set_del( set_t **head, const char *key )
 {
 	set_t *s = *head, *t = NULL;
 	
-	while( s )
+	if( s == NULL || !( s = g_hash_table_lookup( s->index, key ) ) )
+		return;
+	
+	g_hash_table_remove( (*head)->index, s->key );
+	if( s == *head )
 	{
-		if( g_strcasecmp( s->key, key ) == 0 )
-			break;
-		s = (t=s)->next;
+		/* The index moves to the new head, if there is one. */
+		if( ( *head = s->next ) )
+			(*head)->index = s->index;
+		else
+			g_hash_table_destroy( s->index );
 	}
-	if( s )
+	else
 	{
-		if( t )
-			t->next = s->next;
-		else
-			*head = s->next;
-		
-		g_free( s->key );
-		g_free( s->old_key );
-		g_free( s->value );
-		g_free( s->def );
-		g_free( s );
+		for( t = *head; t->next != s; t = t->next );
+		t->next = s->next;
 	}
+	
+	g_free( s->old_key );
+	g_free( s->value );
+	g_free( s->def );
+	g_free( s );
 }
 
 int set_reset( set_t **head, const char *key )
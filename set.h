@@ -36,7 +36,12 @@ struct set;
    remembers a default value for every setting. And to prevent the user
    from setting invalid values, you can write an evaluator function for
    every setting, which can check a new value and block it by returning
-   NULL, or replace it by returning a new value. See struct set.eval. */
+   NULL, or replace it by returning a new value. See struct set.eval.
+   
+   Settings get read a lot (some of them for every message), so the first
+   set_t in every list also keeps a hash table of all the keys in it, and
+   every set_t keeps its value parsed as an int/bool, updated whenever
+   the value changes. */
 
 typedef char *(*set_eval) ( struct set *set, char *value );
 
@@ -74,6 +79,10 @@ typedef struct set
 	set_eval eval;
 	void *eval_data;
 	struct set *next;
+	
+	int value_int;      /* Cached results of set_getint()/set_getbool(). */
+	int value_bool;
+	GHashTable *index;  /* Only on the first set_t of a list: key -> set_t. */
 } set_t;
 
 #define set_value( set ) ((set)->value) ? ((set)->value) : ((set)->def)
@@ -103,6 +112,10 @@ int set_reset( set_t **head, const char *key );
 /* returns true if a setting shall be shown to the user */
 int set_isvisible( set_t *set );
 
+/* Updates the cached int/bool values. set_setstr() and friends do this
+   already, only needed after changing set->value or set->def directly. */
+void set_parse( set_t *s );
+
 /* Two very useful generic evaluators. */
 char *set_eval_int( set_t *set, char *value );
 char *set_eval_bool( set_t *set, char *value );
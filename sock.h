@@ -9,7 +9,7 @@
 #include <netdb.h>
 #define sock_make_nonblocking(fd) fcntl(fd, F_SETFL, O_NONBLOCK)
 #define sock_make_blocking(fd) fcntl(fd, F_SETFL, 0)
-#define sockerr_again() (errno == EINPROGRESS || errno == EINTR)
+#define sockerr_again() (errno == EINPROGRESS || errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
 void closesocket( int fd );
 #else
 # include <winsock2.h>
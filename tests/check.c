@@ -31,6 +31,29 @@ irc_t *torture_irc(void)
 	return irc;
 }
 
+static void fake_logout(struct im_connection *ic)
+{
+}
+
+static struct prpl fake_prpl = { .name = "fake", .logout = fake_logout };
+
+/* An account on a do-nothing IM protocol, logged in, for tests that need
+   contacts or a connection to hang protocol state off. */
+struct im_connection *torture_ic(irc_t *irc, const char *user)
+{
+	account_t *acc = account_add(irc->b, &fake_prpl, user, "secret");
+
+	return imcb_new(acc);
+}
+
+/* Timeout handler that makes b_main_run() return, so tests can let the
+   event loop run for a while. */
+gboolean quit_cb(gpointer data, gint fd, b_input_condition cond)
+{
+	b_main_quit();
+	return FALSE;
+}
+
 double gettime()
 {
 	struct timeval time[1];
@@ -69,6 +92,30 @@ Suite *jabber_sasl_suite(void);
 /* From check_jabber_sasl.c */
 Suite *jabber_util_suite(void);
 
+/* From check_jabber_sm.c */
+Suite *jabber_sm_suite(void);
+
+/* From check_iobuf.c */
+Suite *iobuf_suite(void);
+
+/* From check_timerwheel.c */
+Suite *timerwheel_suite(void);
+
+/* From check_slab.c */
+Suite *slab_suite(void);
+
+/* From check_dns.c */
+Suite *dns_suite(void);
+
+/* From check_commands.c */
+Suite *commands_suite(void);
+
+/* From check_xmltree.c */
+Suite *xmltree_suite(void);
+
+/* From check_ipc.c */
+Suite *ipc_suite(void);
+
 int main (int argc, char **argv)
 {
 	int nf;
@@ -117,6 +164,14 @@ int main (int argc, char **argv)
 	srunner_add_suite(sr, set_suite());
 	srunner_add_suite(sr, jabber_sasl_suite());
 	srunner_add_suite(sr, jabber_util_suite());
+	srunner_add_suite(sr, jabber_sm_suite());
+	srunner_add_suite(sr, iobuf_suite());
+	srunner_add_suite(sr, timerwheel_suite());
+	srunner_add_suite(sr, slab_suite());
+	srunner_add_suite(sr, dns_suite());
+	srunner_add_suite(sr, commands_suite());
+	srunner_add_suite(sr, xmltree_suite());
+	srunner_add_suite(sr, ipc_suite());
 	if (no_fork)
 		srunner_set_fork_status(sr, CK_NOFORK);
 	srunner_run_all (sr, verbose?CK_VERBOSE:CK_NORMAL);
@@ -0,0 +1,52 @@
+#include <stdlib.h>
+#include <glib.h>
+#include <gmodule.h>
+#include <check.h>
+#include <string.h>
+#include "commands.h"
+
+static void cmd_a(irc_t *irc, char **args) {}
+static void cmd_b(irc_t *irc, char **args) {}
+
+static const command_t test_commands[] = {
+	{ "privmsg", 1, cmd_a, 0 },
+	{ "ping",    0, cmd_b, 0 },
+	{ NULL }
+};
+
+START_TEST(test_find)
+	command_table_t *t = command_table_new(test_commands);
+	const command_t *c;
+
+	c = command_table_find(t, "PRIVMSG");
+	fail_unless(c != NULL && c->execute == cmd_a && c->required_parameters == 1);
+	c = command_table_find(t, "Ping");
+	fail_unless(c != NULL && c->execute == cmd_b);
+	fail_unless(command_table_find(t, "pin") == NULL);
+	fail_unless(command_table_find(t, "pong") == NULL);
+
+	command_table_free(t);
+END_TEST
+
+START_TEST(test_add)
+	command_table_t *t = command_table_new(test_commands);
+	command_t c = { "otr", 1, cmd_b, 0 };
+
+	fail_unless(command_table_add(t, &c));
+	/* The table should have its own copy. */
+	c.execute = cmd_a;
+	fail_unless(command_table_find(t, "OTR")->execute == cmd_b);
+	fail_if(command_table_add(t, &test_commands[1]));
+
+	command_table_free(t);
+END_TEST
+
+Suite *commands_suite (void)
+{
+	Suite *s = suite_create("Commands");
+	TCase *tc_core = tcase_create("Core");
+	suite_add_tcase (s, tc_core);
+	tcase_add_test (tc_core, test_find);
+	tcase_add_test (tc_core, test_add);
+	return s;
+}
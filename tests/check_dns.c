@@ -0,0 +1,98 @@
+#include <stdlib.h>
+#include <glib.h>
+#include <gmodule.h>
+#include <check.h>
+#include <string.h>
+#include <stdio.h>
+#include <arpa/inet.h>
+#include "dns.h"
+#include "proxy.h"
+#include "testsuite.h"
+
+static int called;
+static struct addrinfo *result;
+
+static void dns_test_cb(gpointer data, struct addrinfo *res, int error)
+{
+	fail_unless(data == &called);
+	called ++;
+	result = res;
+}
+
+START_TEST(test_numeric)
+	struct sockaddr_in *sin;
+
+	called = 0;
+	fail_unless(dns_lookup("127.0.0.1", 6667, AF_UNSPEC, dns_test_cb, &called) == 0);
+	fail_unless(called == 1);
+	fail_if(result == NULL);
+	fail_unless(result->ai_family == AF_INET);
+
+	sin = (struct sockaddr_in *) result->ai_addr;
+	fail_unless(ntohs(sin->sin_port) == 6667);
+	fail_unless(sin->sin_addr.s_addr == htonl(INADDR_LOOPBACK));
+
+	dns_free(result);
+END_TEST
+
+START_TEST(test_numeric6)
+	struct sockaddr_in6 *sin6;
+
+	called = 0;
+	fail_unless(dns_lookup("::1", 5222, AF_UNSPEC, dns_test_cb, &called) == 0);
+	fail_unless(called == 1);
+	fail_if(result == NULL);
+	fail_unless(result->ai_family == AF_INET6);
+
+	sin6 = (struct sockaddr_in6 *) result->ai_addr;
+	fail_unless(ntohs(sin6->sin6_port) == 5222);
+	fail_unless(result->ai_next == NULL);
+
+	dns_free(result);
+END_TEST
+
+START_TEST(test_sync)
+	struct addrinfo *res;
+
+	fail_unless(dns_lookup_sync("10.1.2.3", 0, AF_INET, &res) == 0);
+	fail_if(res == NULL);
+	fail_unless(((struct sockaddr_in *) res->ai_addr)->sin_addr.s_addr == inet_addr("10.1.2.3"));
+	dns_free(res);
+
+	/* IPv4 address, but asking for IPv6. */
+	fail_if(dns_lookup_sync("10.1.2.3", 0, AF_INET6, &res) == 0);
+	fail_unless(res == NULL);
+END_TEST
+
+static gboolean proxy_test_cb(gpointer data, gint fd, b_input_condition cond)
+{
+	called ++;
+	return FALSE;
+}
+
+START_TEST(test_proxy_cancel)
+	int fd;
+
+	/* Most likely not in the cache yet, so we get a placeholder fd while
+	   the lookup is running. Closing it means we're not interested. */
+	called = 0;
+	fd = proxy_connect("localhost", 6667, proxy_test_cb, NULL);
+	fail_unless(fd >= 0);
+	closesocket(fd);
+
+	b_timeout_add(500, quit_cb, NULL);
+	b_main_run();
+	fail_unless(called == 0);
+END_TEST
+
+Suite *dns_suite (void)
+{
+	Suite *s = suite_create("DNS");
+	TCase *tc_core = tcase_create("Core");
+	suite_add_tcase (s, tc_core);
+	tcase_add_test (tc_core, test_numeric);
+	tcase_add_test (tc_core, test_numeric6);
+	tcase_add_test (tc_core, test_sync);
+	tcase_add_test (tc_core, test_proxy_cancel);
+	return s;
+}
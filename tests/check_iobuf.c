@@ -0,0 +1,147 @@
+#include <stdlib.h>
+#include <glib.h>
+#include <gmodule.h>
+#include <check.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include "iobuf.h"
+
+START_TEST(test_append_drop)
+	iobuf_t *b = iobuf_new();
+	char *s;
+	gsize len;
+
+	iobuf_append(b, "PING :a\r\n", 9);
+	iobuf_append(b, "PING :b\r\n", 9);
+	fail_unless(b->len == 18);
+
+	s = iobuf_head(b, &len);
+	fail_unless(len == 18);
+	fail_unless(strncmp(s, "PING :a\r\nPING :b\r\n", 18) == 0);
+
+	iobuf_drop(b, 9);
+	fail_unless(b->len == 9);
+	s = iobuf_head(b, &len);
+	fail_unless(strncmp(s, "PING :b\r\n", 9) == 0);
+
+	iobuf_drop(b, 9);
+	fail_unless(b->len == 0);
+	fail_unless(iobuf_head(b, &len) == NULL && len == 0);
+
+	iobuf_free(b);
+END_TEST
+
+START_TEST(test_big_append_pullup)
+	iobuf_t *b = iobuf_new();
+	char *big = g_malloc(IOBUF_CHUNK_SIZE * 3), *s;
+	int i;
+
+	for (i = 0; i < IOBUF_CHUNK_SIZE * 3; i ++)
+		big[i] = 'a' + i % 26;
+
+	iobuf_append(b, "x", 1);
+	iobuf_append(b, big, IOBUF_CHUNK_SIZE * 3);
+	fail_unless(b->len == IOBUF_CHUNK_SIZE * 3 + 1);
+
+	s = iobuf_pullup(b);
+	fail_unless(s[0] == 'x');
+	fail_unless(memcmp(s + 1, big, IOBUF_CHUNK_SIZE * 3) == 0);
+	fail_unless(b->first == b->last);
+
+	iobuf_free(b);
+	g_free(big);
+END_TEST
+
+START_TEST(test_reserve_commit)
+	iobuf_t *b = iobuf_new();
+	char *s;
+
+	s = iobuf_reserve(b, 512);
+	memcpy(s, "NICK bla\r\nUSER", 14);
+	iobuf_commit(b, 14);
+	iobuf_drop(b, 10);
+
+	s = iobuf_reserve(b, 512);
+	memcpy(s, " a a a a\r\n", 10);
+	iobuf_commit(b, 10);
+
+	s = iobuf_pullup(b);
+	s[b->len] = '\0';
+	fail_unless(strcmp(s, "USER a a a a\r\n") == 0);
+
+	iobuf_free(b);
+END_TEST
+
+START_TEST(test_writev)
+	iobuf_t *b = iobuf_new();
+	int fds[2];
+	char *big = g_malloc(IOBUF_CHUNK_SIZE * 2), in[IOBUF_CHUNK_SIZE * 2 + 1];
+	int n = 0, st;
+
+	fail_unless(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+
+	memset(big, 'z', IOBUF_CHUNK_SIZE * 2);
+	iobuf_append(b, "a", 1);
+	iobuf_append(b, big, IOBUF_CHUNK_SIZE * 2);
+
+	while (b->len > 0)
+		fail_unless(iobuf_writev(b, fds[0]) > 0);
+
+	while (n < sizeof(in) && (st = read(fds[1], in + n, sizeof(in) - n)) > 0)
+		n += st;
+
+	fail_unless(n == sizeof(in));
+	fail_unless(in[0] == 'a' && in[sizeof(in) - 1] == 'z');
+
+	close(fds[0]);
+	close(fds[1]);
+	iobuf_free(b);
+	g_free(big);
+END_TEST
+
+START_TEST(test_read)
+	iobuf_t *b = iobuf_new();
+	int fds[2], i;
+	char *out = g_malloc(60000), *s;
+
+	fail_unless(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+	for (i = 0; i < 60000; i ++)
+		out[i] = 'a' + i % 26;
+	fail_unless(write(fds[0], out, 60000) == 60000);
+
+	/* Stops at the budget, the rest is read in the next round. */
+	fail_unless(iobuf_read(b, fds[1], NULL, 16384) == 16384);
+	fail_unless(iobuf_read(b, fds[1], NULL, 0) == 60000 - 16384);
+	fail_unless(b->len == 60000);
+	fail_unless(iobuf_read(b, fds[1], NULL, 0) < 0 && errno == EAGAIN);
+
+	s = iobuf_pullup(b);
+	fail_unless(memcmp(s, out, 60000) == 0);
+
+	close(fds[0]);
+	fail_unless(iobuf_read(b, fds[1], NULL, 0) == 0);
+	fail_unless(b->len == 60000);
+
+	close(fds[1]);
+	iobuf_free(b);
+	g_free(out);
+END_TEST
+
+Suite *iobuf_suite (void)
+{
+	Suite *s = suite_create("IOBuf");
+	TCase *tc_core = tcase_create("Core");
+	suite_add_tcase (s, tc_core);
+	tcase_add_test (tc_core, test_append_drop);
+	tcase_add_test (tc_core, test_big_append_pullup);
+	tcase_add_test (tc_core, test_reserve_commit);
+	tcase_add_test (tc_core, test_writev);
+	tcase_add_test (tc_core, test_read);
+	return s;
+}
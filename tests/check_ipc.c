@@ -0,0 +1,103 @@
+#include <stdlib.h>
+#include <glib.h>
+#include <gmodule.h>
+#include <check.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include "bitlbee.h"
+#include "ipc.h"
+#include "testsuite.h"
+
+static pid_t master;
+
+/* Pool children are fork()ed from inside the event loop, so they come out
+   of b_main_run() here too. Keep them around until the master closes
+   their IPC socket, like the real ones. */
+static void run_pool(void)
+{
+	char c;
+
+	b_timeout_add(300, quit_cb, NULL);
+	b_main_run();
+	if (getpid() != master) {
+		fcntl(global.listen_socket, F_SETFL, 0);
+		while (read(global.listen_socket, &c, 1) > 0);
+		_exit(0);
+	}
+}
+
+static int pool_pids(pid_t *pids, int max)
+{
+	GSList *l;
+	int n = 0;
+
+	for (l = child_list; l; l = l->next) {
+		struct bitlbee_child *c = l->data;
+
+		if (c->idle && n < max)
+			pids[n] = c->pid;
+		if (c->idle)
+			n ++;
+	}
+
+	return n;
+}
+
+START_TEST(test_pool_rehash)
+	char fn[] = "/tmp/bitlbee-test.XXXXXX";
+	char *old_file = global.conf_file;
+	char *cmd[] = { "REHASH", NULL };
+	pid_t old[2], new[2];
+	FILE *fp;
+	int i;
+
+	fail_unless((fp = fdopen(mkstemp(fn), "w")) != NULL);
+	fprintf(fp, "[settings]\nForkDaemonPool = 2\n");
+	fclose(fp);
+
+	master = getpid();
+	global.conf_file = fn;
+	global.conf->runmode = RUNMODE_FORKDAEMON;
+	global.conf->forkpool = 2;
+	global.listen_socket = -1;
+	global.listen_watch_source_id = -1;
+
+	ipc_master_pool_refill();
+	run_pool();
+	fail_unless(pool_pids(old, 2) == 2);
+
+	/* Children forked before the rehash still have the old settings,
+	   and there's no way to tell them. They have to be replaced. */
+	fp = fopen(fn, "a");
+	fprintf(fp, "AuthMode = Closed\n");
+	fclose(fp);
+	ipc_master_cmd_rehash(NULL, cmd);
+	fail_unless(global.conf->authmode == AUTHMODE_CLOSED);
+	fail_unless(pool_pids(new, 2) == 0);
+
+	run_pool();
+	fail_unless(pool_pids(new, 2) == 2);
+	for (i = 0; i < 2; i ++)
+		fail_if(new[i] == old[0] || new[i] == old[1]);
+
+	ipc_master_free_all();
+	for (i = 0; i < 2; i ++) {
+		waitpid(old[i], NULL, 0);
+		waitpid(new[i], NULL, 0);
+	}
+	unlink(fn);
+	global.conf_file = old_file;
+	global.conf->runmode = RUNMODE_DAEMON;
+END_TEST
+
+Suite *ipc_suite (void)
+{
+	Suite *s = suite_create("IPC");
+	TCase *tc_core = tcase_create("Core");
+	suite_add_tcase (s, tc_core);
+	tcase_add_test (tc_core, test_pool_rehash);
+	return s;
+}
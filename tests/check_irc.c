@@ -5,6 +5,7 @@
 #include <string.h>
 #include <stdio.h>
 #include "irc.h"
+#include "bitlbee.h"
 #include "testsuite.h"
 
 START_TEST(test_connect)
@@ -54,6 +55,220 @@ START_TEST(test_login)
 	g_free(raw);
 END_TEST
 
+START_TEST(test_tokenize)
+	char *cmd[IRC_MAX_ARGS+1];
+	char line1[] = ":nick!u@h PRIVMSG #bitlbee :foo bar";
+	char line2[] = "   ";
+	char line3[] = "A 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17";
+
+	fail_unless(irc_tokenize(line1, cmd) == 3);
+	fail_unless(strcmp(cmd[0], "PRIVMSG") == 0);
+	fail_unless(strcmp(cmd[1], "#bitlbee") == 0);
+	fail_unless(strcmp(cmd[2], "foo bar") == 0);
+	fail_unless(cmd[3] == NULL);
+
+	fail_unless(irc_tokenize(line2, cmd) == 0);
+	fail_unless(cmd[0] == NULL);
+
+	/* Anything beyond IRC_MAX_ARGS ends up in the last argument. */
+	fail_unless(irc_tokenize(line3, cmd) == IRC_MAX_ARGS);
+	fail_unless(strcmp(cmd[IRC_MAX_ARGS-2], "14") == 0);
+	fail_unless(strcmp(cmd[IRC_MAX_ARGS-1], "15 16 17") == 0);
+	fail_unless(cmd[IRC_MAX_ARGS] == NULL);
+END_TEST
+
+START_TEST(test_partial_line)
+	GIOChannel *ch1, *ch2;
+	irc_t *irc;
+	char *raw;
+	fail_unless(g_io_channel_pair(&ch1, &ch2));
+
+	g_io_channel_set_flags(ch1, G_IO_FLAG_NONBLOCK, NULL);
+	g_io_channel_set_flags(ch2, G_IO_FLAG_NONBLOCK, NULL);
+
+	irc = irc_new(g_io_channel_unix_get_fd(ch1));
+
+	fail_unless(g_io_channel_write_chars(ch2, "NICK bla\r\nUSER a a",
+			-1, NULL, NULL) == G_IO_STATUS_NORMAL);
+	fail_unless(g_io_channel_flush(ch2, NULL) == G_IO_STATUS_NORMAL);
+	g_main_iteration(FALSE);
+
+	/* The incomplete line has to stay behind until the rest arrives. */
+	fail_unless(irc->readbuffer->len == 8);
+
+	fail_unless(g_io_channel_write_chars(ch2, " a a\n",
+			-1, NULL, NULL) == G_IO_STATUS_NORMAL);
+	fail_unless(g_io_channel_flush(ch2, NULL) == G_IO_STATUS_NORMAL);
+	g_main_iteration(FALSE);
+
+	fail_unless(irc->readbuffer->len == 0);
+	irc_free(irc);
+
+	fail_unless(g_io_channel_read_to_end(ch2, &raw, NULL, NULL) == G_IO_STATUS_NORMAL);
+	fail_unless(strstr(raw, "001") != NULL);
+
+	g_free(raw);
+END_TEST
+
+START_TEST(test_cork)
+	GIOChannel *ch1, *ch2;
+	irc_t *irc;
+	char *raw;
+	fail_unless(g_io_channel_pair(&ch1, &ch2));
+
+	g_io_channel_set_flags(ch2, G_IO_FLAG_NONBLOCK, NULL);
+
+	irc = irc_new(g_io_channel_unix_get_fd(ch1));
+
+	irc_cork();
+	irc_write(irc, "NOTICE a :1");
+	irc_write(irc, "NOTICE a :2");
+	irc_write(irc, "NOTICE a :3");
+	fail_unless(irc->w_watch_source_id == 0);
+	fail_unless(irc->corked);
+	irc_uncork();
+
+	fail_unless(irc->sendbuffer->len == 0);
+	fail_unless(irc->lines_out == 3);
+	fail_unless(irc->writes_out == 1);
+	irc_free(irc);
+
+	fail_unless(g_io_channel_read_to_end(ch2, &raw, NULL, NULL) == G_IO_STATUS_NORMAL);
+	fail_unless(strcmp(raw, "NOTICE a :1\r\nNOTICE a :2\r\nNOTICE a :3\r\n") == 0);
+
+	g_free(raw);
+END_TEST
+
+START_TEST(test_charset)
+	GIOChannel *ch1, *ch2;
+	irc_t *irc;
+	char *raw;
+	fail_unless(g_io_channel_pair(&ch1, &ch2));
+
+	g_io_channel_set_flags(ch2, G_IO_FLAG_NONBLOCK, NULL);
+	g_io_channel_set_encoding(ch2, NULL, NULL);
+
+	irc = irc_new(g_io_channel_unix_get_fd(ch1));
+	fail_unless(irc->charset_utf8 && irc->charset_ascii);
+
+	set_setstr(&irc->b->set, "charset", "iso8859-1");
+	fail_unless(!irc->charset_utf8 && irc->charset_ascii);
+
+	/* Only the second line needs converting. */
+	irc_write(irc, "NOTICE a :plain");
+	irc_write(irc, "NOTICE a :caf\xc3\xa9");
+	irc_flush(irc);
+	irc_free(irc);
+
+	fail_unless(g_io_channel_read_to_end(ch2, &raw, NULL, NULL) == G_IO_STATUS_NORMAL);
+	fail_unless(strcmp(raw, "NOTICE a :plain\r\nNOTICE a :caf\xe9\r\n") == 0);
+
+	g_free(raw);
+END_TEST
+
+START_TEST(test_channel_users)
+	irc_t *irc = torture_irc();
+	irc_channel_t *ic = irc_channel_new(irc, "&test");
+	irc_user_t *b = irc_user_new(irc, "bob"), *a = irc_user_new(irc, "alice");
+	GSList *l;
+
+	fail_unless(irc_channel_add_user(ic, b));
+	fail_unless(irc_channel_add_user(ic, a));
+	fail_if(irc_channel_add_user(ic, a));
+	fail_unless(irc_channel_has_user(ic, a)->iu == a);
+	fail_unless(g_hash_table_size(ic->users) == 3);
+
+	/* alice, bob, root */
+	l = irc_channel_users(ic);
+	fail_unless(g_slist_length(l) == 3);
+	fail_unless(((irc_channel_user_t*)l->data)->iu == a);
+	fail_unless(((irc_channel_user_t*)l->next->data)->iu == b);
+	fail_unless(irc_channel_users(ic) == l);
+
+	/* Renaming has to invalidate the sorted list. */
+	fail_unless(irc_user_set_nick(b, "aaron"));
+	l = irc_channel_users(ic);
+	fail_unless(((irc_channel_user_t*)l->data)->iu == b);
+
+	fail_unless(irc_channel_del_user(ic, a, IRC_CDU_SILENT, NULL));
+	fail_unless(irc_channel_has_user(ic, a) == NULL);
+	fail_unless(g_slist_length(irc_channel_users(ic)) == 2);
+
+	irc_free(irc);
+END_TEST
+
+START_TEST(test_control_channel_index)
+	irc_t *irc = torture_irc();
+	irc_channel_t *ic = irc_channel_new(irc, "&test");
+	bee_group_t *foo, *bar;
+	GSList *l;
+
+	fail_unless(g_slist_find(irc->control_channels_all, ic) != NULL);
+
+	fail_unless(set_setstr(&ic->set, "group", "foo"));
+	fail_unless(set_setstr(&ic->set, "fill_by", "group"));
+	foo = bee_group_by_name(irc->b, "foo", FALSE);
+	fail_unless(g_slist_find(irc->control_channels_all, ic) == NULL);
+	l = g_hash_table_lookup(irc->control_channels, foo);
+	fail_unless(l && l->data == ic && l->next == NULL);
+
+	fail_unless(set_setstr(&ic->set, "group", "bar"));
+	bar = bee_group_by_name(irc->b, "bar", FALSE);
+	fail_unless(g_hash_table_lookup(irc->control_channels, foo) == NULL);
+	fail_unless(g_hash_table_lookup(irc->control_channels, bar) != NULL);
+
+	fail_unless(set_setstr(&ic->set, "type", "chat"));
+	fail_unless(g_hash_table_size(irc->control_channels) == 0);
+	fail_unless(g_slist_find(irc->control_channels_all, ic) == NULL);
+
+	irc_free(irc);
+END_TEST
+
+START_TEST(test_channel_quiet)
+	irc_t *irc = torture_irc();
+	irc_channel_t *ic = irc_channel_new(irc, "&test");
+	irc_user_t *iu = irc_user_new(irc, "bob");
+	guint64 lines;
+
+	ic->flags |= IRC_CHANNEL_JOINED | IRC_CHANNEL_QUIET;
+	lines = irc->lines_out;
+	fail_unless(irc_channel_add_user(ic, iu));
+	irc_channel_user_set_mode(ic, iu, IRC_CHANNEL_USER_VOICE);
+	fail_unless(irc->lines_out == lines);
+	fail_unless(ic->flags & IRC_CHANNEL_NAMES_PENDING);
+	fail_unless(irc_channel_has_user(ic, iu)->flags == IRC_CHANNEL_USER_VOICE);
+
+	irc_free(irc);
+END_TEST
+
+START_TEST(test_channel_lookup)
+	irc_t *irc = torture_irc();
+	irc_channel_t *a = irc_channel_new(irc, "&Test[1]");
+	irc_channel_t *b = irc_channel_new(irc, "#foo");
+	irc_channel_t *c = irc_channel_new(irc, "#bar");
+	char nr[8];
+
+	fail_unless(irc_channel_by_name(irc, "&test{1}") == a);
+	fail_unless(irc_channel_by_name(irc, "&TEST[1]") == a);
+	fail_unless(irc_channel_by_name(irc, "&test") == NULL);
+	fail_unless(irc_channel_new(irc, "#FOO") == NULL);
+
+	irc_channel_rename(b, g_strdup("#Baz"));
+	fail_unless(irc_channel_by_name(irc, "#foo") == NULL);
+	fail_unless(irc_channel_by_name(irc, "#baz") == b);
+
+	/* Numbers don't shift when a channel in front of them goes away,
+	   and the free one gets reused. */
+	g_snprintf(nr, sizeof(nr), "%d", c->id);
+	irc_channel_free(b);
+	fail_unless(irc_channel_get(irc, nr) == c);
+	b = irc_channel_new(irc, "#foo");
+	fail_unless(b->id < c->id && b->id > a->id);
+	fail_unless(irc_channel_get(irc, "#ba") == c);
+
+	irc_free(irc);
+END_TEST
+
 Suite *irc_suite (void)
 {
 	Suite *s = suite_create("IRC");
@@ -61,5 +276,13 @@ Suite *irc_suite (void)
 	suite_add_tcase (s, tc_core);
 	tcase_add_test (tc_core, test_connect);
 	tcase_add_test (tc_core, test_login);
+	tcase_add_test (tc_core, test_tokenize);
+	tcase_add_test (tc_core, test_partial_line);
+	tcase_add_test (tc_core, test_cork);
+	tcase_add_test (tc_core, test_charset);
+	tcase_add_test (tc_core, test_channel_users);
+	tcase_add_test (tc_core, test_control_channel_index);
+	tcase_add_test (tc_core, test_channel_quiet);
+	tcase_add_test (tc_core, test_channel_lookup);
 	return s;
 }
@@ -0,0 +1,276 @@
+#include <stdlib.h>
+#include <glib.h>
+#include <gmodule.h>
+#include <check.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "testsuite.h"
+#include "jabber/jabber.h"
+
+static int logged_out;
+
+/* Same cleanup as jabber_logout(), minus the </stream:stream>. */
+static void fake_logout(struct im_connection *ic)
+{
+	struct jabber_data *jd = ic->proto_data;
+
+	logged_out ++;
+	if (jd == NULL)
+		return;
+
+	jabber_connections = g_slist_remove(jabber_connections, ic);
+	if (jd->r_inpa > 0)
+		b_event_remove(jd->r_inpa);
+	if (jd->w_inpa > 0)
+		b_event_remove(jd->w_inpa);
+	if (jd->fd >= 0)
+		closesocket(jd->fd);
+	xt_free(jd->xt);
+	iobuf_free(jd->rxq);
+	iobuf_free(jd->txq);
+	sm_free(ic);
+	g_free(jd->connect_to);
+	g_free(jd);
+	ic->proto_data = NULL;
+}
+
+static struct prpl fake_prpl = { .name = "jabber", .logout = fake_logout };
+
+/* Reads whatever the "server" got so far. */
+static char *server_read(int fd)
+{
+	static char buf[4096];
+	int st = read(fd, buf, sizeof(buf) - 1);
+
+	buf[st > 0 ? st : 0] = '\0';
+	return buf;
+}
+
+static void server_pkt(struct im_connection *ic, xt_status (*func)(struct xt_node *, gpointer), char *s)
+{
+	struct xt_node *node = xt_from_string(s, 0);
+
+	fail_unless(func(node, ic) == XT_HANDLED);
+	xt_free_node(node);
+}
+
+static void send_msg(struct im_connection *ic, char *id)
+{
+	struct xt_node *node = xt_new_node("message", NULL, xt_new_node("body", "hi", NULL));
+
+	xt_add_attr(node, "id", id);
+	fail_unless(jabber_write_packet(ic, node));
+	xt_free_node(node);
+}
+
+START_TEST(test_sm_resume)
+	irc_t *irc = torture_irc();
+	account_t *acc = account_add(irc->b, &fake_prpl, "me@example.com", "secret");
+	struct im_connection *ic = imcb_new(acc);
+	struct jabber_data *jd = g_new0(struct jabber_data, 1);
+	struct xt_node *node;
+	int fds[2];
+	char *s;
+
+	set_add(&acc->set, "stream_management", "true", NULL, acc);
+	ic->proto_data = jd;
+	jd->ic = ic;
+	jd->rxq = iobuf_new();
+	jd->txq = iobuf_new();
+	jd->r_inpa = jd->w_inpa = -1;
+	jd->xt = xt_new(NULL, ic);
+	jd->flags = JFLAG_SM_SUPPORTED;
+
+	fail_unless(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+	jd->fd = fds[0];
+
+	fail_unless(sm_enable(ic));
+	fail_unless(strstr(server_read(fds[1]), "<enable xmlns=\"urn:xmpp:sm:3\" resume=\"true\"/>") != NULL);
+	server_pkt(ic, sm_pkt_enabled, "<enabled xmlns='urn:xmpp:sm:3' id='abc' resume='true' max='30'/>");
+	fail_unless(strcmp(jd->sm_id, "abc") == 0 && jd->sm_max == 30);
+
+	/* Only stanzas are counted, and they're kept until they're acked. */
+	send_msg(ic, "1");
+	send_msg(ic, "2");
+	send_msg(ic, "3");
+	fail_unless(sm_request(ic, 1));
+	s = server_read(fds[1]);
+	fail_unless(strstr(s, "<message id=\"3\">") && g_str_has_suffix(s, "<r xmlns=\"urn:xmpp:sm:3\"/>"));
+	fail_unless(g_queue_get_length(jd->sm_lens) == 3);
+
+	server_pkt(ic, sm_pkt_a, "<a xmlns='urn:xmpp:sm:3' h='2'/>");
+	fail_unless(g_queue_get_length(jd->sm_lens) == 1);
+	s = iobuf_pullup(jd->sm_unacked);
+	fail_unless(strncmp(s, "<message id=\"3\">", 16) == 0);
+
+	/* Lose the connection. Stanzas get queued, the rest is dropped. */
+	ic->flags |= OPT_LOGGED_IN;
+	fail_unless(sm_lost(ic));
+	fail_unless(jd->fd == -1 && jd->xt == NULL && (jd->flags & JFLAG_SM_RESUMING));
+	send_msg(ic, "4");
+	fail_unless(jabber_write(ic, "\n", 1));
+	fail_unless(jd->txq->len == 0);
+	fail_unless(g_queue_get_length(jd->sm_lens) == 2);
+	close(fds[1]);
+
+	/* New connection, logged in again. */
+	fail_unless(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+	jd->fd = fds[0];
+	jd->xt = xt_new(NULL, ic);
+
+	node = xt_from_string("<message><body>a</body></message>", 0);
+	fail_unless(sm_count(node, ic) == XT_NEXT);
+	xt_free_node(node);
+	fail_unless(sm_resume(ic, TRUE));
+	fail_unless(strstr(server_read(fds[1]), "<resume xmlns=\"urn:xmpp:sm:3\" h=\"1\" previd=\"abc\"/>") != NULL);
+
+	/* The server got #3 before the connection died, so only #4 goes
+	   out again. */
+	server_pkt(ic, sm_pkt_resumed, "<resumed xmlns='urn:xmpp:sm:3' h='3' previd='abc'/>");
+	fail_if(jd->flags & JFLAG_SM_RESUMING);
+	s = server_read(fds[1]);
+	fail_unless(strncmp(s, "<message id=\"4\">", 16) == 0, "%s", s);
+	fail_if(strstr(s, "<message id=\"3\">"));
+
+	server_pkt(ic, sm_pkt_r, "<r xmlns='urn:xmpp:sm:3'/>");
+	fail_unless(strcmp(server_read(fds[1]), "<a xmlns=\"urn:xmpp:sm:3\" h=\"1\"/>") == 0);
+
+	close(fds[0]);
+	close(fds[1]);
+	xt_free(jd->xt);
+	iobuf_free(jd->rxq);
+	iobuf_free(jd->txq);
+	sm_free(ic);
+	g_free(jd);
+	ic->proto_data = NULL;
+	irc_free(irc);
+END_TEST
+
+static int listen_fd, server_fd = -1;
+static GString *greeting;
+
+/* Waits for the reconnect and the new stream header. */
+static gboolean server_poll(gpointer data, gint fd, b_input_condition cond)
+{
+	char buf[512];
+	int st;
+
+	if (server_fd == -1 && (server_fd = accept(listen_fd, NULL, NULL)) >= 0)
+		fcntl(server_fd, F_SETFL, O_NONBLOCK);
+	if (server_fd >= 0 && (st = read(server_fd, buf, sizeof(buf))) > 0)
+		g_string_append_len(greeting, buf, st);
+
+	if (strstr(greeting->str, "<stream:stream")) {
+		b_main_quit();
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static gboolean logout_poll(gpointer data, gint fd, b_input_condition cond)
+{
+	if (logged_out) {
+		b_main_quit();
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static void run_until(b_event_handler func)
+{
+	int quit = b_timeout_add(5000, quit_cb, NULL);
+	int poll = b_timeout_add(10, func, NULL);
+
+	b_main_run();
+	b_event_remove(quit);
+	b_event_remove(poll);
+}
+
+START_TEST(test_sm_dropped)
+	irc_t *irc = torture_irc();
+	account_t *acc = account_add(irc->b, &fake_prpl, "me@example.com", "secret");
+	struct im_connection *ic = imcb_new(acc);
+	struct jabber_data *jd = g_new0(struct jabber_data, 1);
+	struct sockaddr_in sin;
+	socklen_t len = sizeof(sin);
+	char *s;
+	int fds[2];
+
+	set_add(&acc->set, "stream_management", "true", NULL, acc);
+	ic->proto_data = jd;
+	jd->ic = ic;
+	jd->server = "example.com";
+	jd->rxq = iobuf_new();
+	jd->txq = iobuf_new();
+	jd->r_inpa = jd->w_inpa = -1;
+	jd->flags = JFLAG_SM_SUPPORTED;
+	jabber_connections = g_slist_prepend(jabber_connections, ic);
+
+	/* Where sm_reconnect() should go back to. */
+	listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	fail_unless(bind(listen_fd, (struct sockaddr *) &sin, sizeof(sin)) == 0);
+	fail_unless(listen(listen_fd, 1) == 0);
+	getsockname(listen_fd, (struct sockaddr *) &sin, &len);
+	fcntl(listen_fd, F_SETFL, O_NONBLOCK);
+	jd->connect_to = g_strdup("127.0.0.1");
+	jd->connect_port = ntohs(sin.sin_port);
+
+	fail_unless(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+	jd->fd = fds[0];
+	fail_unless(jabber_connected_plain(ic, fds[0], B_EV_IO_WRITE));
+	fail_unless(jd->r_inpa > 0);
+	fail_unless(sm_enable(ic));
+	server_pkt(ic, sm_pkt_enabled, "<enabled xmlns='urn:xmpp:sm:3' id='abc' resume='true' max='30'/>");
+	ic->flags |= OPT_LOGGED_IN;
+	send_msg(ic, "1");
+	server_read(fds[1]);
+
+	/* The server goes away, the read handler has to notice that and
+	   connect again without logging us out. */
+	close(fds[1]);
+	greeting = g_string_new("");
+	run_until(server_poll);
+
+	fail_unless(g_slist_find(jabber_connections, ic) != NULL);
+	fail_unless(jd->flags & JFLAG_SM_RESUMING);
+	fail_unless(jd->fd >= 0 && jd->r_inpa > 0);
+	fail_unless(strstr(greeting->str, "<stream:stream to=\"example.com\"") != NULL, "%s", greeting->str);
+	fail_unless(g_queue_get_length(jd->sm_lens) == 1);
+
+	/* Now it's a pre-XMPP 1.0 server, without stream features, so
+	   there's no way to resume. Log out instead of hanging around. */
+	logged_out = 0;
+	s = "<?xml version='1.0'?><stream:stream xmlns='jabber:client' "
+	    "xmlns:stream='http://etherx.jabber.org/streams' id='x'>";
+	fail_unless(write(server_fd, s, strlen(s)) == strlen(s));
+	run_until(logout_poll);
+	fail_unless(logged_out == 1);
+	fail_unless(acc->ic == NULL);
+	fail_if(strstr(server_read(server_fd), "jabber:iq:auth"));
+
+	close(server_fd);
+	close(listen_fd);
+	g_string_free(greeting, TRUE);
+	irc_free(irc);
+END_TEST
+
+Suite *jabber_sm_suite (void)
+{
+	Suite *s = suite_create("jabber/sm");
+	TCase *tc_core = tcase_create("Core");
+	suite_add_tcase (s, tc_core);
+	tcase_add_test (tc_core, test_sm_resume);
+	tcase_add_test (tc_core, test_sm_dropped);
+	return s;
+}
@@ -6,6 +6,82 @@
 #include "irc.h"
 #include "set.h"
 #include "misc.h"
+#include "bitlbee.h"
+#include "testsuite.h"
+
+/* Fills a fake account with n contacts and checks they all got a unique
+   nick. Timings show up with ./check -v. */
+static void nick_roster(const char *nick_format, const char *handle_fmt, int n, int div)
+{
+	irc_t *irc = torture_irc();
+	struct im_connection *ic;
+	double start;
+	GSList *l;
+	int i, users = 0;
+
+	set_setstr(&irc->b->set, "nick_format", nick_format);
+	ic = torture_ic(irc, "me");
+
+	start = gettime();
+	imcb_roster_begin(ic);
+	for (i = 0; i < n; i++) {
+		char handle[64];
+
+		g_snprintf(handle, sizeof(handle), handle_fmt, i % div, i / div);
+		fail_unless(bee_user_new(irc->b, ic, handle, 0) != NULL);
+	}
+	imcb_roster_end(ic);
+	log_message(LOGLVL_INFO, "%d contacts (%s): %.3fs", n, handle_fmt, gettime() - start);
+
+	for (l = irc->users; l; l = l->next) {
+		irc_user_t *iu = l->data;
+
+		fail_unless(irc_user_by_name(irc, iu->nick) == iu);
+		fail_unless(nick_ok(iu->nick), "Bad nick: %s", iu->nick);
+		users++;
+	}
+	fail_unless(users >= n);
+
+	irc_free(irc);
+}
+
+START_TEST(test_nick_roster_unique)
+	nick_roster("%-@nick", "user%d.%d@example.com", 10000, 10000);
+END_TEST
+
+/* 500 different names, 20 contacts each. */
+START_TEST(test_nick_roster_collide)
+	nick_roster("%-_handle", "u%d_%d@example.com", 10000, 500);
+END_TEST
+
+START_TEST(test_nick_dedupe_reuse)
+	irc_t *irc = torture_irc();
+	struct im_connection *ic;
+	bee_user_t *a, *b, *c;
+
+	set_setstr(&irc->b->set, "nick_format", "%-_handle");
+	ic = torture_ic(irc, "me");
+
+	a = bee_user_new(irc->b, ic, "bob_1", 0);
+	b = bee_user_new(irc->b, ic, "bob_2", 0);
+	c = bee_user_new(irc->b, ic, "bob_3", 0);
+	fail_unless(strcmp(((irc_user_t*)a->ui_data)->nick, "bob") == 0);
+	fail_unless(strcmp(((irc_user_t*)b->ui_data)->nick, "bob_") == 0);
+	fail_unless(strcmp(((irc_user_t*)c->ui_data)->nick, "bob__") == 0);
+
+	/* Freed nicks with fewer underscores get used again. */
+	bee_user_free(irc->b, b);
+	b = bee_user_new(irc->b, ic, "bob_5", 0);
+	fail_unless(strcmp(((irc_user_t*)b->ui_data)->nick, "bob_") == 0);
+
+	/* Saved nicks are found no matter what the case/spacing is. */
+	nick_set_raw(ic->acc, "Bob 4", "robert");
+	c = bee_user_new(irc->b, ic, "bob4", 0);
+	fail_unless(nick_saved(c));
+	fail_unless(strcmp(((irc_user_t*)c->ui_data)->nick, "robert") == 0);
+
+	irc_free(irc);
+END_TEST
 
 START_TEST(test_nick_strip)
 {
@@ -72,5 +148,8 @@ Suite *nick_suite (void)
 	tcase_add_test (tc_core, test_nick_ok_ok);
 	tcase_add_test (tc_core, test_nick_ok_notok);
 	tcase_add_test (tc_core, test_nick_strip);
+	tcase_add_test (tc_core, test_nick_dedupe_reuse);
+	tcase_add_test (tc_core, test_nick_roster_unique);
+	tcase_add_test (tc_core, test_nick_roster_collide);
 	return s;
 }
@@ -100,6 +100,47 @@ START_TEST(test_set_get_int_unknown)
 	fail_unless(set_getint(&s, "foo") == 0);
 END_TEST
 
+START_TEST(test_set_find_case)
+	set_t *s = NULL;
+	set_add(&s, "first", NULL, NULL, NULL);
+	set_add(&s, "Second", NULL, NULL, NULL);
+	fail_unless(set_find(&s, "SECOND") == s->next);
+	fail_unless(set_find(&s, "fIrSt") == s);
+END_TEST
+
+START_TEST(test_set_cached_values)
+	set_t *s = NULL;
+	set_add(&s, "number", "10", NULL, NULL);
+	set_add(&s, "flag", "true", NULL, NULL);
+	fail_unless(set_getint(&s, "number") == 10);
+	fail_unless(set_getbool(&s, "flag"));
+	set_setstr(&s, "number", "-3");
+	set_setstr(&s, "flag", "off");
+	fail_unless(set_getint(&s, "number") == -3);
+	fail_unless(!set_getbool(&s, "flag"));
+	set_reset(&s, "number");
+	fail_unless(set_getint(&s, "number") == 10);
+	set_add(&s, "number", "42", NULL, NULL);
+	fail_unless(set_getint(&s, "number") == 42);
+END_TEST
+
+START_TEST(test_set_del_head)
+	set_t *s = NULL;
+	set_add(&s, "one", "1", NULL, NULL);
+	set_add(&s, "two", "2", NULL, NULL);
+	set_add(&s, "three", "3", NULL, NULL);
+	set_del(&s, "one");
+	fail_unless(set_find(&s, "one") == NULL);
+	fail_unless(set_getint(&s, "three") == 3);
+	set_del(&s, "three");
+	fail_unless(set_find(&s, "three") == NULL);
+	fail_unless(set_getint(&s, "two") == 2);
+	set_del(&s, "two");
+	fail_unless(s == NULL);
+	set_add(&s, "four", "4", NULL, NULL);
+	fail_unless(set_getint(&s, "four") == 4);
+END_TEST
+
 Suite *set_suite (void)
 {
 	Suite *s = suite_create("Set");
@@ -118,5 +159,8 @@ Suite *set_suite (void)
 	tcase_add_test (tc_core, test_set_get_int_unknown);
 	tcase_add_test (tc_core, test_setint);
 	tcase_add_test (tc_core, test_setstr);
+	tcase_add_test (tc_core, test_set_find_case);
+	tcase_add_test (tc_core, test_set_cached_values);
+	tcase_add_test (tc_core, test_set_del_head);
 	return s;
 }
@@ -0,0 +1,80 @@
+#include <stdlib.h>
+#include <glib.h>
+#include <gmodule.h>
+#include <check.h>
+#include <string.h>
+#include <stdio.h>
+#include "slab.h"
+
+struct thing
+{
+	guint64 a;
+	char b[13];
+};
+
+START_TEST(test_alloc_free)
+	slab_t *s = slab_new("thing", sizeof(struct thing));
+	struct thing *t1, *t2;
+
+	t1 = slab_alloc(s);
+	t2 = slab_alloc(s);
+	fail_unless(t1 != t2);
+	fail_unless(t1->a == 0 && t1->b[12] == 0);
+	fail_unless(((gsize) &t1->a) % 8 == 0);
+	fail_unless(s->used == 2 && s->chunks == 1);
+
+	t1->a = 42;
+	slab_free(t1);
+	fail_unless(s->used == 1);
+
+	/* Recycled, and zeroed again. */
+	t1 = slab_alloc(s);
+	fail_unless(t1->a == 0);
+
+	slab_free(t1);
+	slab_free(t2);
+	slab_free(NULL);
+	fail_unless(s->used == 0 && s->chunks == 1);
+
+	slab_destroy(s);
+END_TEST
+
+START_TEST(test_many)
+	slab_t *s = slab_new("thing", sizeof(struct thing));
+	int i, n = s->per_chunk * 5 + 3;
+	struct thing **t = g_new(struct thing *, n);
+
+	for (i = 0; i < n; i ++) {
+		t[i] = slab_alloc(s);
+		t[i]->a = i;
+	}
+	fail_unless(s->chunks == 6);
+	fail_unless(slab_bytes(s) >= n * sizeof(struct thing));
+
+	for (i = 0; i < n; i ++)
+		fail_unless(t[i]->a == i);
+
+	for (i = 0; i < n; i += 2)
+		slab_free(t[i]);
+	fail_unless(s->chunks == 6);
+	/* Empty chunks get freed, except for the last one. */
+	for (i = 1; i < n; i += 2)
+		slab_free(t[i]);
+	fail_unless(s->chunks == 1 && s->used == 0);
+
+	/* Leaving stuff behind is fine. */
+	for (i = 0; i < n; i ++)
+		slab_alloc(s);
+	slab_destroy(s);
+	g_free(t);
+END_TEST
+
+Suite *slab_suite (void)
+{
+	Suite *s = suite_create("Slab");
+	TCase *tc_core = tcase_create("Core");
+	suite_add_tcase (s, tc_core);
+	tcase_add_test (tc_core, test_alloc_free);
+	tcase_add_test (tc_core, test_many);
+	return s;
+}
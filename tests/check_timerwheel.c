@@ -0,0 +1,108 @@
+#include <stdlib.h>
+#include <glib.h>
+#include <gmodule.h>
+#include <check.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "timerwheel.h"
+
+static int due_count(struct tw_timer *due)
+{
+	int n = 0;
+
+	for (; due; due = due->next)
+		n ++;
+
+	return n;
+}
+
+START_TEST(test_add_del)
+	struct tw_wheel w;
+	struct tw_timer a, b;
+
+	tw_init(&w);
+	memset(&a, 0, sizeof(a));
+	memset(&b, 0, sizeof(b));
+
+	fail_unless(tw_next_timeout(&w) == -1);
+
+	tw_add(&w, &a, 1000);
+	tw_add(&w, &b, 3600 * 1000);
+	fail_unless(w.count == 2);
+	fail_unless(tw_next_timeout(&w) <= 1000);
+
+	/* Re-arming shouldn't count twice. */
+	tw_add(&w, &a, 2000);
+	fail_unless(w.count == 2);
+
+	tw_del(&w, &a);
+	tw_del(&w, &b);
+	tw_del(&w, &b);
+	fail_unless(w.count == 0);
+	fail_unless(tw_next_timeout(&w) == -1);
+END_TEST
+
+START_TEST(test_coalesce)
+	struct tw_wheel w;
+	struct tw_timer a, b, c;
+	struct tw_timer *due = NULL;
+
+	tw_init(&w);
+	memset(&a, 0, sizeof(a));
+	memset(&b, 0, sizeof(b));
+	memset(&c, 0, sizeof(c));
+
+	/* These two are due within the same tick. */
+	tw_add(&w, &a, 1);
+	tw_add(&w, &b, TW_TICK - 1);
+	tw_add(&w, &c, 60 * 1000);
+
+	fail_unless(tw_next_timeout(&w) <= TW_TICK * 2);
+	usleep(TW_TICK * 3 * 1000);
+
+	tw_advance(&w, &due);
+	fail_unless(due_count(due) == 2);
+	fail_unless(w.count == 1);
+
+	/* Removing something from the due list is fine too. */
+	tw_del(&w, &a);
+	fail_unless(due_count(due) == 1);
+	fail_unless(w.count == 1);
+
+	tw_del(&w, &c);
+	fail_unless(w.count == 0);
+END_TEST
+
+START_TEST(test_cascade)
+	struct tw_wheel w;
+	struct tw_timer a;
+	struct tw_timer *due = NULL;
+
+	tw_init(&w);
+	memset(&a, 0, sizeof(a));
+
+	/* Pretend the wheel is lagging behind a bit, so this one has to go
+	   through a higher level first. */
+	w.now -= TW_SIZE;
+	tw_add(&w, &a, TW_TICK * 3);
+	fail_unless(a.list < &w.slot[0][0] || a.list >= &w.slot[1][0]);
+
+	tw_advance(&w, &due);
+	fail_unless(due_count(due) == 0);
+	usleep(TW_TICK * 5 * 1000);
+	tw_advance(&w, &due);
+	fail_unless(due_count(due) == 1);
+	fail_unless(w.count == 0);
+END_TEST
+
+Suite *timerwheel_suite (void)
+{
+	Suite *s = suite_create("TimerWheel");
+	TCase *tc_core = tcase_create("Core");
+	suite_add_tcase (s, tc_core);
+	tcase_add_test (tc_core, test_add_del);
+	tcase_add_test (tc_core, test_coalesce);
+	tcase_add_test (tc_core, test_cascade);
+	return s;
+}
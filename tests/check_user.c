@@ -59,6 +59,44 @@ START_TEST(test_user_rename)
 	fail_if(user_find(irc, "bar") == NULL);
 END_TEST
 #endif
+
+START_TEST(test_presence_delay)
+	irc_t *irc = torture_irc();
+	struct im_connection *ic = torture_ic(irc, "me");
+	bee_user_t *bu = bee_user_new(irc->b, ic, "bob", 0);
+	irc_user_t *iu = bu->ui_data;
+	guint64 in = irc->b->presence_in;
+
+	set_setstr(&irc->b->set, "presence_delay", "50");
+
+	/* Flapping: the UI doesn't see anything until the timer goes off,
+	   and only the first update counts. */
+	fail_unless(iu->flags & IRC_USER_AWAY);
+	imcb_buddy_status(ic, "bob", OPT_LOGGED_IN, NULL, NULL);
+	imcb_buddy_status(ic, "bob", OPT_LOGGED_IN | OPT_AWAY, NULL, NULL);
+	imcb_buddy_status(ic, "bob", OPT_LOGGED_IN, NULL, NULL);
+	fail_unless(iu->flags & IRC_USER_AWAY);
+	fail_unless(irc->b->presence_in == in + 3);
+	fail_unless(irc->b->presence_absorbed == 2);
+
+	b_timeout_add(200, quit_cb, NULL);
+	b_main_run();
+	fail_if(iu->flags & IRC_USER_AWAY);
+	fail_unless(ic->status_timer == 0 && bu->status_old == NULL);
+	fail_unless(irc->b->presence_absorbed == 2);
+
+	/* No net change at all means the UI isn't told, but that counts as
+	   absorbed too. */
+	imcb_buddy_status(ic, "bob", 0, NULL, NULL);
+	imcb_buddy_status(ic, "bob", OPT_LOGGED_IN, NULL, NULL);
+	b_timeout_add(200, quit_cb, NULL);
+	b_main_run();
+	fail_unless(irc->b->presence_absorbed == 4);
+	fail_if(iu->flags & IRC_USER_AWAY);
+
+	irc_free(irc);
+END_TEST
+
 Suite *user_suite (void)
 {
 	Suite *s = suite_create("User");
@@ -73,5 +111,6 @@ Suite *user_suite (void)
 	tcase_add_test (tc_core, test_user_del);
 	tcase_add_test (tc_core, test_user_rename);
 #endif
+	tcase_add_test (tc_core, test_presence_delay);
 	return s;
 }
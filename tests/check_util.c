@@ -43,6 +43,44 @@ START_TEST(test_strip_newlines)
 }
 END_TEST
 
+START_TEST(test_str_is_ascii)
+	char buf[64];
+	int i, j;
+
+	memset(buf, 'a', sizeof(buf));
+	fail_unless(str_is_ascii(buf, sizeof(buf)));
+	fail_unless(str_is_ascii(buf, 0));
+
+	/* Try a high byte in every position and alignment. */
+	for (i = 0; i < 16; i++)
+		for (j = i; j < sizeof(buf); j++) {
+			buf[j] = 0xe9;
+			fail_if(str_is_ascii(buf + i, sizeof(buf) - i), "%d %d", i, j);
+			fail_unless(str_is_ascii(buf + i, j - i), "%d %d", i, j);
+			buf[j] = 'a';
+		}
+END_TEST
+
+START_TEST(test_str_ref)
+	char buf[] = "Away";
+	const char *a, *b;
+
+	fail_unless(str_ref(NULL) == NULL);
+
+	a = str_ref(buf);
+	b = str_ref("Away");
+	fail_unless(a == b);
+	fail_unless(a != buf && strcmp(a, "Away") == 0);
+
+	/* Equal but not interned, shouldn't do anything. */
+	str_unref(buf);
+	str_unref(b);
+	fail_unless(str_ref("Away") == a);
+	str_unref(a);
+	str_unref(a);
+	str_unref(NULL);
+END_TEST
+
 START_TEST(test_set_url_http)
 	url_t url;
 	
@@ -175,6 +213,8 @@ Suite *util_suite (void)
 	suite_add_tcase (s, tc_core);
 	tcase_add_test (tc_core, test_strip_linefeed);
 	tcase_add_test (tc_core, test_strip_newlines);
+	tcase_add_test (tc_core, test_str_is_ascii);
+	tcase_add_test (tc_core, test_str_ref);
 	tcase_add_test (tc_core, test_set_url_http);
 	tcase_add_test (tc_core, test_set_url_https);
 	tcase_add_test (tc_core, test_set_url_port);
@@ -0,0 +1,205 @@
+#include <stdlib.h>
+#include <glib.h>
+#include <gmodule.h>
+#include <check.h>
+#include <string.h>
+#include <stdio.h>
+#include "iobuf.h"
+#include "xmltree.h"
+
+START_TEST(test_big_roster)
+	GString *s = g_string_new("<query xmlns='jabber:iq:roster'>");
+	struct xt_node *x, *c;
+	int i;
+
+	for (i = 0; i < 5000; i++)
+		g_string_append_printf(s, "<item jid='user%d@example.com' subscription='both'>"
+		                          "<group>Friends</group></item>", i);
+	g_string_append(s, "</query>");
+
+	x = xt_from_string(s->str, s->len);
+	fail_if(x == NULL);
+	fail_unless(strcmp(xt_find_attr(x, "xmlns"), "jabber:iq:roster") == 0);
+
+	for (i = 0, c = x->children; c; c = c->next, i++) {
+		char jid[32];
+
+		g_snprintf(jid, sizeof(jid), "user%d@example.com", i);
+		fail_unless(strcmp(xt_find_attr(c, "jid"), jid) == 0);
+		fail_unless(c->parent == x);
+		fail_unless(strcmp(c->children->text, "Friends") == 0);
+		/* Common names don't get copied. */
+		fail_unless(c->name == x->children->name);
+	}
+	fail_unless(i == 5000);
+
+	xt_free_node(x);
+	g_string_free(s, TRUE);
+END_TEST
+
+static xt_status count_handler(struct xt_node *node, gpointer data)
+{
+	GString *seen = data;
+
+	g_string_append(seen, xt_find_attr(node, "id"));
+	return XT_HANDLED;
+}
+
+static const struct xt_handler_entry count_handlers[] = {
+	{ "message", "stream:stream", count_handler },
+	{ NULL, NULL, NULL }
+};
+
+START_TEST(test_stream)
+	GString *seen = g_string_new("");
+	struct xt_parser *xt = xt_new(count_handlers, seen);
+	const char *in[] = { "<stream:stream xmlns:stream='x'>",
+	                     "<message id='1'><body>he", "llo</body></message>",
+	                     "<message id='2'/><message id='3'><bo", "dy/></message>",
+	                     "<message id='4'>", "</message>", NULL };
+	int i;
+
+	for (i = 0; in[i]; i++) {
+		fail_unless(xt_feed(xt, in[i], strlen(in[i])) == 1);
+		if (i == 2)
+			fail_unless(strcmp(xt->root->children->children->text, "hello") == 0);
+		fail_unless(xt_handle(xt, NULL, 1));
+		xt_cleanup(xt, NULL, 1);
+	}
+
+	fail_unless(strcmp(seen->str, "1234") == 0);
+	fail_unless(xt->root->children == NULL);
+
+	xt_free(xt);
+	g_string_free(seen, TRUE);
+END_TEST
+
+START_TEST(test_modify_parsed)
+	struct xt_node *x = xt_from_string("<iq type='get' from='a' to='b'><query/></iq>", 0), *d;
+	char *s;
+
+	xt_add_attr(x, "id", "1");
+	xt_add_attr(x, "type", "result");
+	xt_add_attr(x, "to", xt_find_attr(x, "from"));
+	fail_unless(xt_remove_attr(x, "from"));
+	xt_add_child(x->children, xt_new_node("item", "text", NULL));
+
+	s = xt_to_string(x);
+	fail_unless(strcmp(s, "<iq type=\"result\" id=\"1\" to=\"a\"><query><item>text</item></query></iq>") == 0);
+	g_free(s);
+
+	d = xt_dup(x);
+	fail_if(d->flags & XT_ARENA);
+	xt_free_node(x);
+
+	s = xt_to_string(d);
+	fail_unless(strcmp(s, "<iq type=\"result\" id=\"1\" to=\"a\"><query><item>text</item></query></iq>") == 0);
+	g_free(s);
+	xt_free_node(d);
+END_TEST
+
+static xt_status stream_any(struct xt_node *node, gpointer data)
+{
+	g_string_append_c(data, '*');
+	return XT_NEXT;
+}
+
+static xt_status stream_msg(struct xt_node *node, gpointer data)
+{
+	/* Earlier stanzas are gone already. */
+	fail_unless(node->parent->children == node && node->next == NULL);
+	g_string_append(data, xt_find_attr(node, "id"));
+	return XT_HANDLED;
+}
+
+static xt_status stream_quit(struct xt_node *node, gpointer data)
+{
+	struct xt_parser **xt = data;
+
+	xt_free(*xt);
+	*xt = NULL;
+	return XT_ABORT;
+}
+
+static const struct xt_handler_entry stream_handlers[] = {
+	{ NULL, "stream:stream", stream_any },
+	{ "MESSAGE", "stream:stream", stream_msg },
+	{ NULL, NULL, NULL }
+};
+
+static const struct xt_handler_entry quit_handlers[] = {
+	{ "stream:error", "stream:stream", stream_quit },
+	{ NULL, NULL, NULL }
+};
+
+START_TEST(test_stream_dispatch)
+	GString *seen = g_string_new("");
+	struct xt_parser *xt = xt_new_stream(stream_handlers, seen);
+	const char *in = "<stream:stream xmlns:stream='x'><message id='1'><body>hi</body></message>"
+	                 "<presence/><message id='2'/><mess";
+
+	fail_unless(xt_feed(xt, in, strlen(in)) == 1);
+	fail_unless(strcmp(seen->str, "*1**2") == 0);
+	fail_unless(xt->root->children == NULL);
+	fail_unless(xt_feed(xt, "age id='3'/></stream:stream>", 28) == 0);
+	fail_unless(strcmp(seen->str, "*1**2*3") == 0);
+
+	xt_free(xt);
+	g_string_free(seen, TRUE);
+END_TEST
+
+START_TEST(test_stream_abort)
+	struct xt_parser *xt = xt_new_stream(quit_handlers, &xt);
+	const char *in = "<stream:stream xmlns:stream='x'><stream:error/><message/>";
+
+	/* The handler frees the parser while it's still parsing. */
+	fail_unless(xt_feed(xt, in, strlen(in)) == 0);
+	fail_unless(xt == NULL);
+END_TEST
+
+START_TEST(test_serialize)
+	const char *text = "a < b & \"c\" > 'd' \x01\x1f\x7f \xc2\x80\xc2\x85\xc2\x9f \xc3\xa9";
+	struct xt_node *x = xt_new_node("message", NULL, xt_new_node("body", text, NULL));
+	iobuf_t *b = iobuf_new();
+	char *s, *esc, *exp;
+
+	xt_add_attr(x, "to", "<a&b>");
+	xt_add_child(x, xt_new_node("active", NULL, NULL));
+
+	/* xt_new_node() strips most control characters, put them back. */
+	g_free(x->children->text);
+	x->children->text = g_strdup(text);
+	x->children->text_len = strlen(text);
+
+	esc = g_markup_escape_text(text, -1);
+	exp = g_strdup_printf("<message to=\"&lt;a&amp;b&gt;\"><body>%s</body><active/></message>", esc);
+
+	s = xt_to_string(x);
+	fail_unless(strcmp(s, exp) == 0, "%s", s);
+	g_free(s);
+
+	iobuf_append(b, "x", 1);
+	xt_to_iobuf(x, b);
+	s = iobuf_pullup(b);
+	fail_unless(b->len == strlen(exp) + 1);
+	fail_unless(s[0] == 'x' && memcmp(s + 1, exp, strlen(exp)) == 0);
+
+	iobuf_free(b);
+	g_free(esc);
+	g_free(exp);
+	xt_free_node(x);
+END_TEST
+
+Suite *xmltree_suite (void)
+{
+	Suite *s = suite_create("XMLTree");
+	TCase *tc_core = tcase_create("Core");
+	suite_add_tcase (s, tc_core);
+	tcase_add_test (tc_core, test_big_roster);
+	tcase_add_test (tc_core, test_stream);
+	tcase_add_test (tc_core, test_modify_parsed);
+	tcase_add_test (tc_core, test_stream_dispatch);
+	tcase_add_test (tc_core, test_stream_abort);
+	tcase_add_test (tc_core, test_serialize);
+	return s;
+}
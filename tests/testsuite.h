@@ -1,9 +1,11 @@
 #ifndef __BITLBEE_CHECK_H__
 #define __BITLBEE_CHECK_H__ 
 
-#include "irc.h"
+#include "bitlbee.h"
 
 irc_t *torture_irc(void);
+struct im_connection *torture_ic(irc_t *irc, const char *user);
+gboolean quit_cb(gpointer data, gint fd, b_input_condition cond);
 gboolean g_io_channel_pair(GIOChannel **ch1, GIOChannel **ch2);
 
 #endif /* __BITLBEE_CHECK_H__ */
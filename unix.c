@@ -120,6 +120,15 @@ int main( int argc, char *argv[] )
 		log_link( LOGLVL_ERROR, LOGOUTPUT_CONSOLE );
 		log_link( LOGLVL_WARNING, LOGOUTPUT_CONSOLE );
 
+		/* Workers that die get replaced by a fresh copy of ourselves. */
+		global.argv = argv;
+		global.cwd = g_malloc( 256 );
+		if( getcwd( global.cwd, 255 ) == NULL )
+		{
+			g_free( global.cwd );
+			global.cwd = NULL;
+		}
+		
 		i = bitlbee_daemon_init();
 		log_message( LOGLVL_INFO, "%s %s starting in daemon mode.", PACKAGE, BITLBEE_VERSION );
 	}
@@ -180,6 +189,10 @@ int main( int argc, char *argv[] )
 	if( !getuid() || !geteuid() )
 		log_message( LOGLVL_WARNING, "BitlBee is running with root privileges. Why?" );
 	
+	/* Send all output generated in one event loop iteration at once. */
+	irc_cork();
+	b_main_set_flush( irc_flush_corked );
+	
 	b_main_run();
 	
 	/* Mainly good for restarting, to make sure we close the help.txt fd. */
@@ -302,6 +315,8 @@ static void sighandler( int signal )
 		
 		while( ( pid = waitpid( 0, &st, WNOHANG ) ) > 0 )
 		{
+			bitlbee_daemon_worker_exited( pid );
+			
 			if( WIFSIGNALED( st ) )
 				log_message( LOGLVL_INFO, "Client %d terminated normally. (status = %d)", (int) pid, WEXITSTATUS( st ) );
 			else if( WIFEXITED( st ) )
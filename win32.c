@@ -242,6 +242,7 @@ void conf_loaddefaults( irc_t *irc )
 		{
 			if( s->def ) g_free( s->def );
 			s->def = g_strdup( data );
+			set_parse( s );
 		}
 
 		namelen = sizeof(name);